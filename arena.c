@@ -0,0 +1,77 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+// The alignment of every allocation (enough for pointers and integers)
+#define ARENA_ALIGN 8
+// The smallest heap block an arena grows by
+#define ARENA_BLOCK_MIN 4096
+
+// arena_init
+// Sets up an arena over a buffer; the buffer must outlive the arena
+// Parameters: a, the arena; buf, the first buffer to allocate from (may be NULL); size, its size in bytes
+// Returns: none
+void arena_init(struct arena* a, void* buf, size_t size) {
+	// Align the start of the buffer so every allocation is aligned
+	uintptr_t start = ((uintptr_t) buf + ARENA_ALIGN - 1) & ~(uintptr_t) (ARENA_ALIGN - 1);
+	uintptr_t end = (uintptr_t) buf + size;
+	a->cur = (buf == NULL || start > end) ? NULL : (char*) start;
+	a->end = (a->cur == NULL) ? NULL : (char*) end;
+	a->blocks = NULL;
+}
+
+// arena_alloc
+// Allocates memory from an arena, adding a heap block if the current one is full
+// Parameters: a, the arena; size, the number of bytes
+// Returns: a pointer to the memory (aligned to 8 bytes), or NULL if a block could not be allocated
+void* arena_alloc(struct arena* a, size_t size) {
+	size = (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+
+	if (a->cur == NULL || (size_t) (a->end - a->cur) < size) {
+		// Start a new block at least twice the size of the last one, so the number of blocks stays logarithmic
+		size_t block_size = (a->blocks != NULL) ? a->blocks->size * 2 : ARENA_BLOCK_MIN;
+		if (block_size < size) block_size = size;
+		struct arena_block* block = (struct arena_block*) malloc(sizeof(struct arena_block) + block_size);
+		if (block == NULL) return NULL;
+		block->size = block_size;
+		block->next = a->blocks;
+		a->blocks = block;
+		a->cur = block->data;
+		a->end = block->data + block_size;
+	}
+
+	void* p = a->cur;
+	a->cur += size;
+	return p;
+}
+
+// arena_strndup
+// Copies up to n characters of a string into an arena
+// Parameters: a, the arena; s, the string; n, the maximum number of characters to copy
+// Returns: the null-terminated copy, or NULL if it could not be allocated
+char* arena_strndup(struct arena* a, const char* s, size_t n) {
+	size_t len = strnlen(s, n);
+	char* copy = (char*) arena_alloc(a, len + 1);
+	if (copy == NULL) return NULL;
+	memcpy(copy, s, len);
+	copy[len] = '\0';
+	return copy;
+}
+
+// arena_free
+// Releases every heap block of an arena; the arena may be reused after arena_init()
+// Parameters: the arena
+// Returns: none
+void arena_free(struct arena* a) {
+	struct arena_block* block = a->blocks;
+	while (block != NULL) {
+		struct arena_block* next = block->next;
+		free(block);
+		block = next;
+	}
+	a->blocks = NULL;
+	a->cur = NULL;
+	a->end = NULL;
+}
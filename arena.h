@@ -0,0 +1,28 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// struct arena_block
+// A heap block an arena overflows into once its first buffer is full
+struct arena_block {
+	struct arena_block* next;   // The previously added block
+	size_t size;                // The usable size of data[]
+	char data[];
+};
+
+// struct arena
+// A bump allocator: allocations are carved out of a caller-provided buffer and then out of
+// heap blocks, and are all released at once by arena_free()
+struct arena {
+	char* cur;                  // The next free byte of the current block
+	char* end;                  // The end of the current block
+	struct arena_block* blocks; // The heap blocks, newest first
+};
+
+void arena_init(struct arena* a, void* buf, size_t size);
+void* arena_alloc(struct arena* a, size_t size);
+char* arena_strndup(struct arena* a, const char* s, size_t n);
+void arena_free(struct arena* a);
+
+#endif
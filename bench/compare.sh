@@ -0,0 +1,20 @@
+#!/bin/sh
+# compare.sh
+# Compares two result files saved from "make bench" (for example from two builds), record by record
+# Usage: sh bench/compare.sh old.tsv new.tsv
+
+if [ $# -ne 2 ]; then
+	echo "usage: $0 old.tsv new.tsv" >&2
+	exit 1
+fi
+
+# Print each record found in both files with its old and new value and the change in percent;
+# "#" lines are comments describing the build
+awk -F '\t' '
+	/^#/ { next }
+	NR == FNR { old[$1] = $2; next }
+	$1 in old {
+		change = (old[$1] != 0) ? ($2 - old[$1]) / old[$1] * 100 : 0
+		printf "%-48s %12s %12s %+8.1f%%  %s\n", $1, old[$1], $2, change, $3
+	}
+' "$1" "$2"
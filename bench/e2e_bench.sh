@@ -0,0 +1,101 @@
+#!/bin/sh
+# e2e_bench.sh
+# Measures end-to-end command throughput of smallsh with each spawn engine: trivial foreground
+# commands, background jobs, and commands with both I/O redirects; then the per-command cost of
+# the in-shell echo builtin against launching /bin/echo, of expanding a pattern against a
+# large directory with its listing cached against rescanning it each time, and of running a
+# command as N lines against a repeat loop that parses it once
+# Prints one "name<TAB>value<TAB>unit" record per measurement
+# Usage: sh bench/e2e_bench.sh [number of commands] [path to smallsh]
+
+N=${1:-2000}
+SHELL_BIN=${2:-./smallsh}
+
+TMPDIR=$(mktemp -d)
+trap 'rm -rf "$TMPDIR"' EXIT
+
+# make_script
+# Writes a script of N copies of a command line, ending with exit
+# Usage: make_script file line
+make_script() {
+	i=0
+	while [ $i -lt "$N" ]; do
+		echo "$2"
+		i=$((i + 1))
+	done > "$1"
+	echo "exit" >> "$1"
+}
+
+# Absolute paths, so PATH search cost is excluded
+make_script "$TMPDIR/foreground" "/bin/true"
+make_script "$TMPDIR/background" "/bin/true &"
+printf 'line one\nline two\n' > "$TMPDIR/in.txt"
+make_script "$TMPDIR/redirect" "/bin/cat < $TMPDIR/in.txt > $TMPDIR/out.txt"
+make_script "$TMPDIR/builtin" "echo hello > $TMPDIR/out.txt"
+make_script "$TMPDIR/external" "/bin/echo hello > $TMPDIR/out.txt"
+
+# A directory of 2000 files, half of which match; its mtime is set back so the listing can be cached
+mkdir "$TMPDIR/many"
+i=0
+while [ $i -lt 1000 ]; do
+	: > "$TMPDIR/many/file$i.log"
+	: > "$TMPDIR/many/file$i.txt"
+	i=$((i + 1))
+done
+touch -d '1 minute ago' "$TMPDIR/many"
+make_script "$TMPDIR/cached" "true $TMPDIR/many/*.log"
+# "hash -r" drops the listing, so every expansion reads the directory again
+i=0
+while [ $i -lt "$N" ]; do
+	echo "hash -r"
+	echo "true $TMPDIR/many/*.log"
+	i=$((i + 1))
+done > "$TMPDIR/rescan"
+echo "exit" >> "$TMPDIR/rescan"
+
+# The same command as N lines, as one loop, and as one loop running 8 iterations at once
+make_script "$TMPDIR/lines" "echo hello \$HOME > /dev/null"
+printf 'repeat %d echo hello $HOME > /dev/null\nexit\n' "$N" > "$TMPDIR/repeat"
+printf 'repeat -j 8 %d /bin/true\nexit\n' "$N" > "$TMPDIR/repeat-j8"
+
+for scenario in foreground background redirect; do
+	for engine in fork vfork posix; do
+		start=$(date +%s%N)
+		"$SHELL_BIN" --spawn=$engine "$TMPDIR/$scenario" > /dev/null
+		end=$(date +%s%N)
+		elapsed=$((end - start))
+		printf 'e2e/%s/%s/total\t%d\tms\n' "$scenario" "$engine" $((elapsed / 1000000))
+		printf 'e2e/%s/%s/latency\t%d\tus/command\n' "$scenario" "$engine" $((elapsed / N / 1000))
+	done
+done
+
+# The echo builtin skips the launch entirely; /bin/echo is launched with the default engine
+for scenario in builtin external; do
+	start=$(date +%s%N)
+	"$SHELL_BIN" "$TMPDIR/$scenario" > /dev/null
+	end=$(date +%s%N)
+	elapsed=$((end - start))
+	printf 'e2e/echo/%s/total\t%d\tms\n' "$scenario" $((elapsed / 1000000))
+	printf 'e2e/echo/%s/latency\t%d.%03d\tus/command\n' "$scenario" $((elapsed / N / 1000)) $((elapsed / N % 1000))
+done
+
+# Both run the true builtin, so the expansion dominates
+for scenario in cached rescan; do
+	start=$(date +%s%N)
+	"$SHELL_BIN" "$TMPDIR/$scenario" > /dev/null
+	end=$(date +%s%N)
+	elapsed=$((end - start))
+	printf 'e2e/glob/%s/total\t%d\tms\n' "$scenario" $((elapsed / 1000000))
+	printf 'e2e/glob/%s/latency\t%d.%03d\tus/command\n' "$scenario" $((elapsed / N / 1000)) $((elapsed / N % 1000))
+done
+
+# The echo builtin runs in the shell, so parsing is a large part of each line's cost; the concurrent
+# loop launches /bin/true, so it goes at the launch rate
+for scenario in lines repeat repeat-j8; do
+	start=$(date +%s%N)
+	"$SHELL_BIN" "$TMPDIR/$scenario" > /dev/null
+	end=$(date +%s%N)
+	elapsed=$((end - start))
+	printf 'e2e/loop/%s/total\t%d\tms\n' "$scenario" $((elapsed / 1000000))
+	printf 'e2e/loop/%s/latency\t%d.%03d\tus/command\n' "$scenario" $((elapsed / N / 1000)) $((elapsed / N % 1000))
+done
@@ -0,0 +1,203 @@
+// parse_alloc.c
+// Compares the heap allocations and time per command line of the original per-token parser
+// with the arena parser in parse.c
+// Build and run with "make bench/parse_alloc && bench/parse_alloc", or with the rest of the suite by "make bench"
+// Prints one "name<TAB>value<TAB>unit" record per measurement
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "parse.h"
+
+// The number of times each line is parsed
+#define ITERATIONS 200000
+
+// Allocation counters, fed by the linker's --wrap of the allocation functions
+static volatile unsigned long n_allocs = 0;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* p, size_t size);
+
+void* __wrap_malloc(size_t size) {
+	n_allocs++;
+	return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t n, size_t size) {
+	n_allocs++;
+	return __real_calloc(n, size);
+}
+
+void* __wrap_realloc(void* p, size_t size) {
+	n_allocs++;
+	return __real_realloc(p, size);
+}
+
+// The original parser: a calloc'd command struct with a fixed argv, and a malloc'd copy of every token
+
+struct legacy_command {
+	char* cmd;
+	int argc;
+	char* argv[512];
+	char* i_file, * o_file;
+	bool background;
+};
+
+struct legacy_pipeline {
+	int n_cmds;
+	struct legacy_command** cmds;
+	bool background;
+};
+
+static void legacy_free_command(struct legacy_command* cmd) {
+	free(cmd->cmd);
+	for (int i = 0; i < cmd->argc; i++) {
+		free(cmd->argv[i]);
+	}
+	free(cmd->i_file);
+	free(cmd->o_file);
+	free(cmd);
+}
+
+static void legacy_free_pipeline(struct legacy_pipeline* pl) {
+	for (int i = 0; i < pl->n_cmds; i++) {
+		legacy_free_command(pl->cmds[i]);
+	}
+	free(pl->cmds);
+	free(pl);
+}
+
+static void legacy_parse_cmd_args(struct legacy_command* cmd, char** cmd_buf) {
+	char* token, * saveptr;
+	token = strtok_r(*cmd_buf, " ", &saveptr);
+	cmd->cmd = (char*) malloc(sizeof(char) * (strlen(token) + 1));
+	strncpy(cmd->cmd, token, strlen(token) + 1);
+	cmd->argv[0] = (char*) malloc(sizeof(char) * (strlen(cmd->cmd) + 1));
+	strncpy(cmd->argv[0], cmd->cmd, strlen(cmd->cmd) + 1);
+	token = strtok_r(NULL, " ", &saveptr);
+	cmd->argc = 1;
+	while (token != NULL) {
+		cmd->argv[cmd->argc] = (char*) malloc(sizeof(char) * (strlen(token) + 1));
+		strncpy(cmd->argv[cmd->argc], token, strlen(token) + 1);
+		cmd->argc++;
+		token = strtok_r(NULL, " ", &saveptr);
+	}
+	if (strcmp(cmd->argv[cmd->argc - 1], "&") == 0) {
+		cmd->background = true;
+		free(cmd->argv[cmd->argc - 1]);
+		cmd->argv[cmd->argc - 1] = NULL;
+		cmd->argc--;
+	} else {
+		cmd->background = false;
+	}
+}
+
+static void legacy_parse_cmd_io_files(struct legacy_command* cmd) {
+	cmd->i_file = NULL;
+	cmd->o_file = NULL;
+	int args_removed = 0;
+	for (int i = 1; i < cmd->argc - 1; i++) {
+		char* arg = cmd->argv[i];
+		if (strcmp(arg, "<") == 0 || strcmp(arg, ">") == 0) {
+			int file_len = strlen(cmd->argv[i + 1]);
+			if (file_len > FILE_NAME_MAX) file_len = FILE_NAME_MAX;
+			char* file = (char*) malloc(sizeof(char) * (file_len + 1));
+			strncpy(file, cmd->argv[i + 1], file_len + 1);
+			if (arg[0] == '<') {
+				cmd->i_file = file;
+			} else {
+				cmd->o_file = file;
+			}
+			free(cmd->argv[i]);
+			cmd->argv[i] = NULL;
+			free(cmd->argv[i + 1]);
+			cmd->argv[i + 1] = NULL;
+			i++;
+			args_removed += 2;
+		}
+	}
+	cmd->argc -= args_removed;
+}
+
+static struct legacy_pipeline* legacy_parse_pipeline(char** cmd_buf) {
+	int n_stages = 1;
+	for (char* c = *cmd_buf; *c != '\0'; c++) {
+		if (*c == '|') n_stages++;
+	}
+	struct legacy_pipeline* pl = (struct legacy_pipeline*) calloc(1, sizeof(struct legacy_pipeline));
+	pl->cmds = (struct legacy_command**) calloc(n_stages, sizeof(struct legacy_command*));
+	char* stage = *cmd_buf;
+	for (int i = 0; i < n_stages; i++) {
+		char* bar = strchr(stage, '|');
+		if (bar != NULL) *bar = '\0';
+		struct legacy_command* cmd = (struct legacy_command*) calloc(1, sizeof(struct legacy_command));
+		legacy_parse_cmd_args(cmd, &stage);
+		legacy_parse_cmd_io_files(cmd);
+		pl->cmds[pl->n_cmds++] = cmd;
+		if (bar != NULL) stage = bar + 1;
+	}
+	pl->background = pl->cmds[pl->n_cmds - 1]->background;
+	if (pl->background) {
+		if (pl->cmds[0]->i_file == NULL) pl->cmds[0]->i_file = strdup("/dev/null");
+		if (pl->cmds[pl->n_cmds - 1]->o_file == NULL) pl->cmds[pl->n_cmds - 1]->o_file = strdup("/dev/null");
+	}
+	return pl;
+}
+
+// now_ns
+// Reads the monotonic clock
+// Parameters: none
+// Returns: the time in nanoseconds
+static double now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// bench_line
+// Parses a line repeatedly with both parsers and prints records of the allocations and time per parse
+// Parameters: name, a label for the line; line, the command line
+// Returns: none
+static void bench_line(const char* name, const char* line) {
+	char buf[2049];
+
+	n_allocs = 0;
+	double start = now_ns();
+	for (int i = 0; i < ITERATIONS; i++) {
+		strncpy(buf, line, sizeof(buf));
+		char* p = buf;
+		legacy_free_pipeline(legacy_parse_pipeline(&p));
+	}
+	double legacy_ns = (now_ns() - start) / ITERATIONS;
+	double legacy_allocs = (double) n_allocs / ITERATIONS;
+
+	n_allocs = 0;
+	start = now_ns();
+	for (int i = 0; i < ITERATIONS; i++) {
+		free_pipeline(parse_pipeline(line));
+	}
+	double arena_ns = (now_ns() - start) / ITERATIONS;
+	double arena_allocs = (double) n_allocs / ITERATIONS;
+
+	printf("parse_alloc/%s/legacy/allocs\t%.1f\tallocs/line\n", name, legacy_allocs);
+	printf("parse_alloc/%s/legacy/time\t%.1f\tns/line\n", name, legacy_ns);
+	printf("parse_alloc/%s/arena/allocs\t%.1f\tallocs/line\n", name, arena_allocs);
+	printf("parse_alloc/%s/arena/time\t%.1f\tns/line\n", name, arena_ns);
+}
+
+int main(void) {
+	// A line with many arguments
+	char many[2049] = "echo";
+	for (int i = 0; i < 200; i++) strcat(many, " arg");
+
+	bench_line("simple", "ls -la /tmp");
+	bench_line("redirect", "sort -rn < input.txt > output.txt");
+	bench_line("pipeline", "cat < access.log | grep GET | sort | uniq -c > counts.txt");
+	bench_line("background", "sleep 5 &");
+	bench_line("many-args", many);
+	return 0;
+}
@@ -0,0 +1,120 @@
+// parse_lex.c
+// Measures command-line parsing throughput: the original expand_sh_vars() + strtok_r() passes
+// against the single-pass lexer in parse.c, on lines of increasing length
+// Build and run with "make bench/parse_lex && bench/parse_lex", or with the rest of the suite by "make bench"
+// Prints one "name<TAB>value<TAB>unit" record per measurement
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "parse.h"
+
+// The number of bytes parsed for each measurement (repeating the line as needed)
+#define BYTES_PER_RUN (64 * 1024 * 1024)
+
+// legacy_expand_sh_vars
+// The original $$ expansion: restarts strstr() from the start of the buffer after each match
+// and copies the whole tail through a 2049-byte temporary; input is limited to 2048 bytes
+static char** legacy_expand_sh_vars(char** cmd_buf) {
+	char* buf_end = *cmd_buf + 2048;
+	char* ptr = strstr(*cmd_buf, "$$");
+	while (ptr != NULL) {
+		char temp[2049];
+		strncpy(temp, ptr + 2, 2048);
+		int curr_pid = getpid();
+		int digits = ceil(log10(curr_pid)) + 1;
+		char digit_str[digits + 1];
+		sprintf(digit_str, "%d", curr_pid);
+		strncpy(ptr, digit_str, buf_end - ptr - 1);
+		if (ptr + digits - 1 < buf_end) {
+			strncpy(ptr + digits - 1, temp, buf_end - (ptr + digits - 1));
+		}
+		ptr = strstr(*cmd_buf, "$$");
+	}
+	return cmd_buf;
+}
+
+// legacy_tokenize
+// The original argument split: strtok_r() on single spaces
+// Returns: the number of tokens
+static int legacy_tokenize(char* buf) {
+	char* saveptr;
+	int n = 0;
+	for (char* token = strtok_r(buf, " ", &saveptr); token != NULL; token = strtok_r(NULL, " ", &saveptr)) {
+		n++;
+	}
+	return n;
+}
+
+// now_sec
+// Reads the monotonic clock
+// Returns: the time in seconds
+static double now_sec(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// make_line
+// Builds a line of roughly the given length out of arguments, one in every four containing $$
+// Returns: the heap-allocated line
+static char* make_line(size_t len) {
+	static const char* words[] = { "alpha", "\"b c\"", "file$$.txt", "'quoted arg'" };
+	char* line = (char*) malloc(len + 32);
+	size_t n = 0;
+	line[n++] = 'x';
+	for (int i = 0; n < len; i++) {
+		n += sprintf(line + n, " %s", words[i % 4]);
+	}
+	line[len] = '\0';
+	// Don't leave a dangling quote or $ at the cut
+	for (size_t i = len; i > 0 && line[i - 1] != ' '; i--) line[i - 1] = 'z';
+	return line;
+}
+
+// bench_size
+// Parses lines of one length with both parsers and prints records of their throughput
+// Parameters: len, the line length in bytes
+// Returns: none
+static void bench_size(size_t len) {
+	char* line = make_line(len);
+	long runs = BYTES_PER_RUN / len + 1;
+
+	// The original passes only handle lines of up to 2048 bytes
+	if (len <= 2048) {
+		char buf[2049];
+		double start = now_sec();
+		for (long i = 0; i < runs; i++) {
+			strncpy(buf, line, sizeof(buf));
+			char* p = buf;
+			legacy_expand_sh_vars(&p);
+			legacy_tokenize(buf);
+		}
+		double secs = now_sec() - start;
+		printf("parse_lex/%zu/legacy/throughput\t%.1f\tMB/s\n", len, runs * len / secs / 1e6);
+		printf("parse_lex/%zu/legacy/rate\t%.0f\tlines/s\n", len, runs / secs);
+	}
+
+	double start = now_sec();
+	for (long i = 0; i < runs; i++) {
+		free_pipeline(parse_pipeline(line));
+	}
+	double secs = now_sec() - start;
+	printf("parse_lex/%zu/lexer/throughput\t%.1f\tMB/s\n", len, runs * len / secs / 1e6);
+	printf("parse_lex/%zu/lexer/rate\t%.0f\tlines/s\n", len, runs / secs);
+
+	free(line);
+}
+
+int main(void) {
+	parse_init();
+	size_t sizes[] = { 64, 512, 2048, 65536, 1 << 20, 16 << 20 };
+	for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		bench_size(sizes[i]);
+	}
+	return 0;
+}
@@ -0,0 +1,306 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "builtins.h"
+
+// builtin_echo
+// Prints the arguments separated by spaces and followed by a newline (omitted with -n)
+// Parameters: the command
+// Returns: 0
+int builtin_echo(struct command* cmd) {
+	int i = 1;
+	bool newline = true;
+	if (cmd->argc > 1 && strcmp(cmd->argv[1], "-n") == 0) {
+		newline = false;
+		i++;
+	}
+	for (; i < cmd->argc; i++) {
+		fputs(cmd->argv[i], stdout);
+		if (i < cmd->argc - 1) putchar(' ');
+	}
+	if (newline) putchar('\n');
+	return 0;
+}
+
+// builtin_true
+// Does nothing, successfully
+// Parameters: the command
+// Returns: 0
+int builtin_true(struct command* cmd) {
+	(void) cmd;
+	return 0;
+}
+
+// builtin_false
+// Does nothing, unsuccessfully
+// Parameters: the command
+// Returns: 1
+int builtin_false(struct command* cmd) {
+	(void) cmd;
+	return 1;
+}
+
+// builtin_pwd
+// Prints the current working directory
+// Parameters: the command
+// Returns: 0 if successful, 1 on failure
+int builtin_pwd(struct command* cmd) {
+	(void) cmd;
+	char cwd[PATH_MAX];
+	if (getcwd(cwd, sizeof(cwd)) == NULL) {
+		perror("pwd");
+		return 1;
+	}
+	puts(cwd);
+	return 0;
+}
+
+// test_unary
+// Evaluates a unary test operator
+// Parameters: op, the operator (such as "-f"); arg, its operand
+// Returns: 1 if true, 0 if false, -1 if the operator is unknown
+static int test_unary(const char* op, const char* arg) {
+	struct stat st;
+	if (op[0] != '-' || op[1] == '\0' || op[2] != '\0') return -1;
+	switch (op[1]) {
+	case 'z': return arg[0] == '\0';
+	case 'n': return arg[0] != '\0';
+	case 'e': return stat(arg, &st) == 0;
+	case 'f': return stat(arg, &st) == 0 && S_ISREG(st.st_mode);
+	case 'd': return stat(arg, &st) == 0 && S_ISDIR(st.st_mode);
+	case 'h':
+	case 'L': return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+	case 'p': return stat(arg, &st) == 0 && S_ISFIFO(st.st_mode);
+	case 's': return stat(arg, &st) == 0 && st.st_size > 0;
+	case 'r': return access(arg, R_OK) == 0;
+	case 'w': return access(arg, W_OK) == 0;
+	case 'x': return access(arg, X_OK) == 0;
+	case 't': return isatty(atoi(arg));
+	default: return -1;
+	}
+}
+
+// test_number
+// Reads an integer operand of a test comparison
+// Parameters: arg, the operand; value, a pointer to receive its value
+// Returns: 0 if the operand is an integer, -1 otherwise
+static int test_number(const char* arg, long long* value) {
+	char* end;
+	errno = 0;
+	*value = strtoll(arg, &end, 10);
+	if (arg[0] == '\0' || *end != '\0' || errno != 0) {
+		fprintf(stderr, "test: %s: integer expected\n", arg);
+		return -1;
+	}
+	return 0;
+}
+
+// test_binary
+// Evaluates a binary test operator
+// Parameters: a, the left operand; op, the operator; b, the right operand
+// Returns: 1 if true, 0 if false, -1 if the operator is unknown, -2 if an operand is invalid
+static int test_binary(const char* a, const char* op, const char* b) {
+	if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) return strcmp(a, b) == 0;
+	if (strcmp(op, "!=") == 0) return strcmp(a, b) != 0;
+
+	static const char* int_ops[] = { "-eq", "-ne", "-lt", "-le", "-gt", "-ge" };
+	for (int i = 0; i < 6; i++) {
+		if (strcmp(op, int_ops[i]) != 0) continue;
+		long long x, y;
+		if (test_number(a, &x) == -1 || test_number(b, &y) == -1) return -2;
+		switch (i) {
+		case 0: return x == y;
+		case 1: return x != y;
+		case 2: return x < y;
+		case 3: return x <= y;
+		case 4: return x > y;
+		default: return x >= y;
+		}
+	}
+	return -1;
+}
+
+// test_expr
+// Evaluates a test expression of up to four words by the POSIX rules for the number of arguments
+// Parameters: argc, the number of words; argv, the words
+// Returns: 1 if true, 0 if false, -1 on a syntax error, -2 if an operand is invalid
+static int test_expr(int argc, char** argv) {
+	switch (argc) {
+	case 0:
+		return 0;
+	case 1:
+		return argv[0][0] != '\0';
+	case 2:
+		if (strcmp(argv[0], "!") == 0) return argv[1][0] == '\0';
+		return test_unary(argv[0], argv[1]);
+	case 3: {
+		int r = test_binary(argv[0], argv[1], argv[2]);
+		if (r != -1) return r;
+		if (strcmp(argv[0], "!") == 0) {
+			r = test_expr(2, argv + 1);
+			return (r < 0) ? r : !r;
+		}
+		if (strcmp(argv[0], "(") == 0 && strcmp(argv[2], ")") == 0) return argv[1][0] != '\0';
+		return -1;
+	}
+	case 4:
+		if (strcmp(argv[0], "!") == 0) {
+			int r = test_expr(3, argv + 1);
+			return (r < 0) ? r : !r;
+		}
+		if (strcmp(argv[0], "(") == 0 && strcmp(argv[3], ")") == 0) return test_expr(2, argv + 1);
+		return -1;
+	default:
+		return -1;
+	}
+}
+
+// builtin_test
+// Evaluates a conditional expression, as test or [ (which requires a closing ])
+// Parameters: the command
+// Returns: 0 if the expression is true, 1 if it is false, 2 on an error
+int builtin_test(struct command* cmd) {
+	int argc = cmd->argc - 1;
+	char** argv = cmd->argv + 1;
+	if (strcmp(cmd->cmd, "[") == 0) {
+		if (argc == 0 || strcmp(argv[argc - 1], "]") != 0) {
+			fprintf(stderr, "[: missing ]\n");
+			return 2;
+		}
+		argc--;
+	}
+
+	int r = test_expr(argc, argv);
+	if (r == -1) {
+		fprintf(stderr, "%s: syntax error\n", cmd->cmd);
+		return 2;
+	}
+	if (r == -2) return 2;
+	return r ? 0 : 1;
+}
+
+// print_escape
+// Prints the character a backslash escape in a printf format stands for
+// Parameters: a pointer to the character after the backslash
+// Returns: a pointer past the escape
+static const char* print_escape(const char* p) {
+	switch (*p) {
+	case 'n': putchar('\n'); break;
+	case 't': putchar('\t'); break;
+	case 'r': putchar('\r'); break;
+	case 'a': putchar('\a'); break;
+	case 'b': putchar('\b'); break;
+	case 'f': putchar('\f'); break;
+	case 'v': putchar('\v'); break;
+	case '\\': putchar('\\'); break;
+	case '0': {
+		// Up to three octal digits after the 0
+		int value = 0, n = 0;
+		for (p++; n < 3 && *p >= '0' && *p <= '7'; p++, n++) value = value * 8 + (*p - '0');
+		putchar(value);
+		return p;
+	}
+	case '\0':
+		putchar('\\');
+		return p;
+	default:
+		putchar('\\');
+		putchar(*p);
+		break;
+	}
+	return p + 1;
+}
+
+// builtin_printf
+// Prints the arguments under the control of a format, reusing the format while arguments remain;
+// supports the flags, width, and precision of %d %i %u %o %x %X %c %s, and %%
+// Parameters: the command
+// Returns: 0 if successful, 1 if an argument was not a valid number or the format was invalid
+int builtin_printf(struct command* cmd) {
+	if (cmd->argc < 2) {
+		fprintf(stderr, "usage: printf format [arguments]\n");
+		return 1;
+	}
+	const char* format = cmd->argv[1];
+	int next = 2;
+	int rc = 0;
+
+	do {
+		bool consumed = false;
+		for (const char* p = format; *p != '\0';) {
+			if (*p == '\\') {
+				p = print_escape(p + 1);
+				continue;
+			}
+			if (*p != '%') {
+				putchar(*p++);
+				continue;
+			}
+			if (p[1] == '%') {
+				putchar('%');
+				p += 2;
+				continue;
+			}
+
+			// Copy the conversion's flags, width, and precision into a format of its own
+			// (the % and n of them, then up to "ll", the conversion, and the null)
+			char spec[32];
+			size_t n = strspn(p + 1, "-+ #0123456789.");
+			if (n + 5 > sizeof(spec) || p[1 + n] == '\0') {
+				fprintf(stderr, "printf: invalid format\n");
+				return 1;
+			}
+			char conv = p[1 + n];
+			memcpy(spec, p, n + 1);
+			const char* arg = (next < cmd->argc) ? cmd->argv[next++] : NULL;
+			consumed = consumed || arg != NULL;
+			p += n + 2;
+
+			char* end = "";
+			errno = 0;
+			switch (conv) {
+			case 'd':
+			case 'i': {
+				long long value = (arg != NULL) ? strtoll(arg, &end, 0) : 0;
+				strcpy(spec + n + 1, "lld");
+				printf(spec, value);
+				break;
+			}
+			case 'u':
+			case 'o':
+			case 'x':
+			case 'X': {
+				unsigned long long value = (arg != NULL) ? strtoull(arg, &end, 0) : 0;
+				sprintf(spec + n + 1, "ll%c", conv);
+				printf(spec, value);
+				break;
+			}
+			case 'c':
+				strcpy(spec + n + 1, "c");
+				printf(spec, (arg != NULL) ? arg[0] : '\0');
+				break;
+			case 's':
+				strcpy(spec + n + 1, "s");
+				printf(spec, (arg != NULL) ? arg : "");
+				break;
+			default:
+				fprintf(stderr, "printf: %%%c: invalid conversion\n", conv);
+				return 1;
+			}
+			if (arg != NULL && (*end != '\0' || errno != 0)) {
+				fprintf(stderr, "printf: %s: invalid number\n", arg);
+				rc = 1;
+			}
+		}
+		// Stop once the arguments are used up, or if the format doesn't take any
+		if (!consumed) break;
+	} while (next < cmd->argc);
+
+	return rc;
+}
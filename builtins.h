@@ -0,0 +1,17 @@
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+#include "parse.h"
+
+// The trivial utilities the shell runs in-process instead of launching a program. Each takes the
+// command and returns its exit code; output goes through stdio to the shell's stdout, which the
+// caller has redirected for the command.
+
+int builtin_echo(struct command* cmd);
+int builtin_true(struct command* cmd);
+int builtin_false(struct command* cmd);
+int builtin_pwd(struct command* cmd);
+int builtin_test(struct command* cmd);
+int builtin_printf(struct command* cmd);
+
+#endif
@@ -0,0 +1,400 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/wait.h>
+
+#include "cache.h"
+#include "pathcache.h"
+#include "vars.h"
+
+// The default bound on the store, in MiB
+#define CACHE_DEFAULT_MB 64
+// Identifies an entry file; the trailer sits at the end of the file so the output can be captured first
+#define CACHE_MAGIC "smshc001"
+
+// struct cache_trailer
+// The end of an entry file, after the output and the key
+struct cache_trailer {
+	uint64_t out_len;           // The number of output bytes at the start of the file
+	uint32_t key_len;           // The number of key bytes after the output
+	int32_t status;             // The command's status set by wait4()
+	char magic[8];
+};
+
+// struct cache_index_entry
+// What the shell knows about an entry file, for eviction
+struct cache_index_entry {
+	unsigned long long hash;
+	off_t size;
+	time_t last_use;            // The file's mtime, which a hit refreshes
+};
+
+static char* cache_dir = NULL;
+static off_t cache_limit = 0;
+
+// The index of the store, loaded on first use
+static struct cache_index_entry* index_entries = NULL;
+static int n_index = 0, index_cap = 0;
+static off_t store_size = 0;
+static bool index_loaded = false;
+
+// Counters for "cache"
+static unsigned long n_hits = 0, n_misses = 0, n_stored = 0, n_evicted = 0;
+
+// open_store
+// Finds (and creates) the store directory and reads the size bound from the environment
+// Parameters: none
+// Returns: 0 if the store is usable, -1 otherwise
+static int open_store(void) {
+	if (cache_dir != NULL) return 0;
+
+	const char* mb = vars_get("SMALLSH_CACHE_MB");
+	long limit_mb = (mb != NULL) ? strtol(mb, NULL, 10) : CACHE_DEFAULT_MB;
+	if (limit_mb < 1) limit_mb = CACHE_DEFAULT_MB;
+	cache_limit = (off_t) limit_mb << 20;
+
+	char* dir = NULL;
+	const char* env = vars_get("SMALLSH_CACHE_DIR");
+	const char* xdg = vars_get("XDG_CACHE_HOME");
+	const char* home = vars_get("HOME");
+	if (env != NULL && env[0] != '\0') {
+		dir = strdup(env);
+	} else if (xdg != NULL && xdg[0] != '\0') {
+		if (asprintf(&dir, "%s/smallsh", xdg) == -1) dir = NULL;
+	} else if (home != NULL) {
+		// ~/.cache may not exist yet either
+		char* parent;
+		if (asprintf(&parent, "%s/.cache", home) == -1) return -1;
+		if (mkdir(parent, 0700) == -1 && errno != EEXIST) {
+			perror(parent);
+			free(parent);
+			return -1;
+		}
+		free(parent);
+		if (asprintf(&dir, "%s/.cache/smallsh", home) == -1) dir = NULL;
+	}
+	if (dir == NULL) return -1;
+	if (mkdir(dir, 0700) == -1 && errno != EEXIST) {
+		perror(dir);
+		free(dir);
+		return -1;
+	}
+	cache_dir = dir;
+	return 0;
+}
+
+// index_add
+// Adds an entry file to the index
+// Parameters: the entry's hash, size, and last use
+// Returns: none
+static void index_add(unsigned long long hash, off_t size, time_t last_use) {
+	if (n_index == index_cap) {
+		int new_cap = (index_cap == 0) ? 64 : index_cap * 2;
+		struct cache_index_entry* grown = (struct cache_index_entry*) realloc(index_entries, sizeof(struct cache_index_entry) * new_cap);
+		if (grown == NULL) return;
+		index_entries = grown;
+		index_cap = new_cap;
+	}
+	index_entries[n_index++] = (struct cache_index_entry) { hash, size, last_use };
+	store_size += size;
+}
+
+// index_find
+// Looks up an entry file in the index
+// Parameters: the entry's hash
+// Returns: its index, or -1 if it is not indexed
+static int index_find(unsigned long long hash) {
+	for (int i = 0; i < n_index; i++) {
+		if (index_entries[i].hash == hash) return i;
+	}
+	return -1;
+}
+
+// load_index
+// Reads the entry files in the store directory into the index
+// Parameters: none
+// Returns: none
+static void load_index(void) {
+	if (index_loaded) return;
+	index_loaded = true;
+
+	DIR* dir = opendir(cache_dir);
+	if (dir == NULL) return;
+	struct dirent* ent;
+	while ((ent = readdir(dir)) != NULL) {
+		// Entry files are named by their 16-digit hash; everything else (such as capture files) is skipped
+		char* end;
+		unsigned long long hash = strtoull(ent->d_name, &end, 16);
+		if (strlen(ent->d_name) != 16 || *end != '\0') continue;
+		struct stat st;
+		if (fstatat(dirfd(dir), ent->d_name, &st, 0) == 0) index_add(hash, st.st_size, st.st_mtime);
+	}
+	closedir(dir);
+}
+
+// entry_path
+// Builds the path of an entry file
+// Parameters: the entry's hash; a buffer of at least PATH_MAX bytes
+// Returns: the buffer
+static char* entry_path(unsigned long long hash, char* buf) {
+	snprintf(buf, PATH_MAX, "%s/%016llx", cache_dir, hash);
+	return buf;
+}
+
+// evict
+// Deletes the least recently used entries until the store fits its bound
+// Parameters: none
+// Returns: none
+static void evict(void) {
+	char path[PATH_MAX];
+	while (store_size > cache_limit && n_index > 0) {
+		int oldest = 0;
+		for (int i = 1; i < n_index; i++) {
+			if (index_entries[i].last_use < index_entries[oldest].last_use) oldest = i;
+		}
+		unlink(entry_path(index_entries[oldest].hash, path));
+		store_size -= index_entries[oldest].size;
+		index_entries[oldest] = index_entries[--n_index];
+		n_evicted++;
+	}
+}
+
+// key_add
+// Appends a NUL-terminated field to the key material
+// Parameters: t, the ticket holding the key; field, the text to append
+// Returns: 0 if successful, -1 on failure
+static int key_add(struct cache_ticket* t, const char* field) {
+	size_t len = strlen(field) + 1;
+	char* grown = (char*) realloc(t->key, t->key_len + len);
+	if (grown == NULL) return -1;
+	memcpy(grown + t->key_len, field, len);
+	t->key = grown;
+	t->key_len += len;
+	return 0;
+}
+
+// key_add_file
+// Appends a file's path and identity to the key material; a file that changes gets a new key
+// Parameters: t, the ticket holding the key; path, the file
+// Returns: 0 if successful, -1 if the file can't be examined
+static int key_add_file(struct cache_ticket* t, const char* path) {
+	struct stat st;
+	if (stat(path, &st) == -1) return -1;
+	char identity[128];
+	snprintf(identity, sizeof(identity), "%llx:%llx:%lld:%lld.%09ld", (unsigned long long) st.st_dev,
+	         (unsigned long long) st.st_ino, (long long) st.st_size, (long long) st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+	return (key_add(t, path) == 0 && key_add(t, identity) == 0) ? 0 : -1;
+}
+
+// make_key
+// Builds the key material of a command and hashes it (FNV-1a, 64 bits)
+// Parameters: cmd, the command; t, the ticket to fill
+// Returns: 0 if successful, -1 if the command can't be cached
+static int make_key(struct command* cmd, struct cache_ticket* t) {
+	const char* file = pathcache_lookup(cmd->cmd);
+	if (file == NULL) file = cmd->cmd;
+	char cwd[PATH_MAX];
+	if (getcwd(cwd, sizeof(cwd)) == NULL) return -1;
+
+	if (key_add(t, "bin") == -1 || key_add_file(t, file) == -1) return -1;
+	if (key_add(t, "cwd") == -1 || key_add(t, cwd) == -1) return -1;
+	if (key_add(t, "argv") == -1) return -1;
+	for (int i = 0; i < cmd->argc; i++) {
+		if (key_add(t, cmd->argv[i]) == -1) return -1;
+	}
+	if (cmd->i_file != NULL && (key_add(t, "in") == -1 || key_add_file(t, cmd->i_file) == -1)) return -1;
+	if (cmd->here != NULL && (key_add(t, "here") == -1 || key_add(t, cmd->here) == -1)) return -1;
+
+	unsigned long long h = 14695981039346656037ull;
+	for (size_t i = 0; i < t->key_len; i++) {
+		h = (h ^ (unsigned char) t->key[i]) * 1099511628211ull;
+	}
+	t->hash = h;
+	return 0;
+}
+
+// copy_out
+// Copies the start of a file to the command's output file or the shell's stdout
+// Parameters: src, the file to copy from; len, the number of bytes; o_file, the output file, or NULL for stdout
+// Returns: 0 if successful, -1 on failure
+static int copy_out(int src, off_t len, const char* o_file) {
+	int dst = STDOUT_FILENO;
+	if (o_file != NULL) {
+		dst = open(o_file, O_WRONLY | O_TRUNC | O_CREAT | O_CLOEXEC, 0770);
+		if (dst == -1) {
+			perror(o_file);
+			return -1;
+		}
+	} else {
+		fflush(stdout);
+	}
+
+	off_t offset = 0;
+	char buf[65536];
+	while (offset < len) {
+		ssize_t n = sendfile(dst, src, &offset, len - offset);
+		if (n == -1 && (errno == EINVAL || errno == ENOSYS)) {
+			// The destination doesn't support sendfile(); copy through a buffer
+			n = pread(src, buf, (len - offset < (off_t) sizeof(buf)) ? (size_t) (len - offset) : sizeof(buf), offset);
+			if (n > 0) n = write(dst, buf, n);
+			if (n > 0) offset += n;
+		}
+		if (n <= 0) break;
+	}
+	if (dst != STDOUT_FILENO) close(dst);
+	return (offset == len) ? 0 : -1;
+}
+
+// free_ticket
+// Frees a ticket's buffers
+// Parameters: the ticket
+// Returns: none
+static void free_ticket(struct cache_ticket* t) {
+	free(t->key);
+	free(t->tmp_path);
+	t->key = NULL;
+	t->tmp_path = NULL;
+}
+
+// replay
+// Replays an entry file if it holds the ticket's key
+// Parameters: t, the ticket; path, the entry file
+// Returns: true if it was replayed, false if there is no matching entry
+static bool replay(struct cache_ticket* t, const char* path) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) return false;
+
+	// Check the trailer and the stored key
+	struct stat st;
+	struct cache_trailer tr;
+	bool match = fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(tr) &&
+	             pread(fd, &tr, sizeof(tr), st.st_size - sizeof(tr)) == sizeof(tr) &&
+	             memcmp(tr.magic, CACHE_MAGIC, sizeof(tr.magic)) == 0 && tr.key_len == t->key_len &&
+	             tr.out_len + tr.key_len + sizeof(tr) == (uint64_t) st.st_size;
+	if (match) {
+		char* key = (char*) malloc(t->key_len);
+		match = key != NULL && pread(fd, key, t->key_len, tr.out_len) == (ssize_t) t->key_len &&
+		        memcmp(key, t->key, t->key_len) == 0;
+		free(key);
+	}
+	// Refresh the entry's last use on disk before replaying it; if that fails the store can't be
+	// kept in order, so the command runs without it
+	if (match) match = futimens(fd, NULL) == 0 && copy_out(fd, tr.out_len, t->o_file) == 0;
+	close(fd);
+	if (!match) return false;
+
+	t->status = tr.status;
+	int i = index_find(t->hash);
+	if (i != -1) index_entries[i].last_use = time(NULL);
+	return true;
+}
+
+// cache_begin
+// Looks a command up in the cache; on a hit its output is replayed, and on a miss a capture file
+// is set up for its stdout
+// Parameters: cmd, a single-stage foreground command; t, the ticket to fill
+// Returns: CACHE_HIT, CACHE_MISS, or CACHE_BYPASS if the command can't be cached
+enum cache_state cache_begin(struct command* cmd, struct cache_ticket* t) {
+	memset(t, 0, sizeof(*t));
+	t->std_fds[0] = t->std_fds[1] = t->std_fds[2] = -1;
+	t->o_file = cmd->o_file;
+	if (open_store() == -1 || make_key(cmd, t) == -1) {
+		free_ticket(t);
+		return CACHE_BYPASS;
+	}
+	load_index();
+
+	char path[PATH_MAX];
+	if (replay(t, entry_path(t->hash, path))) {
+		n_hits++;
+		free_ticket(t);
+		return CACHE_HIT;
+	}
+
+	// Capture the command's stdout in a file in the store; the command's own output file is
+	// written from the capture once the command has ended
+	n_misses++;
+	if (asprintf(&t->tmp_path, "%s/.capture-XXXXXX", cache_dir) == -1) t->tmp_path = NULL;
+	if (t->tmp_path == NULL || (t->std_fds[1] = mkostemp(t->tmp_path, O_CLOEXEC)) == -1) {
+		free_ticket(t);
+		return CACHE_BYPASS;
+	}
+	cmd->o_file = NULL;
+	return CACHE_MISS;
+}
+
+// cache_end
+// Delivers a missed command's captured output and stores it, with its status, as a new entry
+// Parameters: t, the ticket from cache_begin(); status, the command's status set by wait4(); ran, whether the
+//             command was started (its status is made up if it wasn't)
+// Returns: none
+void cache_end(struct cache_ticket* t, int status, bool ran) {
+	int fd = t->std_fds[1];
+	off_t out_len = lseek(fd, 0, SEEK_END);
+	copy_out(fd, out_len, t->o_file);
+
+	// Only commands that ran and exited are stored; one killed by a signal may not have finished its output,
+	// and one that couldn't be started (such as a program not yet made executable) may start next time
+	bool stored = false;
+	if (ran && WIFEXITED(status) && out_len != -1) {
+		struct cache_trailer tr = { .out_len = out_len, .key_len = t->key_len, .status = status };
+		memcpy(tr.magic, CACHE_MAGIC, sizeof(tr.magic));
+		char path[PATH_MAX];
+		if (pwrite(fd, t->key, t->key_len, out_len) == (ssize_t) t->key_len &&
+		    pwrite(fd, &tr, sizeof(tr), out_len + t->key_len) == sizeof(tr) &&
+		    rename(t->tmp_path, entry_path(t->hash, path)) == 0) {
+			stored = true;
+			n_stored++;
+			int i = index_find(t->hash);
+			if (i != -1) {
+				store_size -= index_entries[i].size;
+				index_entries[i] = index_entries[--n_index];
+			}
+			index_add(t->hash, out_len + t->key_len + sizeof(tr), time(NULL));
+			evict();
+		}
+	}
+	if (!stored) unlink(t->tmp_path);
+	close(fd);
+	free_ticket(t);
+}
+
+// cache_print
+// Prints the store's size and the cache counters (for "cache")
+// Parameters: none
+// Returns: none
+void cache_print(void) {
+	if (open_store() == -1) return;
+	load_index();
+	unsigned long lookups = n_hits + n_misses;
+	printf("%s: %d entries, %lld of %lld KiB\n", cache_dir, n_index, (long long) store_size >> 10, (long long) cache_limit >> 10);
+	printf("%lu hits, %lu misses (%.1f%% hit rate), %lu stored, %lu evicted\n",
+	       n_hits, n_misses, (lookups > 0) ? 100.0 * n_hits / lookups : 0.0, n_stored, n_evicted);
+}
+
+// cache_clear
+// Deletes every entry in the store (for "cache -c")
+// Parameters: none
+// Returns: none
+void cache_clear(void) {
+	if (open_store() == -1) return;
+	load_index();
+	char path[PATH_MAX];
+	for (int i = 0; i < n_index; i++) {
+		unlink(entry_path(index_entries[i].hash, path));
+	}
+	n_index = 0;
+	store_size = 0;
+}
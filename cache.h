@@ -0,0 +1,39 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+
+#include "parse.h"
+
+// The result cache remembers the stdout and exit status of commands run with the "cache" prefix,
+// keyed by the command's argv, the working directory, the identity of the program file, and the
+// identity (device, inode, size, mtime) of its input file. A hit replays the stored output
+// without launching anything. Entries live in files under $SMALLSH_CACHE_DIR (default
+// $XDG_CACHE_HOME/smallsh or ~/.cache/smallsh), and the least recently used ones are evicted
+// once the store exceeds $SMALLSH_CACHE_MB megabytes (default 64).
+
+// What cache_begin() decided
+enum cache_state {
+	CACHE_BYPASS,   // The command can't be cached; run it normally
+	CACHE_HIT,      // The stored output was replayed; the status is in the ticket
+	CACHE_MISS      // Run the command with the ticket's descriptors, then call cache_end()
+};
+
+// struct cache_ticket
+// A command being served by the cache
+struct cache_ticket {
+	int status;                 // The replayed status on a hit
+	int std_fds[3];             // On a miss, the descriptors to launch the command with (stdout is the capture file)
+	char* o_file;               // The command's own output file, or NULL for the shell's stdout
+	char* tmp_path;             // The capture file's path
+	char* key;                  // The key material, stored with the entry to rule out hash collisions
+	size_t key_len;
+	unsigned long long hash;    // The hash of the key, which names the entry
+};
+
+enum cache_state cache_begin(struct command* cmd, struct cache_ticket* t);
+void cache_end(struct cache_ticket* t, int status, bool ran);
+void cache_print(void);
+void cache_clear(void);
+
+#endif
@@ -0,0 +1,220 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+
+#include "deadline.h"
+
+// The expiry of a deadline that no longer has anything left to do
+#define NEVER UINT64_MAX
+
+// struct deadline
+// A child with a time limit
+struct deadline {
+	pid_t pid;
+	int pidfd;                  // Refers to the child for as long as the entry exists, even once it has been reaped
+	uint64_t expires;           // When the next signal is due, in CLOCK_MONOTONIC nanoseconds (NEVER once SIGKILL was sent)
+	uint64_t kill_after;        // The grace period between SIGTERM and SIGKILL in nanoseconds (0 for no SIGKILL)
+	bool timed_out;             // Whether SIGTERM has been sent
+};
+
+static struct deadline* deadlines = NULL;
+static int n_deadlines = 0, deadlines_cap = 0;
+static int timer_fd = -1;
+static uint64_t armed_for = 0;   // The expiry the timer is armed for, or 0 if it is disarmed
+
+// now_ns
+// Reads the monotonic clock
+// Parameters: none
+// Returns: the time in nanoseconds
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// to_ns
+// Converts a duration in seconds to nanoseconds, saturating instead of overflowing
+// Parameters: the duration
+// Returns: the duration in nanoseconds
+static uint64_t to_ns(double secs) {
+	if (secs >= 1e9) return NEVER / 2;
+	return (uint64_t) (secs * 1e9);
+}
+
+// rearm
+// Arms the timer for the earliest pending deadline, or disarms it if there is none
+// Parameters: none
+// Returns: none
+static void rearm(void) {
+	uint64_t earliest = NEVER;
+	for (int i = 0; i < n_deadlines; i++) {
+		if (deadlines[i].expires < earliest) earliest = deadlines[i].expires;
+	}
+	if (earliest == NEVER) earliest = 0;
+	if (earliest == armed_for) return;
+
+	// An absolute time of zero disarms the timer
+	struct itimerspec its = { { 0, 0 }, { (time_t) (earliest / 1000000000u), (long) (earliest % 1000000000u) } };
+	timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+	armed_for = earliest;
+}
+
+// find_deadline
+// Finds a child's deadline
+// Parameters: the child's pid
+// Returns: the index of its entry, or -1 if it has none
+static int find_deadline(pid_t pid) {
+	for (int i = 0; i < n_deadlines; i++) {
+		if (deadlines[i].pid == pid) return i;
+	}
+	return -1;
+}
+
+// deadline_init
+// Creates the timer that wakes the shell when a deadline expires
+// Parameters: none
+// Returns: the timer's descriptor, for the event loop to watch, or -1 on failure
+int deadline_init(void) {
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timer_fd == -1) perror("timerfd_create");
+	return timer_fd;
+}
+
+// deadline_add
+// Puts a time limit on a child that has not been reaped yet (so its pid can't have been reused)
+// Parameters: pid, the child's pid; secs, the limit in seconds from now; kill_after, the grace period
+//             between SIGTERM and SIGKILL in seconds, or 0 to only send SIGTERM
+// Returns: 0 if successful, -1 on failure
+int deadline_add(pid_t pid, double secs, double kill_after) {
+	if (timer_fd == -1) {
+		errno = EBADF;
+		return -1;
+	}
+	if (n_deadlines == deadlines_cap) {
+		int cap = (deadlines_cap == 0) ? 16 : deadlines_cap * 2;
+		struct deadline* grown = (struct deadline*) realloc(deadlines, sizeof(struct deadline) * cap);
+		if (grown == NULL) return -1;
+		deadlines = grown;
+		deadlines_cap = cap;
+	}
+
+	int pidfd = syscall(SYS_pidfd_open, pid, 0);
+	if (pidfd == -1) return -1;
+	deadlines[n_deadlines++] = (struct deadline) { pid, pidfd, now_ns() + to_ns(secs), to_ns(kill_after), false };
+	rearm();
+	return 0;
+}
+
+// deadline_remove
+// Forgets a child's deadline once the child has been reaped
+// Parameters: the child's pid
+// Returns: whether the child's time limit ran out
+bool deadline_remove(pid_t pid) {
+	int i = find_deadline(pid);
+	if (i == -1) return false;
+
+	bool timed_out = deadlines[i].timed_out;
+	close(deadlines[i].pidfd);
+	deadlines[i] = deadlines[--n_deadlines];
+	rearm();
+	return timed_out;
+}
+
+// deadline_count
+// Gets the number of children with a deadline
+// Parameters: none
+// Returns: the number of deadlines
+int deadline_count(void) {
+	return n_deadlines;
+}
+
+// deadline_timer_fd
+// Gets the timer's descriptor, for loops that poll it themselves
+// Parameters: none
+// Returns: the descriptor, which becomes readable when a deadline expires; call deadline_expire() then
+int deadline_timer_fd(void) {
+	return timer_fd;
+}
+
+// deadline_expire
+// Signals every child whose deadline has passed: SIGTERM first, then SIGKILL after its grace period
+// Parameters: none
+// Returns: none
+void deadline_expire(void) {
+	uint64_t expirations;
+	while (read(timer_fd, &expirations, sizeof(expirations)) > 0);
+	armed_for = 0;
+
+	uint64_t now = now_ns();
+	for (int i = 0; i < n_deadlines; i++) {
+		struct deadline* d = &deadlines[i];
+		if (d->expires > now) continue;
+		// A child that has already exited makes the signal fail with ESRCH, which is harmless
+		if (!d->timed_out) {
+			syscall(SYS_pidfd_send_signal, d->pidfd, SIGTERM, NULL, 0);
+			d->timed_out = true;
+			d->expires = (d->kill_after > 0) ? now + d->kill_after : NEVER;
+		} else {
+			syscall(SYS_pidfd_send_signal, d->pidfd, SIGKILL, NULL, 0);
+			d->expires = NEVER;
+		}
+	}
+	rearm();
+}
+
+// deadline_wait
+// Sleeps until a child has exited, acting on any deadline (the child's or another's) that expires
+// meanwhile; the child is left for the caller to reap
+// Parameters: the child's pid
+// Returns: none
+void deadline_wait(pid_t pid) {
+	// With no deadlines, the caller's blocking wait can't miss anything
+	if (n_deadlines == 0) return;
+
+	int i = find_deadline(pid);
+	int pidfd = (i != -1) ? deadlines[i].pidfd : syscall(SYS_pidfd_open, pid, 0);
+	if (pidfd == -1) return;
+
+	struct pollfd pfds[2] = { { pidfd, POLLIN, 0 }, { timer_fd, POLLIN, 0 } };
+	while (true) {
+		if (poll(pfds, 2, -1) == -1) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		if (pfds[1].revents & POLLIN) deadline_expire();
+		if (pfds[0].revents != 0) break;
+	}
+	if (i == -1) close(pidfd);
+}
+
+// deadline_parse
+// Reads a duration in seconds, which may have a fraction and an s, m, h, or d suffix
+// Parameters: s, the duration; secs, a pointer to receive it in seconds
+// Returns: 0 if successful, -1 if it is not a valid duration
+int deadline_parse(const char* s, double* secs) {
+	char* end;
+	errno = 0;
+	double value = strtod(s, &end);
+	if (end == s || errno != 0 || value < 0 || value != value) return -1;
+	switch (*end) {
+	case '\0':
+	case 's': break;
+	case 'm': value *= 60; break;
+	case 'h': value *= 3600; break;
+	case 'd': value *= 86400; break;
+	default: return -1;
+	}
+	if (*end != '\0' && end[1] != '\0') return -1;
+	*secs = value;
+	return 0;
+}
@@ -0,0 +1,24 @@
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+// Deadlines put time limits on children. Each limited child is held by a pidfd, so signals always
+// reach the right process even if its pid is reaped and reused, and one timerfd, armed for the
+// earliest deadline, wakes the event loop (as EV_TIMER) when a limit runs out. An expired child is
+// sent SIGTERM, then SIGKILL once its grace period has also run out.
+
+// The grace period between SIGTERM and SIGKILL when none is given, in seconds
+#define DEADLINE_KILL_AFTER 5.0
+
+int deadline_init(void);
+int deadline_add(pid_t pid, double secs, double kill_after);
+bool deadline_remove(pid_t pid);
+int deadline_count(void);
+int deadline_timer_fd(void);
+void deadline_expire(void);
+void deadline_wait(pid_t pid);
+int deadline_parse(const char* s, double* secs);
+
+#endif
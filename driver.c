@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -8,101 +10,40 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <termios.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "builtins.h"
+#include "cache.h"
+#include "deadline.h"
+#include "events.h"
+#include "globcache.h"
+#include "history.h"
+#include "input.h"
+#include "jobs.h"
+#include "jobsched.h"
+#include "launch.h"
+#include "launch_engine.h"
+#include "parse.h"
+#include "pathcache.h"
+#include "pathindex.h"
+#include "pump.h"
+#include "server.h"
+#include "trace.h"
+#include "usage.h"
+#include "vars.h"
 
-// Macros for the maximum file name length and path length
-#define FILE_NAME_MAX 255
+// Macro for the maximum path length
 #define PATH_LEN_MAX 4095
 
 // A flag for foreground-only mode
-static volatile bool fg_only_mode = false;
-
-// struct command
-// Holds command data
-struct command {
-	char* cmd;                  // The command itself
-	int argc;                   // The number of arguments (counting the command)
-	char* argv[512];            // The arguments (including the command)
-	char* i_file, * o_file;     // The input and output files for I/O redirection
-	bool background;            // Whether the command should be a background process
-};
-
-// free_command
-// Frees heap memory allocated for a command struct
-// Parameters: a pointer to a command struct on the heap
-// Returns: none
-void free_command(struct command* cmd) {
-    // Free the command
-	free(cmd->cmd);
+static bool fg_only_mode = false;
 
-    // Free the arguments
-	for (int i = 0; i < cmd->argc; i++) {
-		free(cmd->argv[i]);
-	}
-
-    // Free the I/O files
-	free(cmd->i_file);
-	free(cmd->o_file);
-
-    // Free the command struct
-	free(cmd);
-	return;
-}
-
-// print_command
-// Prints the data in a command struct; only used for debugging
-// Parameters: the command struct to be printed
-// Returns: none
-void print_command(struct command* cmd) {
-	printf("\n");
-
-    // Print a null pointer if the passed command is NULL
-	if (cmd == NULL) {
-		printf("%p\n\n", cmd);
-		return;
-	}
-
-    // Print the command data
-	printf("cmd: %s\n", cmd->cmd);
-	printf("argc: %d\nargv[]: ", cmd->argc);
-	for (int i = 0; i < cmd->argc; i++) {
-		printf("%s (%d chars), ", cmd->argv[i], strlen(cmd->argv[i]) + 1);
-	}
-	printf("\ni_file: %s\n", cmd->i_file);
-	printf("o_file: %s\n", cmd->o_file);
-	printf("background: %d\n\n", cmd->background);
-}
-
-// delete_int
-// Searches for and deletes an integer in an integer list, shifting other entries to fill the gap
-// Parameters: i, the integer to delete; i_list, a pointer to the integer list to delete from;
-//             n, a pointer to the number of elements in the integer list
-// Returns: a pointer to the integer list
-int* delete_int(int i, int* i_list, int* n) {
-	// j will mark the index of i
-    // Initialize j to -1 to indicate that i has not been found yet
-    int j = -1;
-    // Loop through i_list
-	for (int k = 0; k < *n; k++) {
-		// Check if i has been found yet
-        if (j != -1) {
-            // At this point, j == k - 1
-            // Copy the current element (k) into the previous element (j)
-            // This erases i from the list and shifts all following elements to fill the gap
-			i_list[j] = i_list[k];
-            // Move j forward to ensure j == k - 1 on the next loop
-			j++;
-		} else if (i_list[k] == i) {
-            // i was found; set j to the current index
-			j = k;
-		}
-	}
-
-    // Reduce n and clear the space at the end
-	(*n)--;
-	i_list[*n] = 0;
-    // Return the list
-	return i_list;
-}
+// A tracker for the status of the last foreground process, and whether its deadline expired
+static int last_exit_status = 0;
+static bool last_timed_out = false;
+// The resource usage of the last foreground process, for "status -v"
+static struct job_usage last_usage;
 
 // int_to_str
 // Converts an integer into a string
@@ -136,219 +77,6 @@ char* int_to_str(int n, char* buffer) {
 	return buffer;
 }
 
-// expand_sh_vars
-// Replaces all occurrences of $$ with the current pid in a given string
-// Parameters: a 2049-char string to perform the substitution on
-// Returns: a pointer to the modified string
-char** expand_sh_vars (char** cmd_buf) {
-    // A pointer to the end of the string
-    char* buf_end = *cmd_buf + 2048;
-
-    // Find the first occurrence of $$
-	char* ptr = strstr(*cmd_buf, "$$");
-	// Loop until no more $$ are found
-    while (ptr != NULL) {
-        // Save a copy of the rest of cmd_buf after the current $$
-		char temp[2049];
-		strncpy(temp, ptr + 2, 2048);
-
-        // Get the current pid and convert it to a string
-		int curr_pid = getpid();
-		int digits = ceil(log10(curr_pid)) + 1;     // A calculation of the number of digits of the pid
-		char digit_str[digits + 1];                 // A buffer to receive the pid as a string
-		sprintf(digit_str, "%d", curr_pid);         // Print to the pid buffer from the integer pid
-
-        // Copy the string pid into cmd_buf up to the end
-        // buf_end - ptr - 1 is the number of chars between ptr and the end of cmd_buf
-		strncpy(ptr, digit_str, buf_end - ptr - 1);
-		
-        // Check whether the last statement ran into the end of cmd_buf
-		if (ptr + digits - 1 < buf_end) {
-            // Copy the rest of cmd_buf after the pid
-            // buf_end - (ptr + digits - 1) is the number of chars 
-            // between the end of the pid string and the end of cmd_buf
-			strncpy(ptr + digits - 1, temp, buf_end - (ptr + digits - 1));
-		}
-		
-        // Find the next occurrence of $$
-		ptr = strstr(*cmd_buf, "$$");
-	}
-    
-    // Return a pointer to the modified string
-	return cmd_buf;
-}
-
-// parse_cmd_args
-// Reads space-separated arguments from a string and adds them to a command struct
-// Parameters: a pointer to a command struct to read into and a pointer to a string to read from
-// Returns: the modified command struct
-struct command* parse_cmd_args(struct command* cmd, char** cmd_buf) {
-	// Char pointers for use with strtok_r()
-    char* token, * saveptr;
-	
-    // Read the first space-separated token (the command)
-    token = strtok_r(*cmd_buf, " ", &saveptr);
-    // Allocate a string for the command and copy it from the token
-	cmd->cmd = (char*) malloc(sizeof(char) * (strlen(token) + 1));
-	strncpy(cmd->cmd, token, strlen(token) + 1);
-	
-    // Allocate a string for the first argument (the command) and copy it from the command string
-	cmd->argv[0] = (char*) malloc(sizeof(char) * (strlen(cmd->cmd) + 1));
-	strncpy(cmd->argv[0], cmd->cmd, strlen(cmd->cmd) + 1);
-
-    // Read the next space-separated token
-	token = strtok_r(NULL, " ", &saveptr);
-    // Start counting arguments
-	cmd->argc = 1;
-	while (token != NULL) {
-        // Allocate space for each argument and copy it from the current token
-		cmd->argv[cmd->argc] = (char*) malloc(sizeof(char) * (strlen(token) + 1));
-		strncpy(cmd->argv[cmd->argc], token, strlen(token) + 1);
-        // Increment the argument counter
-		cmd->argc++;
-
-        // Find the next space-separated token
-		token = strtok_r(NULL, " ", &saveptr);
-	}
-
-    // Check for an & argument at the end
-	if (strcmp(cmd->argv[cmd->argc - 1], "&") == 0) {
-		// Register the command as a background process
-        cmd->background = true;
-
-        // Remove the & argument so it won't be passed to exec()
-		free(cmd->argv[cmd->argc - 1]);
-		cmd->argv[cmd->argc - 1] = NULL;
-		cmd->argc--;
-	} else {
-        // Otherwise, register the command as a foreground process
-		cmd->background = false;
-	}
-
-    // Return the pointer to the command struct
-    return cmd;
-}
-
-// parse_cmd_io_files
-// Checks a command struct for I/O redirect arguments and
-// registers them separately from other arguments
-// Parameters: a pointer to a command struct
-// Returns: the modified command struct
-struct command* parse_cmd_io_files(struct command* cmd) {
-	// Set the I/O files to NULL by default
-    cmd->i_file = NULL;
-	cmd->o_file = NULL;
-
-    // Count the number of arguments to remove (assuming >, <, and the file names should be removed)
-	int args_removed = 0;
-    // Loop from the first non-command argument to the penultimate argument
-    // (The last argument cannot be a valid I/O redirect sequence)
-	for (int i = 1; i < cmd->argc - 1; i++) {
-		// Alias the current argument for clarity
-        char* arg = cmd->argv[i];
-
-        // Check whether the current argument is the start of an I/O redirect sequence
-		if (strcmp(arg, "<") == 0) {
-            // Assume the next argument is a file name; calculate its length up to the file name maximum
-			int file_len = strlen(cmd->argv[i + 1]);
-			if (file_len > FILE_NAME_MAX) file_len = FILE_NAME_MAX;
-
-            // Copy the next argument into the input file field of the command struct
-			cmd->i_file = (char*) malloc(sizeof(char) * (file_len + 1));
-			strncpy(cmd->i_file, cmd->argv[i + 1], file_len + 1);
-			
-            // Free the current argument (<) and the next one (the file name)
-            // This prevents exec() from taking the I/O redirect sequence as an argument
-			free(cmd->argv[i]);
-			cmd->argv[i] = NULL;
-			free(cmd->argv[i + 1]);
-			cmd->argv[i + 1] = NULL;
-			i++;
-            // Count two arguments to be removed from the argument count at the end
-			args_removed += 2;
-		} else if (strcmp(arg, ">") == 0) {
-            // Assume the next argument is a file name; calculate its length up to the file name maximum
-			int file_len = strlen(cmd->argv[i + 1]);
-			if (file_len > FILE_NAME_MAX) file_len = FILE_NAME_MAX;
-
-            // Copy the next argument into the output file field of the command struct
-			cmd->o_file = (char*) malloc(sizeof(char) * (file_len + 1));
-			strncpy(cmd->o_file, cmd->argv[i + 1], file_len + 1);
-			
-            // Free the current argument (>) and the next one (the file name)
-            // This prevents exec() from taking the I/O redirect sequence as an argument
-			free(cmd->argv[i]);
-			cmd->argv[i] = NULL;
-			free(cmd->argv[i + 1]);
-			cmd->argv[i + 1] = NULL;
-			i++;
-            // Count two arguments to be removed from the argument count at the end
-			args_removed += 2;
-		}
-	}
-	
-    // If the command is for a background process and no I/O redirect is given, default to /dev/null
-	if (cmd->background) {
-		if (cmd->i_file == NULL) {
-			cmd->i_file = (char*) malloc(sizeof(char) * 10);
-			strncpy(cmd->i_file, "/dev/null", 10);
-		}
-
-		if (cmd->o_file == NULL) {
-			cmd->o_file = (char*) malloc(sizeof(char) * 10);
-			strncpy(cmd->o_file, "/dev/null", 10);
-		}
-	}
-
-    // Remove the arguments from the count of arguments
-	cmd->argc -= args_removed;
-
-    // Return a pointer to the modified command struct
-	return cmd;
-}
-
-// get_cmd
-// Reads a command from the user and parses it into a command struct
-// Parameters: none
-// Returns: a pointer to a filled command struct
-struct command* get_cmd() {
-    // Allocate space for the command struct; return NULL if this fails
-	struct command* cmd = (struct command*) calloc(1, sizeof(struct command));
-	if (cmd == NULL) return NULL;
-	
-    // Print the shell prompt
-	printf(": ");
-	fflush(stdout);
-	
-    // Allocate space for the maximum command size
-	char* cmd_buf = (char*) malloc(sizeof(char) * 2049);
-    // Buffer variables for use with getline()
-	char* buffer = NULL;
-	size_t buffer_size = 0;
-    // Get a line from stdin; return NULL if there is an error
-	getline(&buffer, &buffer_size, stdin);
-    if (ferror(stdin) != 0) return NULL;
-
-    // Copy the user input into a buffer of the right size
-    strncpy(cmd_buf, buffer, 2048);
-    // Remove the newline character
-	cmd_buf[strlen(cmd_buf) - 1] = '\0';
-    // If the resulting command string is empty, return NULL
-	if (strcmp(cmd_buf, "") == 0) return NULL;
-
-    // Replace $$ with the current pid
-	expand_sh_vars(&cmd_buf);
-    // Read the arguments into the command struct
-	parse_cmd_args(cmd, &cmd_buf);
-    // Check for I/O redirection
-	parse_cmd_io_files(cmd);
-
-    // Free the command string
-	free(cmd_buf);
-    // Return a pointer to the command struct
-	return cmd;
-}
-
 // cd
 // Changes the current working directory to HOME or a directory given by an argument
 // Parameters: a pointer to a non-empty command struct
@@ -363,8 +91,13 @@ int cd(struct command* cmd) {
         // Try to change the current working directory to the argument provided
 		err = chdir(cmd->argv[1]);
 	} else {
-        // Try to change the current working directory to the directory in the HOME environment variable
-		err = chdir(getenv("HOME"));
+        // Try to change the current working directory to the directory in the HOME variable
+		const char* home = vars_get("HOME");
+		if (home == NULL) {
+			fprintf(stderr, "cd: HOME not set\n");
+			return -1;
+		}
+		err = chdir(home);
 	}
 	
     // Return an error code if the directory change failed
@@ -379,246 +112,1149 @@ int cd(struct command* cmd) {
 
 // status
 // Prints the exit status or termination signal of the last non-custom foreground process that ended
-// Parameters: an integer status code set by waitpid()
+// Parameters: an integer status code set by wait4(), and whether the process was stopped by its deadline
 // Returns: none
-void status(int last_exit_status) {
+void status(int last_exit_status, bool timed_out) {
 	// Check if the last exit status was ended by a signal
     if (WIFSIGNALED(last_exit_status) == true) {
         // If so, print the termination signal
-		printf("Terminated by signal %d.\n", WTERMSIG(last_exit_status));
+		printf("Terminated by signal %d%s.\n", WTERMSIG(last_exit_status), timed_out ? " (timed out)" : "");
 	} else {
         // Otherwise, print the exit status
-		printf("Exit status %d.\n", WEXITSTATUS(last_exit_status));
+		printf("Exit status %d%s.\n", WEXITSTATUS(last_exit_status), timed_out ? " (timed out)" : "");
 	}
 	return;
 }
 
-// redirect_io
-// Redirects stdin and stdout to the files specified in a given command struct
+// hash
+// Lists the path and glob caches, clears them (-r), or resolves the given command names into the path cache
 // Parameters: a pointer to a non-empty command struct
-// Returns: 0 if successful, -1 on failure
-int redirect_io(struct command* cmd) {
-    // Check for a specified input file
-	if (cmd->i_file != NULL) {
-        // Try to open the specified input file for reading only; return an error code if unsuccessful
-		int fd = open(cmd->i_file, O_RDONLY);
-		if (fd == -1) {
-			perror(cmd->i_file);
-			return -1;
-		}
-
-        // Redirect stdin to the input file; return an error code if unsuccessful
-		int err = dup2(fd, STDIN_FILENO);
-		if (err == -1) {
-			perror("Redirect");
-			return -1;
-		}
-        // Close the input file descriptor
-		close(fd);
+// Returns: 0 if successful, -1 if a name was not found
+int hash(struct command* cmd) {
+    // With no arguments, list the cached commands and directories and the cache counters
+	if (cmd->argc == 1) {
+		pathcache_print();
+		globcache_print();
+		return 0;
 	}
 
-    // Check for a specified output file
-	if (cmd->o_file != NULL) {
-        // Try to open the specified output file for writing only; truncate it if it exists; create it if not
-        // Return an error code if unsuccessful
-		int fd = open(cmd->o_file, O_WRONLY | O_TRUNC | O_CREAT, 0770);
-		if (fd == -1) {
-			perror(cmd->o_file);
-			return -1;
+	int err = 0;
+	for (int i = 1; i < cmd->argc; i++) {
+		if (strcmp(cmd->argv[i], "-r") == 0) {
+            // Forget every cached command and directory listing
+			pathcache_clear();
+			globcache_clear();
+		} else if (pathcache_warm(cmd->argv[i]) == -1) {
+            // Pre-warm the cache with the named command
+			fprintf(stderr, "hash: %s: not found\n", cmd->argv[i]);
+			err = -1;
 		}
-
-        // Redirect stdout to the output file
-		int err = dup2(fd, STDOUT_FILENO);
-		if (err == -1) {
-			perror("Redirect");
-			return -1;
-		}
-        // Close the output file descriptor
-		close(fd);
 	}
+	return err;
+}
 
-    // Return a success code
-	return 0;
+// trace_child
+// Records the lifetime of a child reaped by the SIGCHLD handler in the trace
+// Parameters: a pointer to the child's job result
+// Returns: none
+void trace_child(const struct job_result* res) {
+	uint64_t start = trace_ts(&res->start);
+	trace_span("child", NULL, start, start + (uint64_t) (res->usage.wall * 1e9), res->pid, res->status);
+}
+
+// report_background
+// Prints a message about a background child process that has ended, and its resource usage if it was timed
+// or every job's is reported
+// Parameters: a pointer to the child's job result
+// Returns: none
+void report_background(const struct job_result* res) {
+	trace_child(res);
+	printf("Background process (pid = %d) ended. ", res->pid);
+	status(res->status, res->timed_out);
+	if (usage_every_job || res->tag == JOB_BACKGROUND_TIMED) usage_print(stderr, &res->usage);
 }
 
-// SIGTSTP_handler
-// A handler for SIGTSTP (Ctrl + Z); toggles foreground-only mode
-// Parameters: the triggering signal number
+// toggle_fg_only
+// Toggles foreground-only mode (on SIGTSTP, Ctrl + Z); since the signal is read from the event loop
+// rather than handled asynchronously, the message never lands in the middle of a foreground job's output
+// Parameters: none
 // Returns: none
-void SIGTSTP_handler(int sig_num) {
+void toggle_fg_only(void) {
 	// Print a different message depending on the current mode
     if (fg_only_mode == false) {
-		write(STDOUT_FILENO, "\nEntering foreground-only mode (& disabled).\n", 45);
+		printf("\nEntering foreground-only mode (& disabled).\n");
 	} else {
-		write(STDOUT_FILENO, "\nLeaving foreground-only mode (& enabled).\n", 43);
+		printf("\nLeaving foreground-only mode (& enabled).\n");
 	}
+	fflush(stdout);
     // Toggle the foreground-only mode flag
 	fg_only_mode = !fg_only_mode;
-	return;
 }
 
-// main
-// The program driver; runs a miniature shell
-// Parameters: argc, the number of arguments; argv, a list of strings of arguments
-// Returns: an exit code
-int main(int argc, char** argv) {
-    // Create a sigaction struct for custom SIGTSTP handling
-	struct sigaction SIGTSTP_action = {0};
-    // Attach the custom handler
-	SIGTSTP_action.sa_handler = &SIGTSTP_handler;
-    // Block all other signals while executing the handler
-	sigfillset(&SIGTSTP_action.sa_mask);
-    // Restart interrupted system calls (such as read())
-	SIGTSTP_action.sa_flags = SA_RESTART;
-    // Register the custom sigaction struct
-	sigaction(SIGTSTP, &SIGTSTP_action, NULL);
-
-    // A list to keep track of the pids of background child processes
-	int* children = (int*) calloc(512, sizeof(int));
-    // The number of background child processes
-	int n_children = 0;
-    // A tracker for the status of the last foreground process
-    int last_exit_status = 0;
-
-    // A pointer to receive command structs
-	struct command* cmd;
+// handle_events
+// Acts on the events reported by the event loop: signals the children whose deadlines have expired,
+// reaps ended jobs on SIGCHLD, and toggles foreground-only mode on SIGTSTP; SIGINT is ignored by the
+// shell itself
+// Parameters: the EV_* bits from events_wait() or events_poll()
+// Returns: the same bits
+int handle_events(int events) {
+	if (events & EV_TIMER) deadline_expire();
+	if (events & EV_CHILD) jobs_reap();
+	if (events & EV_TSTP) toggle_fg_only();
+	return events;
+}
 
-    // The program loop; the infinite loop is broken internally
-	while(true) {
-		// Block the process from receiving SIGINT
-		sigset_t sig_proc_mask;             // A set of signals to be masked (blocked)
-		sigemptyset(&sig_proc_mask);        // Empty the mask
-		sigaddset(&sig_proc_mask, SIGINT);  // Add SIGINT to the mask
-        // Set the process signal mask to the set just made (only SIGINT)
-		sigprocmask(SIG_SETMASK, &sig_proc_mask, NULL);
-
-        // Check for background child processes that have ended; don't pause execution (WNOHANG)
-		int bg_pid, bg_stat;
-		bg_pid = waitpid(-1, &bg_stat, WNOHANG);
-		if (bg_pid > 0) {
-            // Delete the pid of the ended process from the list of active background processes
-			delete_int(bg_pid, children, &n_children);
-
-            // Print an appropriate message about the ended process
-			printf("Background process (pid = %d) ended. ", bg_pid);
-			if (WIFSIGNALED(bg_stat) == true) {
-				printf("Terminated by signal %d.\n", WTERMSIG(bg_stat));
-			} else {
-				printf("Exit status %d.\n", WEXITSTATUS(bg_stat));
-			}
+// report_done_jobs
+// Reports every background job that has been reaped
+// Parameters: none
+// Returns: the number of jobs reported
+int report_done_jobs(void) {
+	int n = 0;
+	struct job_result res;
+	while (jobs_next_done(&res)) {
+		report_background(&res);
+		n++;
+	}
+	fflush(stdout);
+	return n;
+}
+
+// struct parallel_slot
+// A pipeline being run by run_in_slots()
+struct parallel_slot {
+	unsigned long id;           // The number it is reported by: its line number, or its iteration
+	int n_running;              // The number of its stages that are still running
+	pid_t last_pid;             // The pid of its last stage, whose status is the command's status
+	int status;                 // The status of its last stage
+	bool timed_out;             // Whether any of its stages was stopped by its deadline
+	struct job_usage usage;     // The resource usage of its finished stages
+};
+
+// struct subst_job
+// The stages of a running $(...) substitution
+struct subst_job {
+	int n_cmds;
+	pid_t pids[];
+};
+
+// subst_start
+// Launches the command line of a $(...) substitution with the last stage's stdout on a pipe; the line's
+// redirects and pipes work as at the prompt, and nothing else runs until the substitution has been read
+// Parameters: line, the command line; job, a pointer to receive the running stages
+// Returns: the read end of the pipe, or -1 if the line is empty or invalid or could not be launched
+int subst_start(const char* line, void** job) {
+	struct pipeline* pl = parse_pipeline(line);
+	if (pl == NULL) return -1;
+	struct subst_job* j = (struct subst_job*) malloc(sizeof(struct subst_job) + sizeof(pid_t) * pl->n_cmds);
+	int fds[2];
+	if (j == NULL || pipe2(fds, O_CLOEXEC) == -1) {
+		perror("smallsh: command substitution");
+		free(j);
+		free_pipeline(pl);
+		return -1;
+	}
+
+	uint64_t t_subst = trace_now();
+	int std_fds[3] = { -1, fds[1], -1 };
+	int n_pumps;
+	j->n_cmds = pl->n_cmds;
+	launch_pipeline(pl, j->pids, NULL, &n_pumps, std_fds, NULL);
+	trace_span("subst", pl->cmds[0].cmd, t_subst, trace_now(), 0, -1);
+	close(fds[1]);
+	free_pipeline(pl);
+	*job = j;
+	return fds[0];
+}
+
+// subst_finish
+// Waits for the stages of a $(...) substitution whose output has been read
+// Parameters: the running stages
+// Returns: the last stage's wait status
+int subst_finish(void* job) {
+	struct subst_job* j = (struct subst_job*) job;
+	int status = W_EXITCODE(EXIT_FAILURE, 0);
+	for (int i = 0; i < j->n_cmds; i++) {
+		if (j->pids[i] == -1) continue;
+		int stage_status;
+		waitpid(j->pids[i], &stage_status, 0);
+		if (i == j->n_cmds - 1) status = stage_status;
+	}
+	free(j);
+	return status;
+}
+
+static const struct subst_hooks subst_hooks = { subst_start, subst_finish };
+
+// The input whose command line is being parsed; the bodies of its here-documents are read from it too
+static struct input* heredoc_input = NULL;
+
+// wait_for_line
+// Sleeps until a whole line has been typed at the terminal; background jobs are reported and
+// foreground-only mode is toggled the moment their signals arrive, followed by a new prompt
+// Parameters: in, the terminal input; more, whether the line continues a command line (a here-document's body)
+// Returns: true once a line (or the end of the input) is ready, or false if SIGINT abandoned a continued line
+bool wait_for_line(struct input* in, bool more) {
+	void (*prompt)(struct input*) = more ? input_prompt_more : input_prompt;
+	prompt(in);
+    // Keys typed ahead may already hold the next line
+	bool ready = input_ready(in, false);
+	while (!ready) {
+		int events = events_wait(true);
+        // SIGINT abandons the line being typed; the line is taken off the screen while anything else is printed
+		if (events & EV_INT) input_cancel(in);
+		if (events & ~(EV_INPUT | EV_INT)) input_hide(in);
+		handle_events(events);
+		if (more && (events & EV_INT)) return false;
+		if (report_done_jobs() > 0 || (events & (EV_TSTP | EV_INT))) prompt(in);
+		input_show(in);
+		ready = (events & EV_INPUT) && input_ready(in, true);
+	}
+	return true;
+}
+
+// read_heredoc_line
+// Reads the next line of a here-document's body from the input of the command line being parsed; at a
+// terminal, the line is prompted for, and Ctrl + D ends only the here-document
+// Parameters: a pointer to receive the line
+// Returns: 1 if a line was read, 0 at the end of the input, or -1 if the command line is abandoned
+int read_heredoc_line(const char** line) {
+	struct input* in = heredoc_input;
+	if (in == NULL) {
+		fprintf(stderr, "smallsh: here-documents are not available here\n");
+		return -1;
+	}
+	if (in->interactive && !wait_for_line(in, true)) return -1;
+	*line = input_read_line(in);
+	if (*line != NULL) return 1;
+	input_resume(in);
+	return 0;
+}
+
+// parse_line
+// Parses a command line read from an input source, reading the bodies of its here-documents from the same source
+// Parameters: in, the input source; line, the command line
+// Returns: a pointer to a filled pipeline struct, or NULL if the line is empty, a comment, or invalid
+struct pipeline* parse_line(struct input* in, const char* line) {
+    // Reading a body reuses the input's line buffer, so a line that may have here-documents is copied first
+	char* copy = NULL;
+	if (strstr(line, "<<") != NULL) {
+		copy = strdup(line);
+		if (copy == NULL) return NULL;
+		line = copy;
+	}
+	struct input* outer = heredoc_input;
+	heredoc_input = in;
+	struct pipeline* pl = parse_pipeline(line);
+	heredoc_input = outer;
+	free(copy);
+	return pl;
+}
+
+// get_cmd
+// Reads a command line from an input source and parses it into a pipeline struct
+// Parameters: the input source to read from
+// Returns: a pointer to a filled pipeline struct, or NULL if the line is empty, a comment,
+//          or invalid, or if the input has ended
+struct pipeline* get_cmd(struct input* in) {
+    // Read the next line into the input's reusable line buffer; return NULL at the end of the input
+	uint64_t t_read = trace_now();
+	char* line = input_read_line(in);
+	trace_span("read", NULL, t_read, trace_now(), 0, in->n_lines);
+	if (line == NULL) return NULL;
+
+    // If the line is empty, only spaces, or a comment (beginning with #), return NULL without parsing it
+	char first = line[strspn(line, " \t")];
+	if (first == '\0' || first == '#') return NULL;
+
+    // At a terminal, replace a history reference with the line it recalls, showing the result, and record the line
+	if (in->interactive) {
+		const char* expanded = history_expand(line);
+		if (expanded == NULL) return NULL;
+		if (expanded != line) {
+			printf("%s\n", expanded);
 			fflush(stdout);
 		}
-		
-        // Get a command from the user; loop again if it is NULL
-		cmd = get_cmd();
-		if (cmd == NULL) continue;
+		line = (char*) expanded;
+		history_add(line);
+	}
 
-        // Check for an exit command
-		if (strcmp(cmd->cmd, "exit") == 0) {
-            // Kill all active background child processes
-			for (int i = 0; i < n_children; i++) {
-				kill(children[i], SIGKILL);
-			}
-            // Free the command struct and break the loop
-			free_command(cmd);
+    // Expand $$, split the stages and arguments, and register the I/O redirects in one pass
+	uint64_t t_parse = trace_now();
+	struct pipeline* pl = parse_line(in, line);
+	trace_span("parse", (pl != NULL) ? pl->cmds[0].cmd : NULL, t_parse, trace_now(), 0, (pl != NULL) ? pl->n_cmds : -1);
+	return pl;
+}
+
+// default_timeout
+// Reads the shell-wide time limit for jobs from the SMALLSH_TIMEOUT variable
+// Parameters: none
+// Returns: the limit in seconds, or 0 if there is none (or the variable is not a valid duration)
+double default_timeout(void) {
+	const char* value = vars_get("SMALLSH_TIMEOUT");
+	double secs;
+	if (value == NULL || value[0] == '\0' || deadline_parse(value, &secs) == -1) return 0;
+	return secs;
+}
+
+// parse_timeout
+// Reads the options of a "timeout [-k duration] duration" prefix
+// Parameters: cmd, a command starting with "timeout"; limit and kill_after, pointers to receive the time
+//             limit and the grace period before SIGKILL, in seconds
+// Returns: the number of words the prefix takes up, or -1 if it is invalid or no command follows it
+int parse_timeout(struct command* cmd, double* limit, double* kill_after) {
+	int i = 1;
+	if (strcmp(cmd->argv[i], "-k") == 0) {
+		if (i + 1 >= cmd->argc || deadline_parse(cmd->argv[i + 1], kill_after) == -1) i = cmd->argc;
+		else i += 2;
+	}
+	if (i + 1 >= cmd->argc || deadline_parse(cmd->argv[i], limit) == -1) {
+		fprintf(stderr, "usage: timeout [-k duration] duration command\n");
+		return -1;
+	}
+	return i + 1;
+}
+
+// parse_sched
+// Reads the options of a "sched [-c cpus] [-n nice] [-i class[:level]]" prefix, which override the shell-wide settings
+// Parameters: cmd, a command starting with "sched"; js, the settings to override; pinned, a pointer to receive
+//             whether the prefix chose the CPUs
+// Returns: the number of words the prefix takes up, or -1 if it is invalid or no command follows it
+int parse_sched(struct command* cmd, struct job_sched* js, bool* pinned) {
+	int i = 1;
+	*pinned = false;
+	while (i + 1 < cmd->argc && cmd->argv[i][0] == '-') {
+		const char* opt = cmd->argv[i];
+		const char* value = cmd->argv[i + 1];
+		if (strcmp(opt, "-c") == 0 && jobsched_parse_cpus(value, &js->cpus) == 0) {
+			js->set_cpus = true;
+			*pinned = true;
+		} else if (strcmp(opt, "-n") == 0 && jobsched_parse_nice(value, &js->nice) == 0) {
+			js->set_nice = true;
+		} else if (strcmp(opt, "-i") == 0 && jobsched_parse_ioprio(value, &js->ioprio) == 0) {
+			js->set_ioprio = true;
+		} else {
+			i = cmd->argc;
 			break;
 		}
+		i += 2;
+	}
+	if (i == 1 || i >= cmd->argc) {
+		fprintf(stderr, "usage: sched [-c cpus] [-n nice] [-i class[:level]] command\n");
+		return -1;
+	}
+	return i;
+}
 
-        // Check for a comment (beginning with #); loop again if so
-		if (strchr(cmd->cmd, '#') == cmd->cmd) {
-			free_command(cmd);
-			continue;
+// struct slot_feed
+// Where run_in_slots() gets the pipelines it runs, and what it calls them in its reports
+struct slot_feed {
+	const char* name;           // The name the reports start with
+	const char* unit;           // What a pipeline is called in the report of its failure
+	const char* units;          // What the pipelines are called in the summary
+	// Sets *pl to the next pipeline, or NULL if it is invalid, and *id to the number it is reported by;
+	// returns false once there are no more
+	bool (*next)(void* ctx, struct pipeline** pl, unsigned long* id);
+	void (*release)(struct pipeline* pl);               // Releases a launched pipeline, or NULL
+	void* ctx;
+};
+
+// run_in_slots
+// Runs pipelines with at most N of them running at once; a new one starts as soon as a running one ends.
+// Every pipeline runs like a foreground command, except that it doesn't read the shell's input, and is
+// held to the shell-wide time limit and scheduling settings. Failed pipelines are reported as they end,
+// followed by a summary; SIGINT stops new pipelines from starting.
+// Parameters: n_slots, N; feed, the pipelines; SIGCHLD must be blocked
+// Returns: 0 if every pipeline succeeded, 1 if any failed
+int run_in_slots(long n_slots, const struct slot_feed* feed) {
+	double limit = default_timeout();
+	struct job_sched js;
+	jobsched_defaults(&js);
+
+    // The slots, and a stack of the ones that are free
+	struct parallel_slot* slots = (struct parallel_slot*) calloc(n_slots, sizeof(struct parallel_slot));
+	int* free_slots = (int*) malloc(sizeof(int) * n_slots);
+	for (int i = 0; i < n_slots; i++) free_slots[i] = n_slots - 1 - i;
+	int n_free = n_slots;
+
+	unsigned long n_started = 0, n_failed = 0;
+	bool eof = false;
+	while (eof == false || n_free < n_slots) {
+        // Start pipelines until every slot is busy or there are no more
+		while (eof == false && n_free > 0) {
+			struct pipeline* pl;
+			unsigned long id;
+			if (!feed->next(feed->ctx, &pl, &id)) {
+				eof = true;
+				break;
+			}
+			n_started++;
+			if (pl == NULL) {
+				n_failed++;
+				continue;
+			}
+
+            // Every pipeline runs like a foreground command, except that it doesn't read the shell's input
+			if (pl->cmds[0].i_file == NULL && pl->cmds[0].here == NULL) pl->cmds[0].i_file = "/dev/null";
+			for (int i = 0; i < pl->n_cmds; i++) {
+				pl->cmds[i].background = false;
+			}
+
+            // Launch the pipeline in a free slot; its stages are tagged with the slot so their ends can be matched up
+			int s = free_slots[--n_free];
+			struct parallel_slot* slot = &slots[s];
+			pid_t pids[pl->n_cmds];
+			int n_pumps;
+			struct timespec start;
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			launch_pipeline(pl, pids, NULL, &n_pumps, NULL, &js);
+			slot->id = id;
+			slot->n_running = 0;
+			slot->last_pid = pids[pl->n_cmds - 1];
+			slot->status = W_EXITCODE(EXIT_FAILURE, 0);
+			slot->timed_out = false;
+			usage_init(&slot->usage);
+			for (int i = 0; i < pl->n_cmds; i++) {
+				if (pids[i] != -1 && jobs_add(pids[i], s + 1, &start) == 0) slot->n_running++;
+				if (pids[i] != -1 && limit > 0 && deadline_add(pids[i], limit, DEADLINE_KILL_AFTER) == -1) perror("timeout");
+			}
+			if (feed->release != NULL) feed->release(pl);
+
+            // A pipeline with no running stages could not be started at all
+			if (slot->n_running == 0) {
+				n_failed++;
+				free_slots[n_free++] = s;
+			}
+		}
+		if (n_free == n_slots) continue;
+
+        // Sleep until a signal arrives, then account for every child that has ended;
+        // trace events are written out first, while there is nothing else to do
+		trace_idle();
+		if (handle_events(events_wait(false)) & EV_INT) eof = true;
+		struct job_result res;
+		while (jobs_next_done(&res)) {
+			if (res.tag <= JOB_BACKGROUND) {
+				report_background(&res);
+				continue;
+			}
+
+			trace_child(&res);
+			struct parallel_slot* slot = &slots[res.tag - 1];
+			if (res.pid == slot->last_pid) slot->status = res.status;
+			usage_merge(&slot->usage, &res.usage);
+			slot->timed_out = slot->timed_out || res.timed_out;
+			if (--slot->n_running > 0) continue;
+
+            // The pipeline has finished; report it if it failed and free its slot
+			if (WIFSIGNALED(slot->status) || WEXITSTATUS(slot->status) != 0) {
+				n_failed++;
+				printf("%s: %s %lu: ", feed->name, feed->unit, slot->id);
+				status(slot->status, slot->timed_out);
+			}
+			if (usage_every_job) {
+				fprintf(stderr, "%s: %s %lu: ", feed->name, feed->unit, slot->id);
+				usage_print(stderr, &slot->usage);
+			}
+			free_slots[n_free++] = res.tag - 1;
+		}
+		fflush(stdout);
+	}
+
+    // Print a summary of the exit statuses
+	printf("%s: %lu %s, %lu succeeded, %lu failed\n", feed->name, n_started, feed->units, n_started - n_failed, n_failed);
+	fflush(stdout);
+
+	free(slots);
+	free(free_slots);
+	return (n_failed > 0) ? 1 : 0;
+}
+
+// next_line
+// Reads and parses the next command line for the parallel builtin, skipping empty lines and comments
+// Parameters: ctx, the input of command lines; pl, a pointer to receive the pipeline; id, a pointer to receive its line number
+// Returns: false at the end of the input, true otherwise
+bool next_line(void* ctx, struct pipeline** pl, unsigned long* id) {
+	struct input* lines = (struct input*) ctx;
+	while (true) {
+		char* line = input_read_line(lines);
+		if (line == NULL) return false;
+		char first = line[strspn(line, " \t")];
+		if (first == '\0' || first == '#') continue;
+		*id = lines->n_lines;
+		*pl = parse_line(lines, line);
+		return true;
+	}
+}
+
+// release_line
+// Frees a pipeline the parallel builtin has launched
+// Parameters: the pipeline
+// Returns: none
+void release_line(struct pipeline* pl) {
+	free_pipeline(pl);
+}
+
+// parallel
+// Runs command lines from a file, the builtin's input redirect or here-document, or stdin, keeping at most N of them running
+// (-j N, default: the number of online CPUs); a new line starts as soon as a running one ends
+// Parameters: a pointer to a non-empty command struct; SIGCHLD must be blocked
+// Returns: 0 if every command succeeded, 1 if any failed, or -1 on a usage error
+int parallel(struct command* cmd) {
+    // Read the options: -j N (or -jN) and an optional file of command lines
+	long n_slots = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n_slots < 1) n_slots = 1;
+	const char* path = cmd->i_file;
+	for (int i = 1; i < cmd->argc; i++) {
+		char* arg = cmd->argv[i];
+		if (strncmp(arg, "-j", 2) == 0) {
+			char* value = (arg[2] != '\0') ? arg + 2 : (i + 1 < cmd->argc) ? cmd->argv[++i] : "";
+			char* end;
+			n_slots = strtol(value, &end, 10);
+			if (*value == '\0' || *end != '\0' || n_slots < 1) {
+				fprintf(stderr, "usage: parallel [-j N] [file]\n");
+				return -1;
+			}
+		} else {
+			path = arg;
 		}
+	}
+
+    // Open the command lines; prompts are never shown for them
+	struct input lines;
+	if (path != NULL) {
+		if (input_open_file(&lines, path) == -1) return -1;
+	} else if (cmd->here != NULL) {
+		if (input_open_string(&lines, cmd->here) == -1) return -1;
+	} else {
+		input_open_stdin(&lines);
+		lines.interactive = false;
+	}
+
+	struct slot_feed feed = { "parallel", "line", "commands", next_line, release_line, &lines };
+	int rc = run_in_slots(n_slots, &feed);
+	input_close(&lines);
+	return rc;
+}
+
+// status_builtin
+// Runs the status builtin; -v adds the resource usage of the last foreground process
+// Parameters: a pointer to a non-empty command struct
+// Returns: 0
+int status_builtin(struct command* cmd) {
+	status(last_exit_status, last_timed_out);
+	if (cmd->argc > 1 && strcmp(cmd->argv[1], "-v") == 0) usage_print(stdout, &last_usage);
+	return 0;
+}
+
+// cache_builtin
+// Manages the result cache when "cache" is given without a command: -c clears it, and otherwise its statistics are printed
+// Parameters: a pointer to a non-empty command struct
+// Returns: 0
+int cache_builtin(struct command* cmd) {
+	if (cmd->argc > 1 && strcmp(cmd->argv[1], "-c") == 0) cache_clear();
+	else cache_print();
+	return 0;
+}
+
+// export_builtin
+// Sets variables given as NAME=value, or lists every variable when given no arguments; a NAME alone is
+// accepted and left as it is, since every variable is exported
+// Parameters: a pointer to a non-empty command struct
+// Returns: 0 if successful, 1 if an argument was not a valid name
+int export_builtin(struct command* cmd) {
+	if (cmd->argc == 1) {
+		vars_print();
+		return 0;
+	}
 
-        // Check for a cd command
-		if (strcmp(cmd->cmd, "cd") == 0) {
-			// Call the custom cd function
-            cd(cmd);
-            // Free the command struct and loop again
-			free_command(cmd);
+	int rc = 0;
+	for (int i = 1; i < cmd->argc; i++) {
+		char* eq = strchr(cmd->argv[i], '=');
+		size_t len = (eq != NULL) ? (size_t) (eq - cmd->argv[i]) : strlen(cmd->argv[i]);
+		if (!vars_valid_name(cmd->argv[i], len)) {
+			fprintf(stderr, "export: '%s': not a valid name\n", cmd->argv[i]);
+			rc = 1;
 			continue;
 		}
+		if (eq == NULL) continue;
+        // Split the argument into the name and the value
+		*eq = '\0';
+		if (vars_set(cmd->argv[i], eq + 1) == -1) {
+			perror("export");
+			rc = 1;
+		}
+		*eq = '=';
+	}
+	return rc;
+}
 
-        // Check for a status command
-		if (strcmp(cmd->cmd, "status") == 0) {
-			// Call the custom status function
-            status(last_exit_status);
-            // Free the command struct and loop again
-			free_command(cmd);
+// unset_builtin
+// Removes the named variables
+// Parameters: a pointer to a non-empty command struct
+// Returns: 0 if successful, 1 if an argument was not a valid name
+int unset_builtin(struct command* cmd) {
+	int rc = 0;
+	for (int i = 1; i < cmd->argc; i++) {
+		if (!vars_valid_name(cmd->argv[i], strlen(cmd->argv[i]))) {
+			fprintf(stderr, "unset: '%s': not a valid name\n", cmd->argv[i]);
+			rc = 1;
 			continue;
 		}
+		vars_unset(cmd->argv[i]);
+	}
+	return rc;
+}
 
-        // Disable background processes if in foreground-only mode
-		if (fg_only_mode == true && cmd->background == true) {
-			cmd->background = false;
+// history_builtin
+// Lists the recorded command lines, or only the last N of them
+// Parameters: a pointer to a non-empty command struct
+// Returns: 0 if successful, 1 if N is not a number or the history is not available
+int history_builtin(struct command* cmd) {
+	long n = 0;
+	if (cmd->argc > 1) {
+		char* end;
+		n = strtol(cmd->argv[1], &end, 10);
+		if (cmd->argv[1][0] == '\0' || *end != '\0' || n < 0 || cmd->argc > 2) {
+			fprintf(stderr, "usage: history [N]\n");
+			return 1;
 		}
+	}
+	return (history_print(n) == 0) ? 0 : 1;
+}
 
-        // Create a child process; print an error if this fails (spawn_pid == -1)
-		pid_t spawn_pid = fork();
-		if (spawn_pid == -1) {
-			perror("");
-			return EXIT_FAILURE;
-		} else if (spawn_pid == 0) {
-            // The child process
-            // Block SIGTSTP in all child processes
-            // Block SIGINT if the child process is a background process
-			sigemptyset(&sig_proc_mask);            // Empty the mask signal set
-			sigaddset(&sig_proc_mask, SIGTSTP);     // Add SIGTSTP to the mask
-			if (cmd->background == true) {
-				sigaddset(&sig_proc_mask, SIGINT);  // Add SIGINT to the mask
-			}
-            // Set the process signal mask for this child process
-			sigprocmask(SIG_SETMASK, &sig_proc_mask, NULL);
-			
-            // Try to redirect I/O; return an error code if unsuccessful
-			int err = redirect_io(cmd);
-			if (err == -1) {
-				return EXIT_FAILURE;
+// Flags describing how a builtin runs
+#define BUILTIN_REDIRECT 1      // Its < and > redirects are applied to the shell's own stdin and stdout while it runs
+#define BUILTIN_STATUS 2        // Its exit code becomes the status reported by "status" (unless it returns -1)
+#define BUILTIN_FOREGROUND 4    // It only runs in the shell in the foreground; in the background, the program of the same name is launched
+
+// struct builtin
+// An entry in the builtin dispatch table
+struct builtin {
+	const char* name;
+	int (*run)(struct command* cmd);
+	int flags;
+};
+
+// The builtin dispatch table; exit is handled by the program loop itself
+static const struct builtin builtins[] = {
+	{ "cd", &cd, 0 },
+	{ "status", &status_builtin, BUILTIN_REDIRECT },
+	{ "parallel", &parallel, BUILTIN_STATUS },
+	{ "cache", &cache_builtin, BUILTIN_REDIRECT },
+	{ "hash", &hash, BUILTIN_REDIRECT },
+	{ "history", &history_builtin, BUILTIN_REDIRECT | BUILTIN_STATUS },
+	{ "export", &export_builtin, BUILTIN_REDIRECT | BUILTIN_STATUS },
+	{ "unset", &unset_builtin, BUILTIN_STATUS },
+	{ "echo", &builtin_echo, BUILTIN_REDIRECT | BUILTIN_STATUS | BUILTIN_FOREGROUND },
+	{ "true", &builtin_true, BUILTIN_REDIRECT | BUILTIN_STATUS | BUILTIN_FOREGROUND },
+	{ "false", &builtin_false, BUILTIN_REDIRECT | BUILTIN_STATUS | BUILTIN_FOREGROUND },
+	{ "pwd", &builtin_pwd, BUILTIN_REDIRECT | BUILTIN_STATUS | BUILTIN_FOREGROUND },
+	{ "test", &builtin_test, BUILTIN_REDIRECT | BUILTIN_STATUS | BUILTIN_FOREGROUND },
+	{ "[", &builtin_test, BUILTIN_REDIRECT | BUILTIN_STATUS | BUILTIN_FOREGROUND },
+	{ "printf", &builtin_printf, BUILTIN_REDIRECT | BUILTIN_STATUS | BUILTIN_FOREGROUND },
+};
+
+// find_builtin
+// Looks up a command name in the builtin dispatch table
+// Parameters: the command name
+// Returns: a pointer to the builtin's entry, or NULL if the command is not a builtin
+const struct builtin* find_builtin(const char* name) {
+	for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+		if (strcmp(name, builtins[i].name) == 0) return &builtins[i];
+	}
+	return NULL;
+}
+
+// run_builtin
+// Runs a builtin in the shell, with its redirects applied to the shell's stdin and stdout for the duration
+// Parameters: b, the builtin's entry; cmd, a pointer to a non-empty command struct
+// Returns: none
+void run_builtin(const struct builtin* b, struct command* cmd) {
+	int saved[2] = { -1, -1 };
+	int rc;
+	uint64_t t_start = trace_now();
+
+	if (b->flags & BUILTIN_REDIRECT) {
+        // Open the redirect files; a builtin whose files cannot be opened fails without running
+		int fds[2];
+		if (redirect_io(cmd, &fds[0], &fds[1]) == -1) {
+			if (b->flags & BUILTIN_STATUS) {
+				last_exit_status = W_EXITCODE(EXIT_FAILURE, 0);
+				last_timed_out = false;
 			}
+			return;
+		}
+        // Swap them in for the shell's stdin and stdout, keeping copies of the originals
+		fflush(stdout);
+		for (int i = 0; i < 2; i++) {
+			if (fds[i] == -1) continue;
+			saved[i] = fcntl(i, F_DUPFD_CLOEXEC, 10);
+			dup2(fds[i], i);
+			close(fds[i]);
+		}
+	}
+
+	rc = b->run(cmd);
 
-            // Execute the command, searching the directory indicated by
-            // the PATH environment variable for programs if necessary
-            execvp(cmd->cmd, cmd->argv);
+    // Put the shell's own stdin and stdout back
+	fflush(stdout);
+	for (int i = 0; i < 2; i++) {
+		if (saved[i] == -1) continue;
+		dup2(saved[i], i);
+		close(saved[i]);
+	}
+	if (saved[0] != -1) clearerr(stdin);
 
-            // If exec() returns, the command failed; print an error and return an error code
-			perror(cmd->cmd);
-			return EXIT_FAILURE;
+	if ((b->flags & BUILTIN_STATUS) && rc != -1) {
+		last_exit_status = W_EXITCODE(rc, 0);
+		last_timed_out = false;
+	}
+	trace_span("builtin", cmd->cmd, t_start, trace_now(), 0, rc);
+}
+
+// run_pipeline
+// Runs a parsed command line as the prompt does: its prefixes are applied, and it is run as a builtin or
+// launched, in the foreground or in the background
+// Parameters: pl, the pipeline, which the caller frees; in, the input it was read from
+// Returns: false if it was the exit command, true otherwise
+bool run_pipeline(struct pipeline* pl, struct input* in) {
+    // A time prefix reports the resource usage of the pipeline after it, a cache prefix serves the
+    // command from the result cache, and timeout and sched prefixes override the shell-wide time limit
+    // and scheduling settings for the pipeline's stages; any order works
+	struct command* cmd = &pl->cmds[0];
+	bool timed = false, cached = false, limited = false, scheduled = false, pinned = false;
+	double limit = default_timeout(), kill_after = DEADLINE_KILL_AFTER;
+	struct job_sched js;
+	jobsched_defaults(&js);
+	int skip = 0;
+	while (cmd->argc > 1 && skip != -1) {
+		if (!timed && strcmp(cmd->cmd, "time") == 0) {
+			timed = true;
+			skip = 1;
+		} else if (!cached && strcmp(cmd->cmd, "cache") == 0 && cmd->argv[1][0] != '-') {
+			cached = true;
+			skip = 1;
+		} else if (!limited && strcmp(cmd->cmd, "timeout") == 0) {
+			limited = true;
+			skip = parse_timeout(cmd, &limit, &kill_after);
+			if (skip == -1) break;
+		} else if (!scheduled && strcmp(cmd->cmd, "sched") == 0) {
+			scheduled = true;
+			skip = parse_sched(cmd, &js, &pinned);
+			if (skip == -1) break;
 		} else {
-            // The parent process
-            // Block SIGINT in the parent process to keep the shell running
-			sigemptyset(&sig_proc_mask);        // Empty the mask
-			sigaddset(&sig_proc_mask, SIGINT);  // Add SIGINT to the mask
-            // Set the process signal mask; implicitly, this enables SIGTSTP
-			sigprocmask(SIG_SETMASK, &sig_proc_mask, NULL);
-			
-            // Check if the command was for a background process
-			if (cmd->background) {
-                // Add the background child pid to the list of active background child processes
-				children[n_children++] = spawn_pid;
-				
-                // Print a message about the created background process
-				printf("Background process (pid = %d) created.\n", spawn_pid);
-				fflush(stdout);
-			} else {
-                // Wait for the foreground child to finish and get its status
-				int child_status;
-				waitpid(spawn_pid, &child_status, 0);
-                // Update the tracker for the status of the last ended foreground process
-				last_exit_status = child_status;
-                // If the child process was ended by a signal, print a message about it
-				if (WIFSIGNALED(child_status) == true) {
-					printf("\nTerminated by signal %d.\n", WTERMSIG(child_status));
-				}
-                // Flush any input read by the terminal while the foreground child process was running
-				tcflush(STDIN_FILENO, TCIFLUSH);
+			break;
+		}
+		cmd->argv += skip;
+		cmd->argc -= skip;
+		cmd->cmd = cmd->argv[0];
+	}
+	if (skip == -1) {
+		last_exit_status = W_EXITCODE(EXIT_FAILURE, 0);
+		last_timed_out = false;
+		return true;
+	}
+
+    // Disable background processes if in foreground-only mode
+	if (fg_only_mode == true && pl->background == true) {
+		pl->background = false;
+		for (int i = 0; i < pl->n_cmds; i++) {
+			pl->cmds[i].background = false;
+		}
+	}
+
+    // Background jobs take turns on the CPUs in $SMALLSH_SPREAD, unless the sched prefix chose their CPUs
+	if (pl->background && !pinned) jobsched_spread(&js);
+
+    // Built-in commands only run as single-stage pipelines
+	if (pl->n_cmds == 1) {
+        // Check for an exit command
+		if (strcmp(cmd->cmd, "exit") == 0) return false;
+
+        // Look the command up in the builtin dispatch table; the trivial utilities are only
+        // run in the shell in the foreground
+		const struct builtin* b = find_builtin(cmd->cmd);
+		if (b != NULL && !((b->flags & BUILTIN_FOREGROUND) && pl->background)) {
+            // A builtin that sets the status also sets the usage "status -v" reports: what the shell, and
+            // the children it waited for, used while the builtin ran
+			bool measured = timed || (b->flags & BUILTIN_STATUS);
+			struct job_usage usage;
+			struct timespec start, end;
+			if (measured) {
+				usage_self(&usage);
+				clock_gettime(CLOCK_MONOTONIC, &start);
 			}
+			run_builtin(b, cmd);
+			if (measured) {
+				struct job_usage before = usage;
+				clock_gettime(CLOCK_MONOTONIC, &end);
+				usage_self(&usage);
+				usage_since(&usage, &before);
+				usage.wall = usage_elapsed(&start, &end);
+				if (b->flags & BUILTIN_STATUS) last_usage = usage;
+				if (timed || usage_every_job) usage_print(stderr, &usage);
+			}
+			return true;
 		}
+	}
+
+    // Launch every stage of the pipeline; splice() pumps are only used for foreground pipelines,
+    // since the shell has to stay with them to move the data
+	pid_t pids[pl->n_cmds];
+	struct pump pumps[2];
+	int n_pumps;
+	bool use_pumps = splice_mode && pl->background == false;
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
 
-        // Free the command struct
-		free_command(cmd);
+    // A cached single-stage foreground command is replayed on a hit; on a miss, its stdout is captured
+	struct cache_ticket ticket;
+	enum cache_state cache_state = CACHE_BYPASS;
+	if (cached && pl->n_cmds == 1 && pl->background == false) {
+		cache_state = cache_begin(cmd, &ticket);
+		if (cache_state == CACHE_HIT) {
+			last_exit_status = ticket.status;
+			last_timed_out = false;
+			// A replay uses no child resources, only time
+			usage_init(&last_usage);
+			struct timespec end;
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			last_usage.wall = usage_elapsed(&start, &end);
+			if (timed || usage_every_job) usage_print(stderr, &last_usage);
+			return true;
+		}
 	}
+	int n_started = launch_pipeline(pl, pids, use_pumps ? pumps : NULL, &n_pumps, (cache_state == CACHE_MISS) ? ticket.std_fds : NULL, &js);
 
-    // If execution reaches this point, the exit command was given; return a success code
+    // Put the time limit on every stage that started
+	for (int i = 0; i < pl->n_cmds && limit > 0; i++) {
+		if (pids[i] != -1 && deadline_add(pids[i], limit, kill_after) == -1) perror("timeout");
+	}
+
+	if (pl->background) {
+		for (int i = 0; i < pl->n_cmds; i++) {
+			if (pids[i] == -1) continue;
+            // Add the background child pid to the job table, noting whether its usage is to be reported
+			if (jobs_add(pids[i], timed ? JOB_BACKGROUND_TIMED : JOB_BACKGROUND, &start) == -1) perror("jobs");
+
+            // Print a message about the created background process
+			printf("Background process (pid = %d) created.\n", pids[i]);
+		}
+		fflush(stdout);
+	} else {
+        // Move the pipeline's redirected data until its streams end
+		uint64_t t_wait = trace_now();
+		pump_run(pumps, n_pumps);
+
+        // Wait for every stage to finish, collecting its resource usage; the pipeline's status is
+        // the last stage's, which counts as a failure if that stage could not be started.
+        // Deadlines that expire meanwhile, the pipeline's own or a background job's, are acted on.
+		int child_status = W_EXITCODE(EXIT_FAILURE, 0);
+		bool timed_out = false;
+		usage_init(&last_usage);
+		for (int i = 0; i < pl->n_cmds; i++) {
+			if (pids[i] == -1) continue;
+			int stage_status;
+			struct rusage ru;
+			deadline_wait(pids[i]);
+			wait4(pids[i], &stage_status, 0, &ru);
+			if (deadline_remove(pids[i])) timed_out = true;
+			usage_add(&last_usage, &ru);
+			trace_span("child", pl->cmds[i].cmd, trace_ts(&start), trace_now(), pids[i], stage_status);
+			if (i == pl->n_cmds - 1) child_status = stage_status;
+		}
+		struct timespec end;
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		last_usage.wall = usage_elapsed(&start, &end);
+		trace_span("wait", cmd->cmd, t_wait, trace_ts(&end), 0, child_status);
+        // Deliver and store the output of a cache miss; one stopped by its deadline is only delivered,
+        // like one killed by a signal, even if it caught the signal and exited, and so is one that didn't start
+		if (cache_state == CACHE_MISS) {
+			cache_end(&ticket, timed_out ? W_EXITCODE(0, SIGTERM) : child_status, n_started == pl->n_cmds);
+		}
+        // Update the tracker for the status of the last ended foreground process
+		last_exit_status = child_status;
+		last_timed_out = timed_out;
+        // If the child process was ended by a signal, print a message about it
+		if (WIFSIGNALED(child_status) == true) {
+			printf("\nTerminated by signal %d%s.\n", WTERMSIG(child_status), timed_out ? " (timed out)" : "");
+		}
+        // Print the resource usage if the pipeline was timed
+		if (timed || usage_every_job) usage_print(stderr, &last_usage);
+        // Flush any input read by the terminal while the foreground child process was running
+		if (in->interactive) tcflush(STDIN_FILENO, TCIFLUSH);
+	}
+	return true;
+}
+
+// struct loop_feed
+// The iterations of a loop, as run_in_slots() takes them
+struct loop_feed {
+	struct pipeline* pl;        // The loop's pipeline, filled in for each iteration in turn
+	unsigned long next;         // The next iteration
+};
+
+// next_iteration
+// Fills a loop's pipeline in for its next iteration
+// Parameters: ctx, the loop_feed; pl, a pointer to receive the pipeline; id, a pointer to receive the iteration, from 1
+// Returns: false once every iteration has been started, true otherwise
+bool next_iteration(void* ctx, struct pipeline** pl, unsigned long* id) {
+	struct loop_feed* lf = (struct loop_feed*) ctx;
+	if (lf->next == lf->pl->loop->n_iters) return false;
+	*id = lf->next + 1;
+	*pl = (parse_loop_iteration(lf->pl, lf->next++) == 0) ? lf->pl : NULL;
+	return true;
+}
+
+// run_loop
+// Runs a for or repeat loop: its iterations one after another, each like a command line at the prompt, or
+// with -j N, up to N of them at once like the lines of the parallel builtin
+// Parameters: pl, the loop's pipeline; in, the input it was read from
+// Returns: false if an iteration was the exit command, true otherwise
+bool run_loop(struct pipeline* pl, struct input* in) {
+	struct loop* lp = pl->loop;
+	if (lp->jobs > 0) {
+		struct loop_feed lf = { pl, 0 };
+		struct slot_feed feed = { lp->keyword, "iteration", "iterations", next_iteration, NULL, &lf };
+		last_exit_status = W_EXITCODE(run_in_slots(lp->jobs, &feed), 0);
+		last_timed_out = false;
+		return true;
+	}
+
+    // The loop's status is its last iteration's, or success if none ran
+	last_exit_status = 0;
+	last_timed_out = false;
+	for (unsigned long i = 0; i < lp->n_iters; i++) {
+		if (parse_loop_iteration(pl, i) == -1) {
+			perror(lp->keyword);
+			break;
+		}
+		if (!run_pipeline(pl, in)) return false;
+
+        // Report the background jobs that ended meanwhile; SIGINT, whether or not it ended the iteration, ends the loop
+		int events = handle_events(events_poll());
+		report_done_jobs();
+		if ((events & EV_INT) || (WIFSIGNALED(last_exit_status) && WTERMSIG(last_exit_status) == SIGINT)) break;
+	}
+	return true;
+}
+
+// struct options
+// Holds the shell's command-line options
+struct options {
+	const char* command;        // The commands given with -c, or NULL
+	const char* script;         // The script file to run, or NULL
+	bool stats;                 // Whether to report line throughput at exit
+	const char* trace;          // The file to write a trace of the shell's phases to, or NULL
+	const char* serve;          // The socket to serve command lines on, or NULL
+	const char* client;         // The socket of a server to send command lines to, or NULL
+	int max_jobs;               // The most pipelines the server runs at once
+	bool edit;                  // Whether to read a terminal with the line editor
+};
+
+// parse_options
+// Reads the shell's command-line options; the SMALLSH_SPAWN and SMALLSH_TRACE environment variables
+// supply the default engine and trace file
+// Parameters: argc, the number of arguments; argv, a list of strings of arguments;
+//             opts, a pointer to an options struct to fill
+// Returns: 0 if successful, -1 on an invalid option
+int parse_options(int argc, char** argv, struct options* opts) {
+	// The long options accepted by the shell
+	static const struct option long_options[] = {
+		{ "spawn", required_argument, NULL, 's' },
+		{ "stats", no_argument, NULL, 'S' },
+		{ "splice", no_argument, NULL, 'p' },
+		{ "time-jobs", no_argument, NULL, 't' },
+		{ "trace", required_argument, NULL, 'T' },
+		{ "serve", required_argument, NULL, 'L' },
+		{ "client", required_argument, NULL, 'C' },
+		{ "max-jobs", required_argument, NULL, 'j' },
+		{ "no-edit", no_argument, NULL, 'E' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	opts->command = NULL;
+	opts->script = NULL;
+	opts->stats = false;
+	opts->serve = NULL;
+	opts->client = NULL;
+	opts->edit = true;
+	opts->max_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	if (opts->max_jobs < 1) opts->max_jobs = 1;
+	// Take the trace file from the environment if it is set
+	opts->trace = getenv("SMALLSH_TRACE");
+
+	// Take the default engine from the environment if it is set
+	char* engine = getenv("SMALLSH_SPAWN");
+	if (engine != NULL && spawn_parse_engine(engine, &spawn_engine) == -1) {
+		fprintf(stderr, "smallsh: unknown spawn engine '%s'\n", engine);
+		return -1;
+	}
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "+c:", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'c':
+			// Run the given commands instead of reading from stdin
+			opts->command = optarg;
+			break;
+		case 's':
+			// Select the engine used to launch commands
+			if (spawn_parse_engine(optarg, &spawn_engine) == -1) {
+				fprintf(stderr, "smallsh: unknown spawn engine '%s' (expected posix, vfork, or fork)\n", optarg);
+				return -1;
+			}
+			break;
+		case 'S':
+			opts->stats = true;
+			break;
+		case 'p':
+			// Move pipeline redirect data with splice() in the shell
+			splice_mode = true;
+			break;
+		case 't':
+			// Print the resource usage of every job as it ends
+			usage_every_job = true;
+			break;
+		case 'T':
+			// Record the shell's phases and its children's lifetimes
+			opts->trace = optarg;
+			break;
+		case 'L':
+			// Run as a resident server for command lines sent by clients
+			opts->serve = optarg;
+			break;
+		case 'C':
+			// Send the command lines to a resident server instead of running them
+			opts->client = optarg;
+			break;
+		case 'E':
+			// Read the terminal's lines as it delivers them, without the line editor
+			opts->edit = false;
+			break;
+		case 'j': {
+			// Cap the number of pipelines the server runs at once
+			char* end;
+			opts->max_jobs = strtol(optarg, &end, 10);
+			if (*optarg == '\0' || *end != '\0' || opts->max_jobs < 1) {
+				fprintf(stderr, "smallsh: invalid job count '%s'\n", optarg);
+				return -1;
+			}
+			break;
+		}
+		default:
+			fprintf(stderr, "usage: %s [--spawn=posix|vfork|fork] [--stats] [--splice] [--time-jobs] [--trace=FILE]\n"
+			        "       [--no-edit] [--serve=SOCKET [--max-jobs=N] | --client=SOCKET] [-c commands | script]\n", argv[0]);
+			return -1;
+		}
+	}
+
+	// The first operand, if any, is a script to run
+	if (optind < argc && opts->command == NULL) opts->script = argv[optind];
+	return 0;
+}
+
+// main
+// The program driver; runs a miniature shell
+// Parameters: argc, the number of arguments; argv, a list of strings of arguments
+// Returns: an exit code
+int main(int argc, char** argv) {
+    // Read the command-line options; exit with an error code if they are invalid
+	struct options opts;
+	if (parse_options(argc, argv, &opts) == -1) return EXIT_FAILURE;
+
+    // In server mode, run command lines from clients until SIGINT
+	if (opts.serve != NULL) {
+		if (events_init(-1) == -1) return EXIT_FAILURE;
+		parse_init();
+		return (server_run(opts.serve, opts.max_jobs) == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+    // Open the source of commands: a -c string, a script file, or stdin
+	struct input in;
+	int err;
+	if (opts.command != NULL) {
+		err = input_open_string(&in, opts.command);
+	} else if (opts.script != NULL) {
+		err = input_open_file(&in, opts.script);
+	} else {
+		err = input_open_stdin(&in);
+	}
+	if (err == -1) return EXIT_FAILURE;
+
+    // In client mode, send the command lines to a server and exit with the last one's status
+	if (opts.client != NULL) {
+		err = client_run(opts.client, &in);
+		input_close(&in);
+		return err;
+	}
+
+    // Edit the lines typed at a terminal; every builtin completes as a command name
+	if (opts.edit && in.interactive && input_use_editor(&in) == 0) {
+		for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+			pathindex_add_builtin(builtins[i].name);
+		}
+		pathindex_add_builtin("exit");
+	}
+
+    // Start tracing if requested
+	if (opts.trace != NULL && opts.trace[0] != '\0' && trace_open(opts.trace) == -1) return EXIT_FAILURE;
+
+    // Start timing the input for the throughput report
+	struct timespec start_time;
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+    // Route SIGCHLD, SIGINT, and SIGTSTP through the event loop; a terminal is watched for input with them
+	if (events_init(in.interactive ? fileno(in.stream) : -1) == -1) return EXIT_FAILURE;
+    // Wake the loop when a job's deadline expires
+	if (events_watch(deadline_init(), EV_TIMER) == -1) return EXIT_FAILURE;
+
+    // Cache the shell's pid for $$ expansion, and run $(...) substitutions in the shell
+	parse_init();
+	parse_set_subst_hooks(&subst_hooks);
+	parse_set_heredoc_reader(read_heredoc_line);
+
+    // The program loop; the infinite loop is broken internally
+	while(true) {
+        // Act on the signals that arrived while the last command ran, and report every background
+        // child process that has ended
+		handle_events(events_poll());
+		report_done_jobs();
+
+        // Write out trace events before waiting for input, so the writes don't land inside a measured span
+		trace_idle();
+
+        // On a terminal, sleep until a line has been typed
+		if (in.interactive) wait_for_line(&in, false);
+		struct pipeline* pl = get_cmd(&in);
+
+        // Loop again if the command line is NULL, or stop at the end of the input
+		if (pl == NULL) {
+			if (in.eof) break;
+			continue;
+		}
+
+        // Run the line; a loop runs its body once for each iteration
+		bool go_on = (pl->loop != NULL) ? run_loop(pl, &in) : run_pipeline(pl, &in);
+		free_pipeline(pl);
+		if (!go_on) break;
+	}
+
+    // The exit command was given or the input ended; kill all active background child processes
+	jobs_kill_all(SIGKILL);
+
+    // Report the line throughput if requested
+	if (opts.stats) {
+		struct timespec end_time;
+		clock_gettime(CLOCK_MONOTONIC, &end_time);
+		double secs = usage_elapsed(&start_time, &end_time);
+		fprintf(stderr, "smallsh: %lu lines in %.3f s (%.0f lines/s)\n",
+		        in.n_lines, secs, (secs > 0) ? in.n_lines / secs : 0.0);
+	}
+	trace_close();
+	input_close(&in);
+
+    // Return a success code
 	return EXIT_SUCCESS;
 }
 
@@ -0,0 +1,614 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#include "editor.h"
+#include "globcache.h"
+#include "history.h"
+#include "pathindex.h"
+
+// The most completions listed at once
+#define EDITOR_MAX_LISTED 200
+
+// The keys the editor handles, after escape sequences have been decoded
+enum editor_key {
+	KEY_NONE = 256, KEY_LEFT, KEY_RIGHT, KEY_UP, KEY_DOWN, KEY_HOME, KEY_END, KEY_DELETE, KEY_WORD_LEFT, KEY_WORD_RIGHT
+};
+
+// The characters a completed name has to have escaped with a backslash to reach the command as they are
+static const char* special_chars = " \t\\'\"$*?[]|<>&#";
+
+// struct completions
+// The names a word can be completed to
+struct completions {
+	char** names;
+	size_t n, cap;
+	bool owned;                 // Whether the names were copied (and have to be freed)
+};
+
+// is_continuation
+// Checks whether a byte continues a UTF-8 character, rather than starting one
+// Parameters: the byte
+// Returns: true if it is a continuation byte
+static bool is_continuation(char c) {
+	return ((unsigned char) c & 0xC0) == 0x80;
+}
+
+// next_char
+// Gets the offset of the character after the one at an offset
+// Parameters: ed, the editor; at, the offset of a character in the line
+// Returns: the offset of the next character, or the line's length
+static size_t next_char(const struct editor* ed, size_t at) {
+	if (at < ed->len) at++;
+	while (at < ed->len && is_continuation(ed->buf[at])) at++;
+	return at;
+}
+
+// prev_char
+// Gets the offset of the character before an offset
+// Parameters: ed, the editor; at, an offset in the line
+// Returns: the offset of the previous character, or 0
+static size_t prev_char(const struct editor* ed, size_t at) {
+	if (at > 0) at--;
+	while (at > 0 && is_continuation(ed->buf[at])) at--;
+	return at;
+}
+
+// columns
+// Counts the terminal columns a part of the line takes up, one per character
+// Parameters: s, the text; len, its length in bytes
+// Returns: the number of columns
+static size_t columns(const char* s, size_t len) {
+	size_t n = 0;
+	for (size_t i = 0; i < len; i++) {
+		if (!is_continuation(s[i])) n++;
+	}
+	return n;
+}
+
+// write_all
+// Writes a whole buffer to the terminal
+// Parameters: data, the bytes; len, their number
+// Returns: none
+static void write_all(const char* data, size_t len) {
+	while (len > 0) {
+		ssize_t n = write(STDOUT_FILENO, data, len);
+		if (n == -1 && errno == EINTR) continue;
+		if (n <= 0) return;
+		data += n;
+		len -= n;
+	}
+}
+
+// refresh
+// Draws the prompt and the line over the terminal's current row, scrolling the line sideways to keep the cursor visible
+// Parameters: the editor
+// Returns: none
+static void refresh(struct editor* ed) {
+	struct winsize ws;
+	size_t cols = (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0) ? ws.ws_col : 80;
+	size_t prompt_cols = strlen(ed->prompt);
+	// The last column stays free, so the cursor never wraps onto the next row
+	size_t width = (cols > prompt_cols + 1) ? cols - prompt_cols - 1 : 1;
+
+	if (ed->cursor < ed->scroll) ed->scroll = ed->cursor;
+	while (columns(ed->buf + ed->scroll, ed->cursor - ed->scroll) > width) ed->scroll = next_char(ed, ed->scroll);
+	size_t end = ed->scroll, shown = 0;
+	while (end < ed->len && shown < width) {
+		end = next_char(ed, end);
+		shown++;
+	}
+
+	char* out;
+	size_t out_len;
+	FILE* stream = open_memstream(&out, &out_len);
+	if (stream == NULL) return;
+	fprintf(stream, "\r%s%.*s\x1b[K\r", ed->prompt, (int) (end - ed->scroll), ed->buf + ed->scroll);
+	size_t cursor_col = prompt_cols + columns(ed->buf + ed->scroll, ed->cursor - ed->scroll);
+	if (cursor_col > 0) fprintf(stream, "\x1b[%zuC", cursor_col);
+	fclose(stream);
+	write_all(out, out_len);
+	free(out);
+	ed->hidden = false;
+}
+
+// reserve
+// Makes sure the line can grow by a number of bytes
+// Parameters: ed, the editor; extra, the number of bytes
+// Returns: 0 if successful, -1 on failure
+static int reserve(struct editor* ed, size_t extra) {
+	if (ed->len + extra + 1 <= ed->cap) return 0;
+	size_t cap = (ed->cap == 0) ? 256 : ed->cap;
+	while (cap < ed->len + extra + 1) cap *= 2;
+	char* grown = (char*) realloc(ed->buf, cap);
+	if (grown == NULL) return -1;
+	ed->buf = grown;
+	ed->cap = cap;
+	return 0;
+}
+
+// insert
+// Inserts text at the cursor and moves the cursor past it
+// Parameters: ed, the editor; text, the text; len, its length
+// Returns: none
+static void insert(struct editor* ed, const char* text, size_t len) {
+	if (reserve(ed, len) == -1) return;
+	memmove(ed->buf + ed->cursor + len, ed->buf + ed->cursor, ed->len - ed->cursor + 1);
+	memcpy(ed->buf + ed->cursor, text, len);
+	ed->len += len;
+	ed->cursor += len;
+}
+
+// erase
+// Removes part of the line, moving the cursor to where it was
+// Parameters: ed, the editor; from and to, the byte range to remove
+// Returns: none
+static void erase(struct editor* ed, size_t from, size_t to) {
+	memmove(ed->buf + from, ed->buf + to, ed->len - to + 1);
+	ed->len -= to - from;
+	ed->cursor = from;
+}
+
+// set_line
+// Replaces the whole line, with the cursor at its end
+// Parameters: ed, the editor; line, the new line
+// Returns: none
+static void set_line(struct editor* ed, const char* line) {
+	ed->len = 0;
+	ed->cursor = 0;
+	ed->buf[0] = '\0';
+	insert(ed, line, strlen(line));
+}
+
+// is_blank
+// Checks whether a character separates words
+// Parameters: the character
+// Returns: true for a space or tab
+static bool is_blank(char c) {
+	return c == ' ' || c == '\t';
+}
+
+// word_left
+// Finds the start of the word before an offset
+// Parameters: ed, the editor; at, the offset
+// Returns: the offset of the word's start
+static size_t word_left(const struct editor* ed, size_t at) {
+	while (at > 0 && is_blank(ed->buf[at - 1])) at--;
+	while (at > 0 && !is_blank(ed->buf[at - 1])) at--;
+	return at;
+}
+
+// word_right
+// Finds the end of the word after an offset
+// Parameters: ed, the editor; at, the offset
+// Returns: the offset just past the word
+static size_t word_right(const struct editor* ed, size_t at) {
+	while (at < ed->len && is_blank(ed->buf[at])) at++;
+	while (at < ed->len && !is_blank(ed->buf[at])) at++;
+	return at;
+}
+
+// recall
+// Moves through the history, keeping the new line so coming back down restores it
+// Parameters: ed, the editor; back, the distance from the end of the history to move to (0 for the new line)
+// Returns: none
+static void recall(struct editor* ed, unsigned long back) {
+	const char* line = (back > 0) ? history_recall(back) : ed->saved;
+	if (line == NULL) return;
+	if (ed->back == 0) {
+		free(ed->saved);
+		ed->saved = strdup(ed->buf);
+		if (ed->saved == NULL) return;
+	}
+	// The saved line may be the one shown next, so it is only freed once it has been copied
+	char* saved = (back == 0) ? ed->saved : NULL;
+	set_line(ed, line);
+	if (saved != NULL) {
+		free(saved);
+		ed->saved = NULL;
+	}
+	ed->back = back;
+}
+
+// add_completion
+// Adds a path a pattern matched to the completions; called by the glob cache
+// Parameters: path, the path; len, its length; ctx, the completions
+// Returns: 0 to go on, or -1 on failure
+static int add_completion(const char* path, size_t len, void* ctx) {
+	struct completions* c = (struct completions*) ctx;
+	if (c->n == c->cap) {
+		size_t cap = (c->cap == 0) ? 64 : c->cap * 2;
+		char** grown = (char**) realloc(c->names, sizeof(char*) * cap);
+		if (grown == NULL) return -1;
+		c->names = grown;
+		c->cap = cap;
+	}
+	c->names[c->n] = strndup(path, len);
+	if (c->names[c->n] == NULL) return -1;
+	c->n++;
+	return 0;
+}
+
+// shown_name
+// Gets the part of a completion that is listed: the last component of a path
+// Parameters: the completion
+// Returns: the part to list
+static const char* shown_name(const char* name) {
+	const char* slash = strrchr(name, '/');
+	return (slash != NULL && slash[1] != '\0') ? slash + 1 : name;
+}
+
+// list_completions
+// Prints the completions in columns under the line, which is then drawn again; paths are shown by their last component
+// Parameters: ed, the editor; c, the completions
+// Returns: none
+static void list_completions(struct editor* ed, const struct completions* c) {
+	size_t n = (c->n < EDITOR_MAX_LISTED) ? c->n : EDITOR_MAX_LISTED;
+	size_t widest = 0;
+	for (size_t i = 0; i < n; i++) {
+		size_t w = columns(shown_name(c->names[i]), strlen(shown_name(c->names[i])));
+		if (w > widest) widest = w;
+	}
+	struct winsize ws;
+	size_t cols = (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0) ? ws.ws_col : 80;
+	size_t per_row = cols / (widest + 2);
+	if (per_row == 0) per_row = 1;
+
+	// Fill the columns top to bottom, as ls does
+	size_t rows = (n + per_row - 1) / per_row;
+	printf("\n");
+	for (size_t r = 0; r < rows; r++) {
+		for (size_t i = r; i < n; i += rows) {
+			const char* shown = shown_name(c->names[i]);
+			fputs(shown, stdout);
+			// Pad every column but the last of the row
+			if (i + rows < n) printf("%*s", (int) (widest + 2 - columns(shown, strlen(shown))), "");
+		}
+		printf("\n");
+	}
+	if (c->n > n) printf("(%zu more)\n", c->n - n);
+	fflush(stdout);
+	refresh(ed);
+}
+
+// complete
+// Completes the word before the cursor: a command name from the path index if it is the first word of a
+// stage, or a path from the glob cache otherwise; a unique completion is finished with a space (or a slash
+// for a directory), several are completed as far as they agree, and a second Tab lists them
+// Parameters: the editor
+// Returns: none
+static void complete(struct editor* ed) {
+	// The word runs back from the cursor to a blank or an operator that isn't escaped
+	size_t start = ed->cursor;
+	while (start > 0) {
+		char c = ed->buf[start - 1];
+		bool escaped = (start >= 2 && ed->buf[start - 2] == '\\');
+		if (!escaped && (is_blank(c) || c == '|' || c == '<' || c == '>' || c == '&')) break;
+		start--;
+	}
+	char word[ed->cursor - start + 1];
+	size_t word_len = 0;
+	for (size_t i = start; i < ed->cursor; i++) {
+		if (ed->buf[i] == '\\' && i + 1 < ed->cursor) i++;
+		word[word_len++] = ed->buf[i];
+	}
+	word[word_len] = '\0';
+
+	// The first word of a stage names a command, unless it is a path
+	size_t p = start;
+	while (p > 0 && is_blank(ed->buf[p - 1])) p--;
+	bool command = (p == 0 || ed->buf[p - 1] == '|') && strchr(word, '/') == NULL;
+
+	struct completions c = { NULL, 0, 0, !command };
+	if (command) {
+		c.n = pathindex_find(word, word_len, &c.names);
+	} else {
+		// Match every name that starts with the word, taken literally
+		char pattern[2 * word_len + 2];
+		size_t n = 0;
+		for (size_t i = 0; i < word_len; i++) {
+			if (strchr("*?[]\\", word[i]) != NULL) pattern[n++] = '\\';
+			pattern[n++] = word[i];
+		}
+		pattern[n++] = '*';
+		pattern[n] = '\0';
+		globcache_expand(pattern, add_completion, &c);
+	}
+
+	// Find how far the completions agree beyond the word
+	size_t common = 0;
+	if (c.n > 0 && strncmp(c.names[0], word, word_len) == 0) {
+		common = strlen(c.names[0]);
+		for (size_t i = 1; i < c.n && common > word_len; i++) {
+			size_t j = word_len;
+			while (j < common && c.names[i][j] == c.names[0][j]) j++;
+			common = j;
+		}
+	}
+
+	if (common > word_len || c.n == 1) {
+		// Insert the rest, escaping what the lexer would otherwise take as syntax
+		for (size_t i = word_len; i < common; i++) {
+			if (strchr(special_chars, c.names[0][i]) != NULL) insert(ed, "\\", 1);
+			insert(ed, &c.names[0][i], 1);
+		}
+		struct stat st;
+		if (c.n == 1) insert(ed, (!command && stat(c.names[0], &st) == 0 && S_ISDIR(st.st_mode)) ? "/" : " ", 1);
+		refresh(ed);
+	} else if (c.n > 1 && ed->tabbed) {
+		list_completions(ed, &c);
+	}
+
+	if (c.owned) {
+		for (size_t i = 0; i < c.n; i++) free(c.names[i]);
+		free(c.names);
+	}
+}
+
+// read_key
+// Decodes the next key from the keys read so far
+// Parameters: in, the keys; n, their number (at least 1); used, a pointer to receive the number of bytes the key took up
+// Returns: the key: a byte, or a KEY_* value for an escape sequence; KEY_NONE if the sequence is incomplete
+static int read_key(const char* in, size_t n, size_t* used) {
+	*used = 1;
+	if (in[0] != '\x1b') return (unsigned char) in[0];
+	if (n < 2) return KEY_NONE;
+
+	// Alt + B and Alt + F move by words
+	if (in[1] == 'b' || in[1] == 'f') {
+		*used = 2;
+		return (in[1] == 'b') ? KEY_WORD_LEFT : KEY_WORD_RIGHT;
+	}
+	if (in[1] != '[' && in[1] != 'O') {
+		*used = 1;
+		return 0;
+	}
+
+	// CSI and SS3 sequences: ESC [ params final, or ESC O final
+	size_t i = 2;
+	while (i < n && ((in[i] >= '0' && in[i] <= '9') || in[i] == ';')) i++;
+	if (i >= n) return KEY_NONE;
+	*used = i + 1;
+	int param = atoi(in + 2);
+	// Ctrl + Left and Ctrl + Right carry the modifier 5
+	bool ctrl = (i >= 4 && in[i - 2] == ';' && in[i - 1] == '5');
+	switch (in[i]) {
+	case 'A': return KEY_UP;
+	case 'B': return KEY_DOWN;
+	case 'C': return ctrl ? KEY_WORD_RIGHT : KEY_RIGHT;
+	case 'D': return ctrl ? KEY_WORD_LEFT : KEY_LEFT;
+	case 'H': return KEY_HOME;
+	case 'F': return KEY_END;
+	case '~':
+		if (param == 1 || param == 7) return KEY_HOME;
+		if (param == 4 || param == 8) return KEY_END;
+		if (param == 3) return KEY_DELETE;
+		return 0;
+	default: return 0;
+	}
+}
+
+// handle_key
+// Applies a key to the line
+// Parameters: ed, the editor; key, the key
+// Returns: the state of the line afterwards
+static enum editor_state handle_key(struct editor* ed, int key) {
+	bool tabbed = false;
+	switch (key) {
+	case '\r':
+	case '\n':
+		return EDITOR_LINE;
+	case 4:         // Ctrl + D
+		if (ed->len == 0) return EDITOR_EOF;
+		// Fall through
+	case KEY_DELETE:
+		if (ed->cursor < ed->len) erase(ed, ed->cursor, next_char(ed, ed->cursor));
+		break;
+	case 127:       // Backspace
+	case 8:         // Ctrl + H
+		if (ed->cursor > 0) erase(ed, prev_char(ed, ed->cursor), ed->cursor);
+		break;
+	case 1:         // Ctrl + A
+	case KEY_HOME:
+		ed->cursor = 0;
+		break;
+	case 5:         // Ctrl + E
+	case KEY_END:
+		ed->cursor = ed->len;
+		break;
+	case 2:         // Ctrl + B
+	case KEY_LEFT:
+		ed->cursor = prev_char(ed, ed->cursor);
+		break;
+	case 6:         // Ctrl + F
+	case KEY_RIGHT:
+		ed->cursor = next_char(ed, ed->cursor);
+		break;
+	case KEY_WORD_LEFT:
+		ed->cursor = word_left(ed, ed->cursor);
+		break;
+	case KEY_WORD_RIGHT:
+		ed->cursor = word_right(ed, ed->cursor);
+		break;
+	case 11:        // Ctrl + K
+		erase(ed, ed->cursor, ed->len);
+		break;
+	case 21:        // Ctrl + U
+		erase(ed, 0, ed->cursor);
+		break;
+	case 23:        // Ctrl + W
+		erase(ed, word_left(ed, ed->cursor), ed->cursor);
+		break;
+	case 12:        // Ctrl + L
+		write_all("\x1b[H\x1b[2J", 7);
+		break;
+	case 16:        // Ctrl + P
+	case KEY_UP:
+		recall(ed, ed->back + 1);
+		break;
+	case 14:        // Ctrl + N
+	case KEY_DOWN:
+		if (ed->back > 0) recall(ed, ed->back - 1);
+		break;
+	case '\t':
+		complete(ed);
+		tabbed = true;
+		break;
+	default:
+		// Other control characters are ignored
+		if (key >= 32 && key < 256 && key != 127) {
+			char c = (char) key;
+			insert(ed, &c, 1);
+		}
+		break;
+	}
+	ed->tabbed = tabbed;
+	return EDITOR_EDITING;
+}
+
+// raw_mode
+// Switches the terminal to raw mode, or back to its own settings
+// Parameters: ed, the editor; on, whether to switch to raw mode
+// Returns: none
+static void raw_mode(struct editor* ed, bool on) {
+	if (on == ed->active) return;
+	struct termios raw = ed->cooked;
+	// Keys arrive one at a time and unechoed; ISIG stays on so Ctrl + C and Ctrl + Z still raise their signals
+	raw.c_lflag &= ~(ICANON | ECHO | IEXTEN);
+	raw.c_iflag &= ~(IXON);
+	raw.c_cc[VMIN] = 1;
+	raw.c_cc[VTIME] = 0;
+	// TCSADRAIN keeps the keys typed ahead, which TCSAFLUSH would throw away
+	tcsetattr(ed->fd, TCSADRAIN, on ? &raw : &ed->cooked);
+	ed->active = on;
+}
+
+// editor_init
+// Sets up an editor for a terminal
+// Parameters: ed, the editor to set up; fd, the terminal
+// Returns: 0 if successful, -1 if the terminal's settings can't be read
+int editor_init(struct editor* ed, int fd) {
+	memset(ed, 0, sizeof(struct editor));
+	ed->fd = fd;
+	ed->prompt = "";
+	if (tcgetattr(fd, &ed->cooked) == -1 || reserve(ed, 0) == -1) return -1;
+	ed->buf[0] = '\0';
+	return 0;
+}
+
+// editor_prompt
+// Starts a new line with a prompt, or draws the line being edited again on a new row (after something else was printed)
+// Parameters: ed, the editor; prompt, the prompt
+// Returns: none
+void editor_prompt(struct editor* ed, const char* prompt) {
+	ed->prompt = prompt;
+	if (!ed->active) {
+		raw_mode(ed, true);
+		ed->state = EDITOR_EDITING;
+		ed->len = 0;
+		ed->cursor = 0;
+		ed->scroll = 0;
+		ed->buf[0] = '\0';
+		ed->back = 0;
+		ed->tabbed = false;
+		free(ed->saved);
+		ed->saved = NULL;
+		// Apply the changes to PATH's directories now, while nothing is waiting on the index
+		pathindex_refresh();
+	}
+	refresh(ed);
+}
+
+// editor_hide
+// Clears the line being edited off the screen, so something can be printed in its place
+// Parameters: the editor
+// Returns: none
+void editor_hide(struct editor* ed) {
+	if (!ed->active || ed->hidden) return;
+	write_all("\r\x1b[K", 4);
+	ed->hidden = true;
+}
+
+// editor_show
+// Draws the line being edited again if it was hidden
+// Parameters: the editor
+// Returns: none
+void editor_show(struct editor* ed) {
+	if (ed->active && ed->hidden) refresh(ed);
+}
+
+// editor_cancel
+// Abandons the line being edited (on Ctrl + C), leaving it on the screen, and starts an empty one on the next row
+// Parameters: the editor
+// Returns: none
+void editor_cancel(struct editor* ed) {
+	if (!ed->active) return;
+	if (ed->hidden) refresh(ed);
+	write_all("^C\n", 3);
+	ed->len = 0;
+	ed->cursor = 0;
+	ed->scroll = 0;
+	ed->buf[0] = '\0';
+	ed->back = 0;
+	ed->hidden = true;
+}
+
+// editor_feed
+// Handles the keys typed so far: those read earlier but not handled yet, then, if the terminal is readable, what it holds
+// Parameters: ed, the editor; readable, whether the terminal has input (it is only read then, so this never blocks)
+// Returns: the state of the line; once it is EDITOR_LINE or EDITOR_EOF, the terminal is back in its own mode
+enum editor_state editor_feed(struct editor* ed, bool readable) {
+	if (!ed->active) return ed->state;
+	if (readable && ed->n_input < sizeof(ed->input)) {
+		ssize_t n = read(ed->fd, ed->input + ed->n_input, sizeof(ed->input) - ed->n_input);
+		if (n > 0) ed->n_input += n;
+		else if (n == 0 || errno != EINTR) ed->state = EDITOR_EOF;
+	}
+
+	// Handle every complete key; an escape sequence cut short waits for the rest of it
+	size_t done = 0;
+	bool changed = false;
+	while (ed->state == EDITOR_EDITING && done < ed->n_input) {
+		size_t used;
+		int key = read_key(ed->input + done, ed->n_input - done, &used);
+		if (key == KEY_NONE) break;
+		done += used;
+		ed->state = handle_key(ed, key);
+		changed = true;
+	}
+	memmove(ed->input, ed->input + done, ed->n_input - done);
+	ed->n_input -= done;
+
+	if (ed->state == EDITOR_EDITING) {
+		if (changed) refresh(ed);
+		return EDITOR_EDITING;
+	}
+
+	// Leave the finished line on the screen in full (even if it was shown scrolled), and give the terminal back
+	if (ed->state == EDITOR_LINE) {
+		write_all("\r\x1b[K", 4);
+		write_all(ed->prompt, strlen(ed->prompt));
+		write_all(ed->buf, ed->len);
+	}
+	write_all("\n", 1);
+	raw_mode(ed, false);
+	return ed->state;
+}
+
+// editor_close
+// Gives the terminal back if a line was being edited, and frees the editor's buffers
+// Parameters: the editor
+// Returns: none
+void editor_close(struct editor* ed) {
+	raw_mode(ed, false);
+	free(ed->buf);
+	free(ed->saved);
+	ed->buf = NULL;
+	ed->saved = NULL;
+}
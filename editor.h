@@ -0,0 +1,53 @@
+#ifndef EDITOR_H
+#define EDITOR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <termios.h>
+
+// The line editor reads the terminal in raw mode (no line buffering or echo, but Ctrl + C and
+// Ctrl + Z still raise their signals) while a command line is being typed, and draws the line
+// itself: the cursor moves and the line is edited in place, Up and Down browse the history, and
+// Tab completes command names from the path index and file names from the glob cache. The
+// terminal is back in its own mode whenever a command runs. Keys are fed to the editor as the
+// event loop sees input, so background jobs are still reported while a line is being typed.
+
+// What editor_feed() left the line in
+enum editor_state {
+	EDITOR_EDITING,             // The line is still being typed
+	EDITOR_LINE,                // Enter was pressed; the line is in the buffer
+	EDITOR_EOF                  // Ctrl + D on an empty line, or the terminal hung up
+};
+
+// The size of the buffer of keys read but not yet handled (such as a pasted line after the current one)
+#define EDITOR_INPUT_SIZE 4096
+
+// struct editor
+// The state of the line being edited
+struct editor {
+	int fd;                     // The terminal
+	struct termios cooked;      // The terminal's own settings, restored while commands run
+	enum editor_state state;
+	bool active;                // Whether a line is being edited (and the terminal is in raw mode)
+	bool hidden;                // Whether the line has been taken off the screen
+	const char* prompt;
+	char* buf;                  // The line, null-terminated
+	size_t len, cap;
+	size_t cursor;              // The byte offset of the cursor
+	size_t scroll;              // The first byte shown, when the line is wider than the terminal
+	bool tabbed;                // Whether the last key was Tab; a second Tab lists the completions
+	unsigned long back;         // How far back in the history the line was recalled from (0 for a new line)
+	char* saved;                // The new line, kept while the history is browsed
+	char input[EDITOR_INPUT_SIZE];
+	size_t n_input;             // The number of keys read but not yet handled
+};
+
+int editor_init(struct editor* ed, int fd);
+void editor_prompt(struct editor* ed, const char* prompt);
+void editor_hide(struct editor* ed);
+void editor_show(struct editor* ed);
+void editor_cancel(struct editor* ed);
+enum editor_state editor_feed(struct editor* ed, bool readable);
+void editor_close(struct editor* ed);
+
+#endif
@@ -0,0 +1,143 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+
+#include "events.h"
+
+static int signal_fd = -1;
+static int epoll_fd = -1;
+static int watched_fd = -1;         // The input watched for EV_INPUT, or -1
+
+// The other descriptors registered with events_watch(), and the event each one reports
+#define EVENTS_MAX_EXTRA 4
+static struct pollfd extra_fds[EVENTS_MAX_EXTRA];
+static int extra_events[EVENTS_MAX_EXTRA];
+static int n_extra = 0;
+
+// events_init
+// Blocks the signals the shell handles, and creates the signalfd and the epoll set that watches it and the input
+// Parameters: the input descriptor to watch, or -1 to only watch signals
+// Returns: 0 if successful, -1 on failure
+int events_init(int input_fd) {
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTSTP);
+	// Children get their own signal mask from the spawn engine, so blocking here only affects the shell
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+
+	signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (signal_fd == -1 || epoll_fd == -1) {
+		perror("events");
+		return -1;
+	}
+
+	struct epoll_event ev = { .events = EPOLLIN, .data.fd = signal_fd };
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &ev) == -1) {
+		perror("events");
+		return -1;
+	}
+	if (input_fd != -1) {
+		ev.data.fd = input_fd;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, input_fd, &ev) == -1) {
+			perror("events");
+			return -1;
+		}
+		watched_fd = input_fd;
+	}
+	return 0;
+}
+
+// events_watch
+// Adds a descriptor to the ones the shell sleeps on; it is reported as an event when it becomes readable,
+// and stays reported until it has been drained
+// Parameters: fd, the descriptor; event, the EV_* bit to report it as
+// Returns: 0 if successful, -1 on failure
+int events_watch(int fd, int event) {
+	if (n_extra == EVENTS_MAX_EXTRA) {
+		errno = ENOSPC;
+		return -1;
+	}
+	struct epoll_event ev = { .events = EPOLLIN, .data.fd = fd };
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) return -1;
+	extra_fds[n_extra] = (struct pollfd) { fd, POLLIN, 0 };
+	extra_events[n_extra++] = event;
+	return 0;
+}
+
+// events_poll
+// Reads every pending signal from the signalfd, and checks the other watched descriptors, without blocking
+// Parameters: none
+// Returns: the EV_* bits of the signals that were pending and the descriptors that are readable, or 0
+int events_poll(void) {
+	int events = 0;
+	if (n_extra > 0 && poll(extra_fds, n_extra, 0) > 0) {
+		for (int j = 0; j < n_extra; j++) {
+			if (extra_fds[j].revents != 0) events |= extra_events[j];
+		}
+	}
+	struct signalfd_siginfo info[16];
+	ssize_t n;
+	while ((n = read(signal_fd, info, sizeof(info))) > 0) {
+		for (int i = 0; i < n / (ssize_t) sizeof(struct signalfd_siginfo); i++) {
+			if (info[i].ssi_signo == SIGCHLD) events |= EV_CHILD;
+			else if (info[i].ssi_signo == SIGINT) events |= EV_INT;
+			else if (info[i].ssi_signo == SIGTSTP) events |= EV_TSTP;
+		}
+	}
+	return events;
+}
+
+// events_wait
+// Sleeps until a signal arrives, a descriptor registered with events_watch() becomes readable, or, if
+// asked for, the watched input becomes readable
+// Parameters: whether the watched input should wake the shell; while running a builtin such as
+//             parallel, the input may be readable without the shell wanting to read it
+// Returns: the EV_* bits of everything that happened
+int events_wait(bool want_input) {
+	while (true) {
+		int events = events_poll();
+		if (events != 0) return events;
+
+		if (want_input && watched_fd != -1) {
+			struct epoll_event ready[2 + EVENTS_MAX_EXTRA];
+			int n = epoll_wait(epoll_fd, ready, 2 + EVENTS_MAX_EXTRA, -1);
+			if (n == -1 && errno != EINTR) {
+				perror("epoll_wait");
+				return EV_INPUT;
+			}
+			for (int i = 0; i < n; i++) {
+				if (ready[i].data.fd == watched_fd) events |= EV_INPUT;
+				for (int j = 0; j < n_extra; j++) {
+					if (ready[i].data.fd == extra_fds[j].fd) events |= extra_events[j];
+				}
+			}
+		} else {
+			// Only the signalfd and the other watched descriptors can wake the shell; events_poll() sees which
+			struct pollfd pfds[1 + EVENTS_MAX_EXTRA];
+			pfds[0] = (struct pollfd) { signal_fd, POLLIN, 0 };
+			memcpy(pfds + 1, extra_fds, sizeof(struct pollfd) * n_extra);
+			poll(pfds, 1 + n_extra, -1);
+		}
+		events |= events_poll();
+		if (events != 0) return events;
+	}
+}
+
+// events_signal_fd
+// Gets the signalfd, for loops that watch it in their own epoll set (such as the server's)
+// Parameters: none
+// Returns: the signalfd; drain it with events_poll()
+int events_signal_fd(void) {
+	return signal_fd;
+}
@@ -0,0 +1,25 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <stdbool.h>
+
+// The shell's event loop: SIGCHLD, SIGINT, and SIGTSTP are blocked in the shell for its whole life
+// and read from a signalfd instead, and one epoll set watches that signalfd together with the
+// terminal and any other descriptors registered with events_watch() (such as the deadline timer).
+// Nothing runs asynchronously, so the job table and the foreground-only flag are only ever touched
+// by the main program.
+
+// The events events_wait() and events_poll() report, as bits
+#define EV_INPUT 1                  // The watched input is readable (or has hung up)
+#define EV_CHILD 2                  // A child has changed state (SIGCHLD)
+#define EV_INT 4                    // SIGINT arrived
+#define EV_TSTP 8                   // SIGTSTP arrived
+#define EV_TIMER 16                 // A deadline expired
+
+int events_init(int input_fd);
+int events_watch(int fd, int event);
+int events_wait(bool want_input);
+int events_poll(void);
+int events_signal_fd(void);
+
+#endif
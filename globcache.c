@@ -0,0 +1,364 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+
+#include "globcache.h"
+
+// The number of directory listings kept; the least recently used one is dropped to make room
+#define GLOBCACHE_MAX_DIRS 64
+
+// struct dir_listing
+// The sorted names in a directory, as of the directory's mtime when it was read
+struct dir_listing {
+	dev_t dev;                  // The directory's identity
+	ino_t ino;
+	struct timespec mtime;      // The directory's mtime before it was read
+	bool racy;                  // Whether the directory changed too recently for its mtime to be trusted
+	bool cached;                // Whether the listing is in the table (otherwise it's freed after use)
+	int pins;                   // The number of expansions iterating over the names
+	unsigned long last_use;     // The use clock when the listing was last used
+	unsigned long hits;         // The number of expansions served without reading the directory
+	char* path;                 // The directory's absolute path when it was first read
+	int n_names;
+	char** names;               // The names, excluding . and .., in strcmp() order
+	char* buf;                  // The storage for the names
+};
+
+// struct glob_state
+// The state of one pattern's expansion
+struct glob_state {
+	char* path;                 // The path matched so far
+	size_t path_cap;
+	glob_emit_fn emit;
+	void* ctx;
+	int n_matches;
+};
+
+static struct dir_listing* dirs[GLOBCACHE_MAX_DIRS];
+static int n_dirs = 0;
+static unsigned long use_clock = 0;
+
+// Counters for the hash builtin
+static unsigned long n_hits = 0, n_scans = 0;
+
+// free_listing
+// Frees a directory listing
+// Parameters: the listing
+// Returns: none
+static void free_listing(struct dir_listing* l) {
+	free(l->path);
+	free(l->names);
+	free(l->buf);
+	free(l);
+}
+
+// compare_names
+// Orders two names for qsort()
+// Parameters: pointers to the two name pointers
+// Returns: the strcmp() of the names
+static int compare_names(const void* a, const void* b) {
+	return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+// read_listing
+// Reads and sorts the names in a directory
+// Parameters: l, the listing to fill (its names must be empty); dir, the directory's path
+// Returns: 0 if successful, -1 on failure
+static int read_listing(struct dir_listing* l, const char* dir) {
+	DIR* d = opendir(dir);
+	if (d == NULL) return -1;
+
+	// Pack the names into one buffer, then point into it once it has stopped moving
+	size_t len = 0, cap = 4096;
+	int n = 0;
+	char* buf = (char*) malloc(cap);
+	struct dirent* ent;
+	while (buf != NULL && (ent = readdir(d)) != NULL) {
+		const char* name = ent->d_name;
+		if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+		size_t name_len = strlen(name) + 1;
+		if (len + name_len > cap) {
+			while (len + name_len > cap) cap *= 2;
+			char* grown = (char*) realloc(buf, cap);
+			if (grown == NULL) {
+				free(buf);
+				buf = NULL;
+				break;
+			}
+			buf = grown;
+		}
+		memcpy(buf + len, name, name_len);
+		len += name_len;
+		n++;
+	}
+	closedir(d);
+
+	char** names = (buf != NULL) ? (char**) malloc(sizeof(char*) * (n + 1)) : NULL;
+	if (names == NULL) {
+		free(buf);
+		return -1;
+	}
+	char* p = buf;
+	for (int i = 0; i < n; i++) {
+		names[i] = p;
+		p += strlen(p) + 1;
+	}
+	qsort(names, n, sizeof(char*), compare_names);
+
+	l->buf = buf;
+	l->names = names;
+	l->n_names = n;
+	n_scans++;
+	return 0;
+}
+
+// take_slot
+// Finds room in the table for a new listing, dropping the least recently used listing if it is full
+// Parameters: none
+// Returns: the index of a free slot, or -1 if every listing is in use by an expansion
+static int take_slot(void) {
+	if (n_dirs < GLOBCACHE_MAX_DIRS) return n_dirs++;
+
+	int victim = -1;
+	for (int i = 0; i < n_dirs; i++) {
+		if (dirs[i]->pins > 0) continue;
+		if (victim == -1 || dirs[i]->last_use < dirs[victim]->last_use) victim = i;
+	}
+	if (victim != -1) free_listing(dirs[victim]);
+	return victim;
+}
+
+// get_listing
+// Finds a directory's listing, reading the directory only if it isn't cached or has changed
+// Parameters: the directory's path
+// Returns: the listing (release it with put_listing()), or NULL if the path is not a readable directory
+static struct dir_listing* get_listing(const char* dir) {
+	struct stat st;
+	if (stat(dir, &st) == -1 || !S_ISDIR(st.st_mode)) return NULL;
+
+	int slot = -1;
+	for (int i = 0; i < n_dirs; i++) {
+		if (dirs[i]->dev == st.st_dev && dirs[i]->ino == st.st_ino) {
+			slot = i;
+			break;
+		}
+	}
+
+	struct dir_listing* l = (slot != -1) ? dirs[slot] : NULL;
+	bool fresh = l != NULL && !l->racy && l->mtime.tv_sec == st.st_mtim.tv_sec && l->mtime.tv_nsec == st.st_mtim.tv_nsec;
+	if (fresh || (l != NULL && l->pins > 0)) {
+		// A listing being iterated over stays as it is until the expansion is done with it
+		n_hits++;
+		l->hits++;
+		l->last_use = ++use_clock;
+		l->pins++;
+		return l;
+	}
+
+	if (l != NULL) {
+		// The directory has changed; read it again into the same slot
+		free(l->names);
+		free(l->buf);
+		l->names = NULL;
+		l->buf = NULL;
+		l->n_names = 0;
+	} else {
+		l = (struct dir_listing*) calloc(1, sizeof(struct dir_listing));
+		if (l == NULL) return NULL;
+		l->path = realpath(dir, NULL);
+		if (l->path == NULL) l->path = strdup(dir);
+		slot = take_slot();
+		l->cached = slot != -1;
+		if (l->cached) dirs[slot] = l;
+	}
+	l->dev = st.st_dev;
+	l->ino = st.st_ino;
+	l->mtime = st.st_mtim;
+
+	// A change within the same second as the mtime might not move it, so don't trust a listing of a
+	// directory that changed that recently
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	l->racy = st.st_mtim.tv_sec >= now.tv_sec - 1;
+
+	if (read_listing(l, dir) == -1) {
+		if (l->cached) {
+			dirs[slot] = dirs[--n_dirs];
+		}
+		free_listing(l);
+		return NULL;
+	}
+	l->last_use = ++use_clock;
+	l->pins++;
+	return l;
+}
+
+// put_listing
+// Releases a listing returned by get_listing()
+// Parameters: the listing
+// Returns: none
+static void put_listing(struct dir_listing* l) {
+	l->pins--;
+	if (!l->cached) free_listing(l);
+}
+
+// has_wildcard
+// Checks whether a pattern component contains an unescaped *, ?, or [
+// Parameters: the component
+// Returns: true if so
+static bool has_wildcard(const char* s) {
+	for (; *s != '\0'; s++) {
+		if (*s == '\\') {
+			if (*++s == '\0') break;
+		} else if (*s == '*' || *s == '?' || *s == '[') {
+			return true;
+		}
+	}
+	return false;
+}
+
+// path_put
+// Writes text into the matched path at an offset, growing the path as needed
+// Parameters: g, the expansion; off, the offset; s, the text; n, its length
+// Returns: 0 if successful, -1 on failure
+static int path_put(struct glob_state* g, size_t off, const char* s, size_t n) {
+	if (off + n + 1 > g->path_cap) {
+		size_t cap = g->path_cap * 2;
+		while (off + n + 1 > cap) cap *= 2;
+		char* path = (char*) realloc(g->path, cap);
+		if (path == NULL) return -1;
+		g->path = path;
+		g->path_cap = cap;
+	}
+	memcpy(g->path + off, s, n);
+	g->path[off + n] = '\0';
+	return 0;
+}
+
+// emit_path
+// Reports a matching path
+// Parameters: g, the expansion; len, the path's length
+// Returns: 0 if successful, -1 if the consumer failed
+static int emit_path(struct glob_state* g, size_t len) {
+	g->n_matches++;
+	return g->emit(g->path, len, g->ctx);
+}
+
+// expand_from
+// Matches the rest of a pattern against the file system below the path matched so far
+// Parameters: g, the expansion; len, the length of the path matched so far; rest, the rest of the pattern,
+//             which is modified and restored while it is matched
+// Returns: 0 if successful, -1 on failure
+static int expand_from(struct glob_state* g, size_t len, char* rest) {
+	// Copy the slashes before the next component
+	size_t n_slashes = strspn(rest, "/");
+	if (n_slashes > 0) {
+		if (path_put(g, len, rest, n_slashes) == -1) return -1;
+		len += n_slashes;
+		rest += n_slashes;
+	}
+
+	// A trailing slash only matches directories
+	if (*rest == '\0') {
+		struct stat st;
+		if (n_slashes > 0 && (stat(g->path, &st) == -1 || !S_ISDIR(st.st_mode))) return 0;
+		return emit_path(g, len);
+	}
+
+	char* slash = strchrnul(rest, '/');
+	char saved = *slash;
+	*slash = '\0';
+	int err = 0;
+
+	if (!has_wildcard(rest)) {
+		// Copy a literal component without its escapes; it has to exist if it ends the pattern
+		size_t n = 0;
+		for (const char* c = rest; *c != '\0'; c++) {
+			if (*c == '\\' && c[1] != '\0') c++;
+			if (path_put(g, len + n, c, 1) == -1) {
+				*slash = saved;
+				return -1;
+			}
+			n++;
+		}
+		*slash = saved;
+		struct stat st;
+		if (saved != '\0') return expand_from(g, len + n, slash);
+		if (lstat(g->path, &st) == 0) return emit_path(g, len + n);
+		return 0;
+	}
+
+	// Match the component against the directory's listing; a leading . has to be matched explicitly
+	g->path[len] = '\0';
+	struct dir_listing* l = get_listing((len == 0) ? "." : g->path);
+	if (l != NULL) {
+		for (int i = 0; i < l->n_names && err == 0; i++) {
+			if (fnmatch(rest, l->names[i], FNM_PERIOD) != 0) continue;
+			size_t n = strlen(l->names[i]);
+			err = path_put(g, len, l->names[i], n);
+			if (err == 0) {
+				*slash = saved;
+				err = (saved != '\0') ? expand_from(g, len + n, slash) : emit_path(g, len + n);
+				*slash = '\0';
+			}
+		}
+		put_listing(l);
+	}
+	*slash = saved;
+	return err;
+}
+
+// globcache_expand
+// Expands a pattern into the paths it matches. Characters quoted in the command line have to be escaped
+// with backslashes in the pattern.
+// Parameters: pattern, the pattern; emit, called with each matching path in sorted order; ctx, passed to emit
+// Returns: the number of matching paths, or -1 on failure
+int globcache_expand(const char* pattern, glob_emit_fn emit, void* ctx) {
+	struct glob_state g = { NULL, 256, emit, ctx, 0 };
+	g.path = (char*) malloc(g.path_cap);
+	char* pat = strdup(pattern);
+	int err = (g.path == NULL || pat == NULL) ? -1 : 0;
+	if (err == 0) {
+		g.path[0] = '\0';
+		err = expand_from(&g, 0, pat);
+	}
+	free(pat);
+	free(g.path);
+	return (err == -1) ? -1 : g.n_matches;
+}
+
+// globcache_clear
+// Forgets every cached directory listing (for "hash -r")
+// Parameters: none
+// Returns: none
+void globcache_clear(void) {
+	int kept = 0;
+	for (int i = 0; i < n_dirs; i++) {
+		if (dirs[i]->pins > 0) {
+			dirs[kept++] = dirs[i];
+		} else {
+			free_listing(dirs[i]);
+		}
+	}
+	n_dirs = kept;
+}
+
+// globcache_print
+// Lists the cached directories with their hit counts, followed by the cache's hit and scan counters
+// Parameters: none
+// Returns: none
+void globcache_print(void) {
+	if (n_dirs > 0) printf("hits\tnames\tdirectory\n");
+	for (int i = 0; i < n_dirs; i++) {
+		printf("%4lu\t%d\t%s\n", dirs[i]->hits, dirs[i]->n_names, dirs[i]->path);
+	}
+	printf("%d directories cached, %lu hits, %lu scans\n", n_dirs, n_hits, n_scans);
+	fflush(stdout);
+}
@@ -0,0 +1,18 @@
+#ifndef GLOBCACHE_H
+#define GLOBCACHE_H
+
+#include <stddef.h>
+
+// The glob cache expands *, ?, and [...] patterns against directory listings it keeps between
+// commands. A listing is keyed by the directory's device and inode and reused for as long as the
+// directory's mtime is unchanged, so a pattern expanded over and over against the same directory
+// costs a stat() instead of a rescan. Only the most recently used directories are kept.
+
+// Called for each path a pattern matches, in sorted order; returns 0 to go on, -1 to stop
+typedef int (*glob_emit_fn)(const char* path, size_t len, void* ctx);
+
+int globcache_expand(const char* pattern, glob_emit_fn emit, void* ctx);
+void globcache_clear(void);
+void globcache_print(void);
+
+#endif
@@ -0,0 +1,351 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "history.h"
+#include "vars.h"
+
+// The identification at the start of a history file
+#define HISTORY_MAGIC "smlhist1"
+// The header takes up the file's first page; the slots follow it
+#define HEADER_SIZE 4096
+#define SLOT_SIZE 128
+#define SLOT_TEXT (SLOT_SIZE - 16)
+// The position of a slot that is being written
+#define UNWRITTEN UINT64_MAX
+
+// struct history_header
+// The start of a history file
+struct history_header {
+	char magic[8];
+	uint64_t n_slots;           // The number of slots in the ring
+	uint64_t head;              // The absolute position of the next free slot; only ever grows
+};
+
+// struct history_slot
+// A slot of the ring; absolute position p lives in slot p % n_slots
+struct history_slot {
+	uint64_t pos;               // The absolute position the slot holds, stored last (UNWRITTEN while it is being written)
+	uint32_t len;               // The length of the line the slot is part of
+	uint32_t part;              // The slot's place in its line (0 for the line's first slot)
+	char text[SLOT_TEXT];       // Up to SLOT_TEXT bytes of the line, not null-terminated
+};
+
+static struct history_header* header = NULL;
+static struct history_slot* slots = NULL;
+static uint64_t n_slots = 0;
+static bool open_failed = false;
+
+// The index, oldest line first: the absolute position of each line and its first 8 bytes (zero padded),
+// which a prefix search compares before it reads the line itself; the live entries are [index_start, index_end)
+static uint64_t* index_pos = NULL;
+static uint64_t* index_key = NULL;
+static size_t index_start = 0, index_end = 0, index_cap = 0;
+static unsigned long n_dropped = 0;     // The number of lines dropped from the front, which keeps the line numbers stable
+static uint64_t scanned = 0;            // The absolute position up to which the ring has been indexed
+static bool indexed = false;
+
+// The buffers for a line read from the ring and for an expanded command line
+static char* line_buf = NULL;
+static size_t line_cap = 0;
+static char* expand_buf = NULL;
+static size_t expand_cap = 0;
+
+// slots_for
+// Gets the number of slots a line takes up
+// Parameters: the line's length
+// Returns: the number of slots
+static uint64_t slots_for(uint64_t len) {
+	return (len + SLOT_TEXT - 1) / SLOT_TEXT;
+}
+
+// reserve
+// Makes sure a buffer can hold a number of bytes
+// Parameters: buf and cap, the buffer and its capacity; size, the bytes needed
+// Returns: 0 if successful, -1 on failure
+static int reserve(char** buf, size_t* cap, size_t size) {
+	if (size <= *cap) return 0;
+	size_t new_cap = (*cap == 0) ? 256 : *cap;
+	while (new_cap < size) new_cap *= 2;
+	char* grown = (char*) realloc(*buf, new_cap);
+	if (grown == NULL) return -1;
+	*buf = grown;
+	*cap = new_cap;
+	return 0;
+}
+
+// open_history
+// Maps the history file, laying it out first if it is new; only tried once
+// Parameters: none
+// Returns: 0 if the history is usable, -1 otherwise
+static int open_history(void) {
+	if (header != NULL) return 0;
+	if (open_failed) return -1;
+	open_failed = true;
+
+	char* path = NULL;
+	const char* env = vars_get("SMALLSH_HISTFILE");
+	const char* home = vars_get("HOME");
+	if (env != NULL && env[0] != '\0') {
+		path = strdup(env);
+	} else if (home != NULL) {
+		asprintf(&path, "%s/.smallsh_history", home);
+	}
+	if (path == NULL) return -1;
+	int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd == -1) {
+		perror(path);
+		free(path);
+		return -1;
+	}
+
+	// Sessions starting at the same time take turns, so only one of them lays out a new file
+	flock(fd, LOCK_EX);
+	struct stat st;
+	void* map = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size == 0) {
+		long n = HISTORY_DEFAULT_SLOTS;
+		const char* size = vars_get("SMALLSH_HISTSIZE");
+		if (size != NULL && strtol(size, NULL, 10) >= 64) n = strtol(size, NULL, 10);
+		struct history_header h = { HISTORY_MAGIC, (uint64_t) n, 0 };
+		if (ftruncate(fd, HEADER_SIZE + (off_t) n * SLOT_SIZE) == 0 && pwrite(fd, &h, sizeof(h), 0) == sizeof(h)) {
+			st.st_size = HEADER_SIZE + (off_t) n * SLOT_SIZE;
+		}
+	}
+	if (st.st_size > HEADER_SIZE) map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	flock(fd, LOCK_UN);
+	close(fd);
+
+	// Make sure the file is a history file whose slots all fit in it
+	struct history_header* h = (struct history_header*) map;
+	if (map == MAP_FAILED || memcmp(h->magic, HISTORY_MAGIC, sizeof(h->magic)) != 0 || h->n_slots == 0 ||
+	    h->n_slots > (uint64_t) (st.st_size - HEADER_SIZE) / SLOT_SIZE) {
+		fprintf(stderr, "smallsh: %s: not a history file\n", path);
+		if (map != MAP_FAILED) munmap(map, st.st_size);
+		free(path);
+		return -1;
+	}
+	free(path);
+	header = h;
+	slots = (struct history_slot*) ((char*) map + HEADER_SIZE);
+	n_slots = h->n_slots;
+	open_failed = false;
+	return 0;
+}
+
+// history_add
+// Records a line at the head of the ring, which other sessions see at once; a line that would take up more
+// than an eighth of the ring is not recorded
+// Parameters: the line
+// Returns: none
+void history_add(const char* line) {
+	size_t len = strlen(line);
+	if (len == 0 || open_history() == -1) return;
+	uint64_t n = slots_for(len);
+	if (n > n_slots / 8) return;
+
+	// Claim the slots; concurrent sessions each get their own
+	uint64_t start = __atomic_fetch_add(&header->head, n, __ATOMIC_RELAXED);
+	for (uint64_t i = 0; i < n; i++) {
+		struct history_slot* slot = &slots[(start + i) % n_slots];
+		// Mark the slot as being written before changing it, and stamp it with its position once it is complete
+		__atomic_store_n(&slot->pos, UNWRITTEN, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		size_t chunk = (len - i * SLOT_TEXT < SLOT_TEXT) ? len - i * SLOT_TEXT : SLOT_TEXT;
+		slot->len = (uint32_t) len;
+		slot->part = (uint32_t) i;
+		memcpy(slot->text, line + i * SLOT_TEXT, chunk);
+		__atomic_store_n(&slot->pos, start + i, __ATOMIC_RELEASE);
+	}
+}
+
+// read_line
+// Copies a line out of the ring, checking that none of its slots is rewritten meanwhile
+// Parameters: the absolute position of the line's first slot
+// Returns: the null-terminated line (valid until the next call), or NULL if it has been overwritten
+static const char* read_line(uint64_t pos) {
+	struct history_slot* first = &slots[pos % n_slots];
+	if (__atomic_load_n(&first->pos, __ATOMIC_ACQUIRE) != pos) return NULL;
+	uint64_t len = first->len;
+	if (len == 0 || first->part != 0 || slots_for(len) > n_slots / 8) return NULL;
+	if (reserve(&line_buf, &line_cap, len + 1) == -1) return NULL;
+
+	for (uint64_t i = 0; i < slots_for(len); i++) {
+		struct history_slot* slot = &slots[(pos + i) % n_slots];
+		if (__atomic_load_n(&slot->pos, __ATOMIC_ACQUIRE) != pos + i) return NULL;
+		size_t chunk = (len - i * SLOT_TEXT < SLOT_TEXT) ? len - i * SLOT_TEXT : SLOT_TEXT;
+		memcpy(line_buf + i * SLOT_TEXT, slot->text, chunk);
+		// A writer that started meanwhile has changed the position first
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&slot->pos, __ATOMIC_RELAXED) != pos + i) return NULL;
+	}
+	line_buf[len] = '\0';
+	return line_buf;
+}
+
+// index_append
+// Adds a line to the end of the index
+// Parameters: pos, the absolute position of the line; key, its first 8 bytes
+// Returns: 0 if successful, -1 on failure
+static int index_append(uint64_t pos, uint64_t key) {
+	if (index_end == index_cap) {
+		if (index_start > 0) {
+			// Reuse the room of the lines dropped from the front
+			memmove(index_pos, index_pos + index_start, sizeof(uint64_t) * (index_end - index_start));
+			memmove(index_key, index_key + index_start, sizeof(uint64_t) * (index_end - index_start));
+			index_end -= index_start;
+			index_start = 0;
+		}
+		if (index_end == index_cap) {
+			size_t cap = (index_cap == 0) ? 1024 : index_cap * 2;
+			uint64_t* new_pos = (uint64_t*) realloc(index_pos, sizeof(uint64_t) * cap);
+			if (new_pos == NULL) return -1;
+			index_pos = new_pos;
+			uint64_t* new_key = (uint64_t*) realloc(index_key, sizeof(uint64_t) * cap);
+			if (new_key == NULL) return -1;
+			index_key = new_key;
+			index_cap = cap;
+		}
+	}
+	index_pos[index_end] = pos;
+	index_key[index_end] = key;
+	index_end++;
+	return 0;
+}
+
+// index_sync
+// Brings the index up to date with the ring: lines that have been overwritten are dropped from the front,
+// and the lines recorded since the last sync (by any session) are added; a slot still being written is skipped
+// Parameters: none
+// Returns: none
+static void index_sync(void) {
+	uint64_t head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+	uint64_t oldest = (head > n_slots) ? head - n_slots : 0;
+	if (!indexed || scanned < oldest) scanned = oldest;
+	indexed = true;
+	while (index_start < index_end && index_pos[index_start] < oldest) {
+		index_start++;
+		n_dropped++;
+	}
+
+	while (scanned < head) {
+		struct history_slot* slot = &slots[scanned % n_slots];
+		uint64_t pos = __atomic_load_n(&slot->pos, __ATOMIC_ACQUIRE);
+		uint64_t len = slot->len, part = slot->part;
+		uint64_t key = 0;
+		memcpy(&key, slot->text, (len < sizeof(key)) ? len : sizeof(key));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		bool valid = (pos == scanned && __atomic_load_n(&slot->pos, __ATOMIC_RELAXED) == pos && len > 0);
+
+		// Skip slots that aren't the start of a complete line, such as the rest of a line whose start was overwritten
+		if (!valid || part != 0) {
+			scanned++;
+			continue;
+		}
+		if (index_append(pos, key) == -1) return;
+		scanned += slots_for(len);
+	}
+}
+
+// find_prefix
+// Finds the newest line that starts with a prefix; the first 8 bytes are compared in the index, so only
+// candidates are read from the ring
+// Parameters: prefix, the prefix; len, its length
+// Returns: the line, or NULL if there is none
+static const char* find_prefix(const char* prefix, size_t len) {
+	uint64_t key = 0, mask = 0;
+	size_t n = (len < sizeof(key)) ? len : sizeof(key);
+	memcpy(&key, prefix, n);
+	memset(&mask, 0xff, n);
+	for (size_t i = index_end; i-- > index_start; ) {
+		if ((index_key[i] & mask) != key) continue;
+		const char* line = read_line(index_pos[i]);
+		if (line != NULL && strncmp(line, prefix, len) == 0) return line;
+	}
+	return NULL;
+}
+
+// find_event
+// Finds the line a history reference refers to: ! for the last line, n for line n, -n for the nth last line,
+// or a prefix for the newest line starting with it
+// Parameters: event, the reference without its leading !; len, its length
+// Returns: the line, or NULL if there is none
+static const char* find_event(const char* event, size_t len) {
+	index_sync();
+	size_t n_lines = index_end - index_start;
+	if (len == 1 && event[0] == '!') {
+		return (n_lines > 0) ? read_line(index_pos[index_end - 1]) : NULL;
+	}
+
+	bool back = (event[0] == '-');
+	size_t digits = strspn(event + back, "0123456789");
+	if (digits > 0 && back + digits == len) {
+		unsigned long n = strtoul(event + back, NULL, 10);
+		if (back) {
+			return (n >= 1 && n <= n_lines) ? read_line(index_pos[index_end - n]) : NULL;
+		}
+		return (n > n_dropped && n - n_dropped <= n_lines) ? read_line(index_pos[index_start + (n - n_dropped - 1)]) : NULL;
+	}
+	return find_prefix(event, len);
+}
+
+// history_expand
+// Replaces a history reference that starts a command line (!!, !n, !-n, or !prefix) with the line it refers to
+// Parameters: the command line
+// Returns: the line itself if it doesn't start with a reference, the expanded line (valid until the next call),
+//          or NULL if the reference doesn't match any line (an error is printed)
+const char* history_expand(const char* line) {
+	// "!" alone, or followed by a blank or "=", is not a reference
+	if (line[0] != '!' || line[1] == '\0' || line[1] == ' ' || line[1] == '\t' || line[1] == '=') return line;
+
+	size_t word = strcspn(line, " \t");
+	const char* found = (open_history() == 0) ? find_event(line + 1, word - 1) : NULL;
+	if (found == NULL) {
+		fprintf(stderr, "smallsh: %.*s: event not found\n", (int) word, line);
+		return NULL;
+	}
+
+	// The rest of the command line follows the line that was found
+	size_t found_len = strlen(found), rest_len = strlen(line + word);
+	if (reserve(&expand_buf, &expand_cap, found_len + rest_len + 1) == -1) return NULL;
+	memcpy(expand_buf, found, found_len);
+	memcpy(expand_buf + found_len, line + word, rest_len + 1);
+	return expand_buf;
+}
+
+// history_recall
+// Gets a recorded line by how far back it is, for browsing the history while editing a line
+// Parameters: the line's distance from the end (1 for the newest line)
+// Returns: the line (valid until the next call into the history), or NULL if there is none that far back
+const char* history_recall(unsigned long back) {
+	if (back == 0 || open_history() == -1) return NULL;
+	index_sync();
+	return (back <= index_end - index_start) ? read_line(index_pos[index_end - back]) : NULL;
+}
+
+// history_print
+// Lists the recorded lines with their numbers, oldest first
+// Parameters: the number of lines to list, counting back from the newest, or 0 for all of them
+// Returns: 0 if successful, -1 if the history is not available
+int history_print(long n) {
+	if (open_history() == -1) return -1;
+	index_sync();
+	size_t from = index_start;
+	if (n > 0 && (size_t) n < index_end - index_start) from = index_end - n;
+	for (size_t i = from; i < index_end; i++) {
+		const char* line = read_line(index_pos[i]);
+		if (line != NULL) printf("%5lu  %s\n", n_dropped + (i - index_start) + 1, line);
+	}
+	fflush(stdout);
+	return 0;
+}
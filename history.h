@@ -0,0 +1,21 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+// The history is a ring of fixed-size slots in a memory-mapped file ($SMALLSH_HISTFILE, default
+// ~/.smallsh_history) shared by every session. A line takes one slot, or several consecutive ones
+// if it is long; a session reserves its slots with an atomic add on the file's head counter and
+// writes the line straight into the mapping, so recording a line makes no system calls. Each slot
+// is stamped with its absolute position, written last, so a reader can tell when a slot is still
+// being written or has since been reused by a newer line. Nothing is read at startup: the index
+// of line starts and first bytes that searches scan is built the first time it is needed, and only
+// the lines recorded since (by any session) are added to it afterwards.
+
+// The number of slots in a new history file when $SMALLSH_HISTSIZE doesn't say
+#define HISTORY_DEFAULT_SLOTS 65536
+
+void history_add(const char* line);
+const char* history_expand(const char* line);
+const char* history_recall(unsigned long back);
+int history_print(long n);
+
+#endif
@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "input.h"
+
+// The stdio buffer size for script files; large enough that long scripts are read in few syscalls
+#define SCRIPT_BUF_SIZE 65536
+
+// input_init
+// Sets up an input struct around an open stream
+// Parameters: in, the input struct to set up; stream, the stream to read from;
+//             interactive, whether the stream is a terminal the user types into
+// Returns: none
+static void input_init(struct input* in, FILE* stream, bool interactive) {
+	in->stream = stream;
+	in->interactive = interactive;
+	in->line = NULL;
+	in->line_cap = 0;
+	in->n_lines = 0;
+	in->eof = false;
+	in->editor = NULL;
+}
+
+// input_open_stdin
+// Reads commands from stdin; prompts are only shown if stdin is a terminal
+// Parameters: the input struct to set up
+// Returns: 0
+int input_open_stdin(struct input* in) {
+	input_init(in, stdin, isatty(STDIN_FILENO));
+	// The event loop decides when a terminal has a line to read, so stdio must not hold typed-ahead
+	// lines back in its buffer; a terminal delivers one line per read() anyway
+	if (in->interactive) setvbuf(stdin, NULL, _IONBF, 0);
+	return 0;
+}
+
+// input_open_file
+// Reads commands from a script file
+// Parameters: in, the input struct to set up; path, the path of the script
+// Returns: 0 if successful, -1 on failure
+int input_open_file(struct input* in, const char* path) {
+	FILE* stream = fopen(path, "r");
+	if (stream == NULL) {
+		perror(path);
+		return -1;
+	}
+	// Read the script in large blocks; a failure here only costs speed
+	setvbuf(stream, NULL, _IOFBF, SCRIPT_BUF_SIZE);
+	input_init(in, stream, false);
+	return 0;
+}
+
+// input_open_string
+// Reads commands from a string, one per line (for -c)
+// Parameters: in, the input struct to set up; str, the commands
+// Returns: 0 if successful, -1 on failure
+int input_open_string(struct input* in, const char* str) {
+	// An empty string has nothing to read; fmemopen() rejects a zero size
+	FILE* stream = (str[0] == '\0') ? fopen("/dev/null", "r") : fmemopen((void*) str, strlen(str), "r");
+	if (stream == NULL) {
+		perror("-c");
+		return -1;
+	}
+	input_init(in, stream, false);
+	return 0;
+}
+
+// input_use_editor
+// Reads the lines of a terminal with the line editor, if stdout is the terminal too
+// Parameters: the input struct, opened on stdin
+// Returns: 0 if the editor is used, -1 if the lines are read as the terminal delivers them
+int input_use_editor(struct input* in) {
+	if (!in->interactive || !isatty(STDOUT_FILENO)) return -1;
+	in->editor = (struct editor*) malloc(sizeof(struct editor));
+	if (in->editor == NULL || editor_init(in->editor, fileno(in->stream)) == -1) {
+		free(in->editor);
+		in->editor = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+// show_prompt
+// Prints a prompt for interactive input; with the editor, the line being typed is drawn after it
+// Parameters: in, the input struct the next line will be read from; prompt, the prompt
+// Returns: none
+static void show_prompt(struct input* in, const char* prompt) {
+	if (in->editor != NULL) {
+		fflush(stdout);
+		editor_prompt(in->editor, prompt);
+	} else if (in->interactive) {
+		fputs(prompt, stdout);
+		fflush(stdout);
+	}
+}
+
+// input_prompt
+// Prints the shell prompt for interactive input
+// Parameters: the input struct the next line will be read from
+// Returns: none
+void input_prompt(struct input* in) {
+	show_prompt(in, ": ");
+}
+
+// input_prompt_more
+// Prints the prompt for a line that continues the command line (such as a here-document's body)
+// Parameters: the input struct the next line will be read from
+// Returns: none
+void input_prompt_more(struct input* in) {
+	show_prompt(in, "> ");
+}
+
+// input_hide
+// Takes the line being typed off the screen before the shell prints something; only the editor can
+// Parameters: the input struct
+// Returns: none
+void input_hide(struct input* in) {
+	if (in->editor != NULL) editor_hide(in->editor);
+}
+
+// input_show
+// Draws the line being typed again after input_hide()
+// Parameters: the input struct
+// Returns: none
+void input_show(struct input* in) {
+	if (in->editor != NULL) {
+		fflush(stdout);
+		editor_show(in->editor);
+	}
+}
+
+// input_cancel
+// Abandons the line being typed (on SIGINT); without the editor, the terminal has already discarded it,
+// so only the cursor is moved to a new line for the next prompt
+// Parameters: the input struct
+// Returns: none
+void input_cancel(struct input* in) {
+	if (in->editor != NULL) {
+		editor_cancel(in->editor);
+	} else if (in->interactive) {
+		printf("\n");
+		fflush(stdout);
+	}
+}
+
+// input_ready
+// Checks whether a whole line has been typed; the editor handles the keys typed so far first
+// Parameters: in, the input struct; readable, whether the terminal has input waiting
+// Returns: true if input_read_line() has a line (or the end of the input) to return
+bool input_ready(struct input* in, bool readable) {
+	if (in->editor == NULL) return readable;
+	return editor_feed(in->editor, readable) != EDITOR_EDITING;
+}
+
+// input_read_line
+// Reads the next line into the input's line buffer, without its newline
+// Parameters: the input struct to read from
+// Returns: the line buffer, or NULL at the end of the input or on an error (in->eof is set)
+char* input_read_line(struct input* in) {
+	// Take the line the editor finished
+	if (in->editor != NULL) {
+		struct editor* ed = in->editor;
+		if (ed->state != EDITOR_LINE || ed->active) {
+			in->eof = (ed->state == EDITOR_EOF);
+			return NULL;
+		}
+		if (in->line_cap < ed->len + 1) {
+			char* grown = (char*) realloc(in->line, ed->len + 1);
+			if (grown == NULL) return NULL;
+			in->line = grown;
+			in->line_cap = ed->len + 1;
+		}
+		memcpy(in->line, ed->buf, ed->len + 1);
+		// The line is only taken once
+		ed->state = EDITOR_EDITING;
+		in->n_lines++;
+		return in->line;
+	}
+
+	// Read a line into the reusable getline() buffer
+	ssize_t len = getline(&in->line, &in->line_cap, in->stream);
+	if (len == -1) {
+		in->eof = true;
+		return NULL;
+	}
+	in->n_lines++;
+
+	// Remove the newline character, if the line has one
+	if (len > 0 && in->line[len - 1] == '\n') in->line[len - 1] = '\0';
+	return in->line;
+}
+
+// input_resume
+// Reads a terminal again after Ctrl + D ended a here-document rather than the shell's input
+// Parameters: the input struct
+// Returns: none
+void input_resume(struct input* in) {
+	if (!in->interactive) return;
+	in->eof = false;
+	clearerr(in->stream);
+}
+
+// input_close
+// Frees the input's buffers and closes its stream (except stdin)
+// Parameters: the input struct to close
+// Returns: none
+void input_close(struct input* in) {
+	if (in->editor != NULL) {
+		editor_close(in->editor);
+		free(in->editor);
+		in->editor = NULL;
+	}
+	free(in->line);
+	in->line = NULL;
+	in->line_cap = 0;
+	if (in->stream != NULL && in->stream != stdin) fclose(in->stream);
+	in->stream = NULL;
+}
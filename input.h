@@ -0,0 +1,35 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "editor.h"
+
+// struct input
+// A source of command lines: the terminal, a script file, or a -c string
+struct input {
+	FILE* stream;                   // The stream lines are read from
+	bool interactive;               // Whether to print prompts and manage the terminal
+	char* line;                     // The getline() buffer, reused for every line of any length
+	size_t line_cap;                // The capacity of the getline() buffer
+	unsigned long n_lines;          // The number of lines read so far
+	bool eof;                       // Whether the end of the input has been reached
+	struct editor* editor;          // The line editor for a terminal, or NULL to read lines as the terminal delivers them
+};
+
+int input_open_stdin(struct input* in);
+int input_open_file(struct input* in, const char* path);
+int input_open_string(struct input* in, const char* str);
+int input_use_editor(struct input* in);
+void input_prompt(struct input* in);
+void input_prompt_more(struct input* in);
+void input_hide(struct input* in);
+void input_show(struct input* in);
+void input_cancel(struct input* in);
+bool input_ready(struct input* in, bool readable);
+char* input_read_line(struct input* in);
+void input_resume(struct input* in);
+void input_close(struct input* in);
+
+#endif
@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "deadline.h"
+#include "jobs.h"
+
+// The starting number of slots in the job table (always a power of two)
+#define JOBS_MIN_CAP 16
+
+// struct job
+// A slot in the job table
+struct job {
+	pid_t pid;                  // The child's pid, or 0 if the slot is empty
+	int tag;                    // The owner's tag (JOB_BACKGROUND, JOB_BACKGROUND_TIMED, or a builtin's own value)
+	struct timespec start;      // When the child was launched
+	bool done;                  // Whether the child has ended and been queued for reporting
+};
+
+// The job table: an open-addressing hash table keyed by pid, with linear probing
+static struct job* table = NULL;
+static int table_cap = 0;       // The number of slots
+static int n_jobs = 0;          // The number of occupied slots
+
+// The queue of finished jobs: a ring with as many slots as the table, so it can never overflow
+static struct job_result* done_queue = NULL;
+static int done_head = 0;       // The index of the oldest entry
+static int done_count = 0;      // The number of entries
+
+// slot_of
+// Hashes a pid to its home slot (Fibonacci hashing spreads sequential pids across the table)
+// Parameters: the pid
+// Returns: the index of the pid's home slot
+static int slot_of(pid_t pid) {
+	return (int) (((unsigned int) pid * 2654435769u) & (unsigned int) (table_cap - 1));
+}
+
+// find_job
+// Looks up a job by pid
+// Parameters: the pid
+// Returns: a pointer to the job's slot, or NULL if the pid is not in the table
+static struct job* find_job(pid_t pid) {
+	if (table_cap == 0) return NULL;
+	for (int i = slot_of(pid); table[i].pid != 0; i = (i + 1) & (table_cap - 1)) {
+		if (table[i].pid == pid) return &table[i];
+	}
+	return NULL;
+}
+
+// remove_job
+// Deletes a job by shifting later entries of its probe run back, so no tombstones are needed
+// Parameters: the slot index of the job to delete
+// Returns: none
+static void remove_job(int i) {
+	int mask = table_cap - 1;
+	int j = i;
+	while (true) {
+		table[i].pid = 0;
+		// Find the next entry that may move into the gap: one whose home slot is not between the gap and itself
+		int home;
+		do {
+			j = (j + 1) & mask;
+			if (table[j].pid == 0) {
+				n_jobs--;
+				return;
+			}
+			home = slot_of(table[j].pid);
+		} while ((i <= j) ? (i < home && home <= j) : (i < home || home <= j));
+		table[i] = table[j];
+		i = j;
+	}
+}
+
+// grow_table
+// Doubles the capacity of the job table and the done queue
+// Parameters: none
+// Returns: 0 if successful, -1 on failure
+static int grow_table(void) {
+	int new_cap = (table_cap == 0) ? JOBS_MIN_CAP : table_cap * 2;
+	struct job* new_table = (struct job*) calloc(new_cap, sizeof(struct job));
+	struct job_result* new_queue = (struct job_result*) malloc(sizeof(struct job_result) * new_cap);
+	if (new_table == NULL || new_queue == NULL) {
+		free(new_table);
+		free(new_queue);
+		return -1;
+	}
+
+	// Move the queued entries to the front of the new queue
+	for (int k = 0; k < done_count; k++) {
+		new_queue[k] = done_queue[(done_head + k) % table_cap];
+	}
+
+	// Rehash every job into the new table
+	struct job* old_table = table;
+	int old_cap = table_cap;
+	table = new_table;
+	table_cap = new_cap;
+	for (int k = 0; k < old_cap; k++) {
+		if (old_table[k].pid == 0) continue;
+		int i = slot_of(old_table[k].pid);
+		while (table[i].pid != 0) i = (i + 1) & (table_cap - 1);
+		table[i] = old_table[k];
+	}
+	free(old_table);
+
+	free(done_queue);
+	done_queue = new_queue;
+	done_head = 0;
+	return 0;
+}
+
+// jobs_reap
+// Reaps every child in the job table that has ended and queues it for reporting, along with its
+// resource usage, wall time, and whether its deadline expired; called when the event loop reports SIGCHLD
+// Parameters: none
+// Returns: none
+void jobs_reap(void) {
+	pid_t pid;
+	int status;
+	struct rusage ru;
+	while ((pid = wait4(-1, &status, WNOHANG, &ru)) > 0) {
+		struct job* job = find_job(pid);
+		if (job == NULL || job->done) continue;
+		job->done = true;
+
+		// Record the job's result
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		struct job_result* res = &done_queue[(done_head + done_count) % table_cap];
+		res->pid = pid;
+		res->tag = job->tag;
+		res->status = status;
+		res->start = job->start;
+		usage_init(&res->usage);
+		usage_add(&res->usage, &ru);
+		res->usage.wall = usage_elapsed(&job->start, &now);
+		res->timed_out = deadline_remove(pid);
+		done_count++;
+	}
+}
+
+// jobs_add
+// Adds a child to the job table
+// Parameters: pid, the child's pid; tag, JOB_BACKGROUND or JOB_BACKGROUND_TIMED for background commands, or a
+//             positive value of the caller's choosing that is handed back by jobs_next_done() (such as a parallel slot);
+//             start, when the child was launched
+// Returns: 0 if successful, -1 on failure
+int jobs_add(pid_t pid, int tag, const struct timespec* start) {
+	// Keep the table at most half full so probe runs stay short
+	if (2 * (n_jobs + 1) > table_cap && grow_table() == -1) return -1;
+
+	int i = slot_of(pid);
+	while (table[i].pid != 0) i = (i + 1) & (table_cap - 1);
+	table[i] = (struct job) { pid, tag, *start, false };
+	n_jobs++;
+	return 0;
+}
+
+// jobs_next_done
+// Takes the oldest finished job off the done queue and deletes it from the table
+// Parameters: a pointer to a job_result struct to receive the job
+// Returns: true if a job was returned, false if none have finished
+bool jobs_next_done(struct job_result* res) {
+	if (done_count == 0) return false;
+
+	*res = done_queue[done_head];
+	done_head = (done_head + 1) % table_cap;
+	done_count--;
+
+	struct job* job = find_job(res->pid);
+	if (job != NULL) remove_job(job - table);
+	return true;
+}
+
+// jobs_count
+// Gets the number of jobs that have not been reported as finished
+// Parameters: none
+// Returns: the number of jobs
+int jobs_count(void) {
+	return n_jobs;
+}
+
+// jobs_kill_all
+// Sends a signal to every job that is still running
+// Parameters: the signal number
+// Returns: none
+void jobs_kill_all(int sig) {
+	for (int i = 0; i < table_cap; i++) {
+		if (table[i].pid != 0 && table[i].done == false) kill(table[i].pid, sig);
+	}
+}
@@ -0,0 +1,34 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stdbool.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "usage.h"
+
+// The tags of jobs started by commands ending in &, without and with a time prefix
+#define JOB_BACKGROUND 0
+#define JOB_BACKGROUND_TIMED -1
+
+// The job table tracks child processes the shell does not wait for directly. When the event
+// loop reports SIGCHLD, jobs_reap() reaps every finished child and queues it for reporting.
+
+// struct job_result
+// A finished job, as handed back by jobs_next_done()
+struct job_result {
+	pid_t pid;                  // The child's pid
+	int tag;                    // The tag it was added with
+	int status;                 // Its status set by wait4()
+	struct timespec start;      // When it was launched
+	struct job_usage usage;     // Its resource usage and wall time
+	bool timed_out;             // Whether it was signalled because its deadline expired
+};
+
+void jobs_reap(void);
+int jobs_add(pid_t pid, int tag, const struct timespec* start);
+bool jobs_next_done(struct job_result* res);
+int jobs_count(void);
+void jobs_kill_all(int sig);
+
+#endif
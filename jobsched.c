@@ -0,0 +1,199 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "jobsched.h"
+#include "vars.h"
+
+// The ioprio_set() arguments glibc has no names for
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_LEVELS 8
+
+// The I/O scheduling classes, by the names ionice(1) uses, indexed by class number
+static const char* ioprio_classes[] = { "none", "realtime", "best-effort", "idle" };
+static const char* ioprio_short[] = { "none", "rt", "be", "idle" };
+
+// The shell-wide settings, parsed from their variables again whenever a variable changes
+static struct job_sched defaults;
+static bool spread_set = false;
+static cpu_set_t spread_cpus;
+static int spread_last = -1;        // The CPU the last background job was pinned to
+static bool loaded = false;
+static unsigned long loaded_generation = 0;
+
+// jobsched_init
+// Clears a job's scheduling settings, so the job inherits the shell's
+// Parameters: the settings
+// Returns: none
+void jobsched_init(struct job_sched* js) {
+	js->set_cpus = false;
+	CPU_ZERO(&js->cpus);
+	js->set_nice = false;
+	js->nice = 0;
+	js->set_ioprio = false;
+	js->ioprio = 0;
+}
+
+// jobsched_active
+// Checks whether a job has any scheduling settings to apply
+// Parameters: the settings, or NULL
+// Returns: true if at least one setting is set
+bool jobsched_active(const struct job_sched* js) {
+	return js != NULL && (js->set_cpus || js->set_nice || js->set_ioprio);
+}
+
+// parse_cpu
+// Reads a CPU number at the start of a string
+// Parameters: s, the string; end, a pointer to receive the first character after the number
+// Returns: the CPU number, or -1 if there is none or it is out of range
+static int parse_cpu(const char* s, char** end) {
+	if (*s < '0' || *s > '9') return -1;
+	errno = 0;
+	long cpu = strtol(s, end, 10);
+	if (errno != 0 || cpu >= CPU_SETSIZE) return -1;
+	return (int) cpu;
+}
+
+// jobsched_parse_cpus
+// Reads a CPU list such as "0-3,8,10-11", as taskset -c takes
+// Parameters: s, the list; cpus, a pointer to receive the set
+// Returns: 0 if successful, -1 if it is not a valid, non-empty list
+int jobsched_parse_cpus(const char* s, cpu_set_t* cpus) {
+	CPU_ZERO(cpus);
+	while (true) {
+		char* end;
+		int first = parse_cpu(s, &end);
+		int last = first;
+		if (first != -1 && *end == '-') last = parse_cpu(end + 1, &end);
+		if (first == -1 || last < first) return -1;
+		for (int cpu = first; cpu <= last; cpu++) CPU_SET(cpu, cpus);
+		if (*end == '\0') return 0;
+		if (*end != ',') return -1;
+		s = end + 1;
+	}
+}
+
+// jobsched_parse_nice
+// Reads a nice level
+// Parameters: s, the level, from -20 (highest priority) to 19 (lowest); nice, a pointer to receive it
+// Returns: 0 if successful, -1 if it is not a valid level
+int jobsched_parse_nice(const char* s, int* nice) {
+	char* end;
+	errno = 0;
+	long value = strtol(s, &end, 10);
+	if (*s == '\0' || *end != '\0' || errno != 0 || value < -20 || value > 19) return -1;
+	*nice = (int) value;
+	return 0;
+}
+
+// jobsched_parse_ioprio
+// Reads an I/O priority: a class (realtime or rt, best-effort or be, idle, or its number 1-3), optionally
+// followed by a colon and a level from 0 (highest) to 7; the level defaults to 4, and idle takes none
+// Parameters: s, the priority; ioprio, a pointer to receive it, packed for ioprio_set()
+// Returns: 0 if successful, -1 if it is not a valid priority
+int jobsched_parse_ioprio(const char* s, int* ioprio) {
+	size_t len = strcspn(s, ":");
+	int class = -1;
+	for (int i = 1; i < (int) (sizeof(ioprio_classes) / sizeof(ioprio_classes[0])); i++) {
+		if ((strlen(ioprio_classes[i]) == len && strncmp(s, ioprio_classes[i], len) == 0) ||
+		    (strlen(ioprio_short[i]) == len && strncmp(s, ioprio_short[i], len) == 0) ||
+		    (len == 1 && s[0] == '0' + i)) {
+			class = i;
+		}
+	}
+	if (class == -1) return -1;
+
+	int level = IOPRIO_LEVELS / 2;
+	if (s[len] == ':') {
+		const char* l = s + len + 1;
+		if (class == 3 || l[0] < '0' || l[0] >= '0' + IOPRIO_LEVELS || l[1] != '\0') return -1;
+		level = l[0] - '0';
+	}
+	if (class == 3) level = 0;
+	*ioprio = (class << IOPRIO_CLASS_SHIFT) | level;
+	return 0;
+}
+
+// load_defaults
+// Parses the shell-wide settings from their variables; a variable that is not valid is reported and ignored
+// Parameters: none
+// Returns: none
+static void load_defaults(void) {
+	loaded = true;
+	loaded_generation = vars_generation();
+	jobsched_init(&defaults);
+
+	const char* value = vars_get("SMALLSH_CPUS");
+	if (value != NULL && value[0] != '\0') {
+		defaults.set_cpus = (jobsched_parse_cpus(value, &defaults.cpus) == 0);
+		if (!defaults.set_cpus) fprintf(stderr, "smallsh: SMALLSH_CPUS: not a CPU list: %s\n", value);
+	}
+	value = vars_get("SMALLSH_NICE");
+	if (value != NULL && value[0] != '\0') {
+		defaults.set_nice = (jobsched_parse_nice(value, &defaults.nice) == 0);
+		if (!defaults.set_nice) fprintf(stderr, "smallsh: SMALLSH_NICE: not a nice level: %s\n", value);
+	}
+	value = vars_get("SMALLSH_IONICE");
+	if (value != NULL && value[0] != '\0') {
+		defaults.set_ioprio = (jobsched_parse_ioprio(value, &defaults.ioprio) == 0);
+		if (!defaults.set_ioprio) fprintf(stderr, "smallsh: SMALLSH_IONICE: not an I/O priority: %s\n", value);
+	}
+
+	// "all" spreads jobs over every CPU the shell itself may run on
+	value = vars_get("SMALLSH_SPREAD");
+	spread_set = false;
+	if (value != NULL && strcmp(value, "all") == 0) {
+		spread_set = (sched_getaffinity(0, sizeof(cpu_set_t), &spread_cpus) == 0);
+	} else if (value != NULL && value[0] != '\0') {
+		spread_set = (jobsched_parse_cpus(value, &spread_cpus) == 0);
+		if (!spread_set) fprintf(stderr, "smallsh: SMALLSH_SPREAD: not a CPU list: %s\n", value);
+	}
+}
+
+// jobsched_defaults
+// Gets the shell-wide settings from the SMALLSH_CPUS, SMALLSH_NICE, and SMALLSH_IONICE variables
+// Parameters: a pointer to receive the settings
+// Returns: none
+void jobsched_defaults(struct job_sched* js) {
+	if (!loaded || loaded_generation != vars_generation()) load_defaults();
+	*js = defaults;
+}
+
+// jobsched_spread
+// Pins a background job to the CPU after the last one used, cycling through the set in SMALLSH_SPREAD;
+// nothing changes if the variable is not set
+// Parameters: the job's settings
+// Returns: none
+void jobsched_spread(struct job_sched* js) {
+	if (!loaded || loaded_generation != vars_generation()) load_defaults();
+	if (!spread_set) return;
+
+	for (int i = 1; i <= CPU_SETSIZE; i++) {
+		int cpu = (spread_last + i) % CPU_SETSIZE;
+		if (CPU_ISSET(cpu, &spread_cpus)) {
+			spread_last = cpu;
+			js->set_cpus = true;
+			CPU_ZERO(&js->cpus);
+			CPU_SET(cpu, &js->cpus);
+			return;
+		}
+	}
+}
+
+// jobsched_apply
+// Applies a job's settings to the calling process; only makes system calls, so a vfork() child may call it
+// Parameters: the settings
+// Returns: 0 if successful, -1 with errno set on failure
+int jobsched_apply(const struct job_sched* js) {
+	if (js->set_cpus && sched_setaffinity(0, sizeof(cpu_set_t), &js->cpus) == -1) return -1;
+	if (js->set_nice && setpriority(PRIO_PROCESS, 0, js->nice) == -1) return -1;
+	if (js->set_ioprio && syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, js->ioprio) == -1) return -1;
+	return 0;
+}
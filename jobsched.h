@@ -0,0 +1,33 @@
+#ifndef JOBSCHED_H
+#define JOBSCHED_H
+
+#include <stdbool.h>
+#include <sched.h>
+
+// Scheduling settings are applied to a child between fork and exec: the CPUs it may run on
+// (sched_setaffinity), its nice level (setpriority), and its I/O priority (ioprio_set). They come
+// from the sched prefix and from the shell-wide SMALLSH_CPUS, SMALLSH_NICE, and SMALLSH_IONICE
+// variables; SMALLSH_SPREAD pins each successive background job to the next CPU of a set.
+// cpu_set_t needs _GNU_SOURCE, so this header is only for files that define it.
+
+// struct job_sched
+// The scheduling settings of a job; each is only applied if it is set
+struct job_sched {
+	bool set_cpus;
+	cpu_set_t cpus;             // The CPUs the job may run on
+	bool set_nice;
+	int nice;                   // The job's nice level, from -20 to 19
+	bool set_ioprio;
+	int ioprio;                 // The job's I/O priority, as the class and level packed for ioprio_set()
+};
+
+void jobsched_init(struct job_sched* js);
+bool jobsched_active(const struct job_sched* js);
+int jobsched_parse_cpus(const char* s, cpu_set_t* cpus);
+int jobsched_parse_nice(const char* s, int* nice);
+int jobsched_parse_ioprio(const char* s, int* ioprio);
+void jobsched_defaults(struct job_sched* js);
+void jobsched_spread(struct job_sched* js);
+int jobsched_apply(const struct job_sched* js);
+
+#endif
@@ -0,0 +1,186 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+
+#include "launch.h"
+#include "launch_engine.h"
+#include "pathcache.h"
+#include "trace.h"
+
+// open_here
+// Puts the text of a here-document or here-string where a command can read it as its stdin, without
+// touching the filesystem: a short text goes in a pipe, whose buffer always holds PIPE_BUF bytes, so
+// writing it never blocks; a longer one goes in a memory-backed file (memfd) read from the start
+// Parameters: text, the text; len, its length
+// Returns: a descriptor to read the text from, or -1 on failure (a message is printed)
+static int open_here(const char* text, size_t len) {
+	int fds[2];
+	if (len <= PIPE_BUF && pipe2(fds, O_CLOEXEC) == 0) {
+		if (len == 0 || write(fds[1], text, len) == (ssize_t) len) {
+			close(fds[1]);
+			return fds[0];
+		}
+		close(fds[0]);
+		close(fds[1]);
+	}
+
+	int fd = memfd_create("smallsh-here", MFD_CLOEXEC);
+	if (fd == -1) {
+		perror("memfd_create");
+		return -1;
+	}
+	for (size_t done = 0; done < len; ) {
+		ssize_t n = write(fd, text + done, len - done);
+		if (n == -1 && errno == EINTR) continue;
+		if (n == -1) {
+			perror("here-document");
+			close(fd);
+			return -1;
+		}
+		done += n;
+	}
+	lseek(fd, 0, SEEK_SET);
+	return fd;
+}
+
+// redirect_io
+// Opens the files a command redirects stdin and stdout to, or the text its here-document or here-string
+// feeds to stdin, so the launch engine only has to dup2() them
+// Parameters: a pointer to a non-empty command struct and pointers to receive the input and output
+//             file descriptors (-1 if the command does not redirect that stream)
+// Returns: 0 if successful, -1 on failure
+int redirect_io(struct command* cmd, int* in_fd, int* out_fd) {
+	*in_fd = -1;
+	*out_fd = -1;
+
+    // Check for a here-document or here-string, or else a specified input file
+	if (cmd->here != NULL) {
+		*in_fd = open_here(cmd->here, cmd->here_len);
+		if (*in_fd == -1) return -1;
+	} else if (cmd->i_file != NULL) {
+        // Try to open the specified input file for reading only; return an error code if unsuccessful
+        // Close-on-exec keeps the descriptor out of every other child; dup2() clears the flag on the copy
+		*in_fd = open(cmd->i_file, O_RDONLY | O_CLOEXEC);
+		if (*in_fd == -1) {
+			perror(cmd->i_file);
+			return -1;
+		}
+	}
+
+    // Check for a specified output file
+	if (cmd->o_file != NULL) {
+        // Try to open the specified output file for writing only; truncate it if it exists; create it if not
+        // Return an error code if unsuccessful
+		*out_fd = open(cmd->o_file, O_WRONLY | O_TRUNC | O_CREAT | O_CLOEXEC, 0770);
+		if (*out_fd == -1) {
+			perror(cmd->o_file);
+			if (*in_fd != -1) close(*in_fd);
+			*in_fd = -1;
+			return -1;
+		}
+	}
+
+    // Return a success code
+	return 0;
+}
+
+// launch_pipeline
+// Starts every stage of a pipeline at once, connecting each stage's stdout to the next stage's stdin
+// A stage's own I/O redirects take precedence over the pipes and over std_fds
+// Parameters: pl, the pipeline; pids, an array to receive one pid per stage (-1 for stages that could not be started);
+//             pumps, an array with room for two pumps to receive the splice() pumps for the pipeline's
+//             redirect files, or NULL to let the stages open them directly; n_pumps, a pointer to receive the number of pumps;
+//             std_fds, the descriptors to use as the first stage's stdin, the last stage's stdout, and every
+//             stage's stderr (such as a server client's), or NULL to inherit the shell's; sched, the
+//             scheduling settings for every stage, or NULL to let the stages inherit the shell's
+// Returns: the number of stages started
+int launch_pipeline(struct pipeline* pl, pid_t* pids, struct pump* pumps, int* n_pumps, const int* std_fds,
+                    const struct job_sched* sched) {
+	int n_started = 0;
+	int err;
+	*n_pumps = 0;
+    // The caller's descriptors for the pipeline's ends, which stay open
+	int first_in = (std_fds != NULL) ? std_fds[0] : -1;
+	int last_out = (std_fds != NULL) ? std_fds[1] : -1;
+	int err_fd = (std_fds != NULL) ? std_fds[2] : -1;
+    // The read end of the pipe from the previous stage
+	int prev_read = first_in;
+
+    // Flush pending output so it isn't interleaved with the children's when stdout is not a terminal
+	fflush(stdout);
+
+    // Every stage is marked not started, including those after a stage where launching stops
+	for (int i = 0; i < pl->n_cmds; i++) pids[i] = -1;
+
+	for (int i = 0; i < pl->n_cmds; i++) {
+		struct command* cmd = &pl->cmds[i];
+		bool last = (i == pl->n_cmds - 1);
+
+        // Create the pipe to the next stage; stop launching stages if this fails
+        // Close-on-exec keeps each pipe out of every child except the two stages it connects
+		int next_pipe[2] = { -1, last ? last_out : -1 };
+		if (!last && pipe2(next_pipe, O_CLOEXEC) == -1) {
+			perror("pipe");
+			break;
+		}
+
+        // Open the stage's I/O redirect files; a stage whose files cannot be opened is not launched
+		int in_fd, out_fd;
+		uint64_t t_redirect = trace_now();
+		err = redirect_io(cmd, &in_fd, &out_fd);
+		if (cmd->i_file != NULL || cmd->o_file != NULL || cmd->here != NULL) trace_span("redirect", cmd->cmd, t_redirect, trace_now(), 0, -1);
+		if (err == 0) {
+            // In splice mode, the shell feeds the pipeline's input file and drains its output file through pipes
+			int pump_pipe[2];
+			if (pumps != NULL && i == 0 && in_fd != -1 && pipe2(pump_pipe, O_CLOEXEC) == 0) {
+				pump_init(&pumps[(*n_pumps)++], in_fd, pump_pipe[1]);
+				in_fd = pump_pipe[0];
+			}
+			if (pumps != NULL && last && out_fd != -1 && pipe2(pump_pipe, O_CLOEXEC) == 0) {
+				pump_init(&pumps[(*n_pumps)++], pump_pipe[0], out_fd);
+				out_fd = pump_pipe[1];
+			}
+
+            // Find the program in the path cache, which searches the shell's PATH variable; the engines would
+            // search the PATH the shell started with, so a name without a slash that isn't found there is not launched
+			uint64_t t_lookup = trace_now();
+			const char* file = pathcache_lookup(cmd->cmd);
+			if (file == NULL && strchr(cmd->cmd, '/') == NULL) errno = ENOENT;
+			else if (file == NULL) file = cmd->cmd;
+			trace_span("lookup", cmd->cmd, t_lookup, trace_now(), 0, -1);
+
+            // Launch the stage with the selected engine; print an error if it could not be started
+			int stage_in = (in_fd != -1) ? in_fd : prev_read;
+			int stage_out = (out_fd != -1) ? out_fd : next_pipe[1];
+			uint64_t t_spawn = trace_now();
+			if (file != NULL) pids[i] = spawn_process(file, cmd->argv, stage_in, stage_out, err_fd, cmd->background, sched);
+			trace_span("spawn", cmd->cmd, t_spawn, trace_now(), 0, pids[i]);
+			if (pids[i] == -1) {
+				perror(cmd->cmd);
+			} else {
+				n_started++;
+			}
+
+            // The child holds its own copies of the redirect files now
+			if (in_fd != -1) close(in_fd);
+			if (out_fd != -1) close(out_fd);
+		}
+
+        // Close the parent's copies of the pipe ends this stage used
+		if (prev_read != first_in) close(prev_read);
+		if (!last) close(next_pipe[1]);
+		prev_read = next_pipe[0];
+	}
+
+    // Close the last pipe if launching stopped early
+	if (prev_read != first_in && prev_read != -1) close(prev_read);
+	return n_started;
+}
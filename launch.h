@@ -0,0 +1,15 @@
+#ifndef LAUNCH_H
+#define LAUNCH_H
+
+#include <sys/types.h>
+
+#include "parse.h"
+#include "pump.h"
+
+struct job_sched;
+
+int redirect_io(struct command* cmd, int* in_fd, int* out_fd);
+int launch_pipeline(struct pipeline* pl, pid_t* pids, struct pump* pumps, int* n_pumps, const int* std_fds,
+                    const struct job_sched* sched);
+
+#endif
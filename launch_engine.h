@@ -0,0 +1,25 @@
+#ifndef LAUNCH_ENGINE_H
+#define LAUNCH_ENGINE_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+struct job_sched;
+
+// enum spawn_engine
+// The mechanisms available for launching child processes
+enum spawn_engine {
+	SPAWN_POSIX,    // posix_spawn(); redirects and signal masks applied through file actions and attributes
+	SPAWN_VFORK,    // vfork(); the child borrows the parent's address space until it calls exec()
+	SPAWN_FORK      // fork(); copies the parent's page tables; kept as a fallback
+};
+
+// The engine used by spawn_process(); defaults to SPAWN_POSIX
+extern enum spawn_engine spawn_engine;
+
+int spawn_parse_engine(const char* name, enum spawn_engine* engine);
+const char* spawn_engine_name(enum spawn_engine engine);
+pid_t spawn_process(const char* file, char* const argv[], int in_fd, int out_fd, int err_fd, bool background,
+                    const struct job_sched* sched);
+
+#endif
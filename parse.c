@@ -0,0 +1,1161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "globcache.h"
+#include "parse.h"
+#include "vars.h"
+
+// The number of argv slots a command starts with; argv doubles in the arena when it fills up
+#define ARGV_MIN_CAP 16
+// The number of tokens and output bytes the lexer starts with; both double in the arena as needed
+#define TOKENS_MIN_CAP 32
+#define LEX_OUT_MIN_CAP 256
+// The least free space the output buffer is grown to before each read of a command substitution's output
+#define SUBST_READ_MIN 4096
+// What a reference to the loop variable is kept as in a loop body's strings, until an iteration fills it in
+#define SLOT_MARK '\x01'
+// The forms of the loop constructs, printed when one is malformed
+#define FOR_USAGE "for [-j N] NAME in [WORD ...]; do PIPELINE; done"
+#define REPEAT_USAGE "repeat [-j N] COUNT PIPELINE"
+
+// enum token_type
+// The kinds of tokens the lexer produces
+enum token_type {
+	TOK_WORD,                   // An argument or file name, after quote removal and expansion
+	TOK_PIPE,                   // |
+	TOK_IN,                     // <
+	TOK_HEREDOC,                // <<DELIM, whose text is the here-document's body
+	TOK_HERESTR,                // <<<
+	TOK_OUT,                    // >
+	TOK_AMP                     // & standing alone; a background marker if it ends the line
+};
+
+// struct token
+// A token found by the lexer
+struct token {
+	enum token_type type;
+	size_t off;                 // The offset of the token's text in the lexer's output buffer
+	bool glob;                  // Whether the word is a pattern to expand, with its quoted characters escaped
+};
+
+// struct lexer
+// The state of one pass over a command line
+struct lexer {
+	struct arena* arena;        // The arena the output, tokens, and commands are allocated in
+	const char* p;              // The next input character
+	char* out;                  // The text of every token, each null-terminated
+	size_t out_len, out_cap;
+	struct token* toks;         // The tokens, in order
+	int n_toks, toks_cap;
+	bool patterns;              // Whether the line has any *, ?, or [, so quoted characters must be escaped
+	size_t word_start;          // The offset of the word being read in the output buffer
+	bool glob;                  // Whether the word being read has an unquoted *, ?, or [
+	bool word_literal;          // Whether the word being read has text of its own, so it is kept even if empty
+	const char* slot;           // The name of the loop variable whose references are marked, or NULL
+	size_t slot_len;
+};
+
+// The text of each operator token, for syntax errors
+static const char* const operator_names[] = {
+	[TOK_PIPE] = "|", [TOK_IN] = "<", [TOK_OUT] = ">", [TOK_HEREDOC] = "<<", [TOK_HERESTR] = "<<<"
+};
+
+// The shell's pid as a string, substituted for $$; filled in once
+static char pid_str[24] = "";
+static size_t pid_len = 0;
+
+// The file background pipelines read from and write to when they have no redirects
+static char dev_null[] = "/dev/null";
+
+// How $(...) command substitutions are run, or NULL if they aren't available
+static const struct subst_hooks* subst = NULL;
+
+// How the bodies of here-documents are read, or NULL if they aren't available
+static heredoc_read_fn read_heredoc_line = NULL;
+
+// free_pipeline
+// Frees heap memory allocated for a pipeline struct; its commands and strings all live in its arena
+// Parameters: a pointer to a pipeline struct on the heap
+// Returns: none
+void free_pipeline(struct pipeline* pl) {
+    // Free a loop's scratch buffer, the arena's overflow blocks (usually none), and the pipeline struct
+	if (pl->loop != NULL) free(pl->loop->scratch);
+	arena_free(&pl->arena);
+	free(pl);
+	return;
+}
+
+// print_command
+// Prints the data in a command struct; only used for debugging
+// Parameters: the command struct to be printed
+// Returns: none
+void print_command(struct command* cmd) {
+	printf("\n");
+
+    // Print a null pointer if the passed command is NULL
+	if (cmd == NULL) {
+		printf("%p\n\n", cmd);
+		return;
+	}
+
+    // Print the command data
+	printf("cmd: %s\n", cmd->cmd);
+	printf("argc: %d\nargv[]: ", cmd->argc);
+	for (int i = 0; i < cmd->argc; i++) {
+		printf("%s (%zu chars), ", cmd->argv[i], strlen(cmd->argv[i]) + 1);
+	}
+	printf("\ni_file: %s\n", cmd->i_file);
+	printf("o_file: %s\n", cmd->o_file);
+	printf("here: %zu bytes\n", cmd->here_len);
+	printf("background: %d\n\n", cmd->background);
+}
+
+// push_arg
+// Appends an argument to a command, doubling its argv in the arena when it is full
+// Parameters: a, the arena to grow argv in; cmd, the command; arg, the argument
+// Returns: 0 if successful, -1 on failure
+static int push_arg(struct arena* a, struct command* cmd, char* arg) {
+    // Keep a slot free for the NULL that terminates argv for exec()
+	if (cmd->argc + 1 >= cmd->argv_cap) {
+		int new_cap = (cmd->argv_cap == 0) ? ARGV_MIN_CAP : cmd->argv_cap * 2;
+		char** argv = (char**) arena_alloc(a, sizeof(char*) * new_cap);
+		if (argv == NULL) return -1;
+		if (cmd->argc > 0) memcpy(argv, cmd->argv, sizeof(char*) * cmd->argc);
+		cmd->argv = argv;
+		cmd->argv_cap = new_cap;
+	}
+
+	cmd->argv[cmd->argc++] = arg;
+	cmd->argv[cmd->argc] = NULL;
+	return 0;
+}
+
+// parse_init
+// Caches the shell's pid as a string for $$ expansion; called once at startup
+// Parameters: none
+// Returns: none
+void parse_init(void) {
+	pid_len = snprintf(pid_str, sizeof(pid_str), "%d", getpid());
+}
+
+// parse_set_subst_hooks
+// Sets how the commands in $(...) substitutions are run
+// Parameters: the hooks, which must stay valid, or NULL to reject substitutions
+// Returns: none
+void parse_set_subst_hooks(const struct subst_hooks* hooks) {
+	subst = hooks;
+}
+
+// parse_set_heredoc_reader
+// Sets how the lines of here-document bodies, which follow the command line, are read
+// Parameters: the function to read them with, or NULL to reject here-documents
+// Returns: none
+void parse_set_heredoc_reader(heredoc_read_fn read_line) {
+	read_heredoc_line = read_line;
+}
+
+// out_reserve
+// Makes room in the lexer's output buffer, doubling it in the arena when it is full
+// Token offsets stay valid because the buffer is moved as a whole
+// Parameters: lx, the lexer; n, the number of bytes needed
+// Returns: 0 if successful, -1 on failure
+static int out_reserve(struct lexer* lx, size_t n) {
+	if (lx->out_len + n <= lx->out_cap) return 0;
+
+	size_t cap = (lx->out_cap == 0) ? LEX_OUT_MIN_CAP : lx->out_cap * 2;
+	while (cap < lx->out_len + n) cap *= 2;
+	char* out = (char*) arena_alloc(lx->arena, cap);
+	if (out == NULL) return -1;
+	if (lx->out_len > 0) memcpy(out, lx->out, lx->out_len);
+	lx->out = out;
+	lx->out_cap = cap;
+	return 0;
+}
+
+// out_append
+// Appends characters to the lexer's output buffer
+// Parameters: lx, the lexer; s, the characters; n, the number of characters
+// Returns: 0 if successful, -1 on failure
+static int out_append(struct lexer* lx, const char* s, size_t n) {
+	if (out_reserve(lx, n) == -1) return -1;
+	memcpy(lx->out + lx->out_len, s, n);
+	lx->out_len += n;
+	return 0;
+}
+
+// out_append_quoted
+// Appends quoted characters to the lexer's output buffer; on a line with patterns, the characters that
+// are special in a pattern are escaped with backslashes so they match only themselves
+// Parameters: lx, the lexer; s, the characters; n, the number of characters
+// Returns: 0 if successful, -1 on failure
+static int out_append_quoted(struct lexer* lx, const char* s, size_t n) {
+	if (!lx->patterns) return out_append(lx, s, n);
+
+	const char* end = s + n;
+	while (s < end) {
+		size_t run = 0;
+		while (s + run < end && strchr("*?[]\\", s[run]) == NULL) run++;
+		if (out_append(lx, s, run) == -1) return -1;
+		s += run;
+		if (s < end) {
+			char escaped[2] = { '\\', *s++ };
+			if (out_append(lx, escaped, 2) == -1) return -1;
+		}
+	}
+	return 0;
+}
+
+// unescape
+// Removes the backslashes a pattern's quoted characters were escaped with, in place
+// Parameters: the pattern
+// Returns: none
+static void unescape(char* s) {
+	char* out = s;
+	for (; *s != '\0'; s++) {
+		if (*s == '\\' && s[1] != '\0') s++;
+		*out++ = *s;
+	}
+	*out = '\0';
+}
+
+// push_token
+// Appends a token, doubling the token array in the arena when it is full
+// Parameters: lx, the lexer; type, the token type; off, the offset of the token's text
+// Returns: 0 if successful, -1 on failure
+static int push_token(struct lexer* lx, enum token_type type, size_t off) {
+	if (lx->n_toks == lx->toks_cap) {
+		int cap = (lx->toks_cap == 0) ? TOKENS_MIN_CAP : lx->toks_cap * 2;
+		struct token* toks = (struct token*) arena_alloc(lx->arena, sizeof(struct token) * cap);
+		if (toks == NULL) return -1;
+		if (lx->n_toks > 0) memcpy(toks, lx->toks, sizeof(struct token) * lx->n_toks);
+		lx->toks = toks;
+		lx->toks_cap = cap;
+	}
+	lx->toks[lx->n_toks++] = (struct token) { type, off, false };
+	return 0;
+}
+
+// is_blank
+// Checks whether a character separates words
+// Parameters: the character
+// Returns: true if it is a space, tab, or newline
+static bool is_blank(char c) {
+	return c == ' ' || c == '\t' || c == '\n';
+}
+
+// is_operator
+// Checks whether a character is an operator that ends a word
+// Parameters: the character
+// Returns: true if it is |, <, or >
+static bool is_operator(char c) {
+	return c == '|' || c == '<' || c == '>';
+}
+
+// finish_word
+// Terminates the word being read, records it, and starts the next one; a word whose wildcards were all
+// quoted loses its escapes
+// Parameters: the lexer
+// Returns: 0 if successful, -1 on failure
+static int finish_word(struct lexer* lx) {
+	if (out_append(lx, "", 1) == -1) return -1;
+	if (lx->patterns && !lx->glob) unescape(lx->out + lx->word_start);
+	if (push_token(lx, TOK_WORD, lx->word_start) == -1) return -1;
+	lx->toks[lx->n_toks - 1].glob = lx->glob;
+
+	lx->word_start = lx->out_len;
+	lx->glob = false;
+	lx->word_literal = false;
+	return 0;
+}
+
+// place_expansion
+// Turns the text of an expansion, just appended to the output buffer, into part of the word being read.
+// Outside double quotes, it is split into words at blanks; either way, its characters are never wildcards.
+// Parameters: lx, the lexer; raw_start, the offset of the expansion's text, which runs to the end of the
+//             buffer; quoted, whether the expansion is inside double quotes
+// Returns: 0 if successful, -1 on failure
+static int place_expansion(struct lexer* lx, size_t raw_start, bool quoted) {
+	size_t raw_end = lx->out_len;
+
+	// On a line with patterns, make room for escaping the output's wildcards by moving it right; the output is
+	// then rewritten in place, since escapes never catch up with the text still to be read, and word breaks
+	// (a terminating null for a run of blanks) never take more room than they replace
+	size_t n_escapes = 0;
+	if (lx->patterns) {
+		for (size_t i = raw_start; i < raw_end; i++) {
+			if (lx->out[i] != '\0' && strchr("*?[]\\", lx->out[i]) != NULL) n_escapes++;
+		}
+		lx->out_len = raw_end;
+		if (out_reserve(lx, n_escapes) == -1) return -1;
+		memmove(lx->out + raw_start + n_escapes, lx->out + raw_start, raw_end - raw_start);
+	}
+	lx->out_len = raw_start;
+
+	for (size_t r = raw_start + n_escapes; r < raw_end + n_escapes; r++) {
+		char c = lx->out[r];
+		if (!quoted && is_blank(c)) {
+			// A blank ends the word, unless the word hasn't started yet
+			if ((lx->out_len > lx->word_start || lx->word_literal) && finish_word(lx) == -1) return -1;
+			continue;
+		}
+		if (lx->patterns && c != '\0' && strchr("*?[]\\", c) != NULL) lx->out[lx->out_len++] = '\\';
+		lx->out[lx->out_len++] = c;
+	}
+	return 0;
+}
+
+// find_subst_end
+// Finds the parenthesis that closes a command substitution, skipping quoted text and nested parentheses
+// Parameters: the first character inside the substitution
+// Returns: a pointer to the closing parenthesis, or NULL if there is none
+static const char* find_subst_end(const char* c) {
+	int depth = 1;
+	for (; *c != '\0'; c++) {
+		if (*c == '\\') {
+			if (*++c == '\0') return NULL;
+		} else if (*c == '\'') {
+			c = strchr(c + 1, '\'');
+			if (c == NULL) return NULL;
+		} else if (*c == '"') {
+			for (c++; *c != '"'; c++) {
+				if (*c == '\0' || (*c == '\\' && *++c == '\0')) return NULL;
+			}
+		} else if (*c == '(') {
+			depth++;
+		} else if (*c == ')' && --depth == 0) {
+			return c;
+		}
+	}
+	return NULL;
+}
+
+// is_name_char
+// Checks whether a character can be part of a variable name
+// Parameters: the character
+// Returns: true if it is a letter, digit, or underscore
+static bool is_name_char(char c) {
+	return c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+}
+
+// mentions_var
+// Checks whether the command line of a substitution refers to a variable, as $NAME or ${NAME} outside single quotes
+// Parameters: text, the command line; end, its end; name, the variable's name; len, the name's length
+// Returns: true if it does
+static bool mentions_var(const char* text, const char* end, const char* name, size_t len) {
+	bool double_quoted = false;
+	for (const char* c = text; c < end; c++) {
+		if (*c == '\\') {
+			c++;
+		} else if (*c == '"') {
+			double_quoted = !double_quoted;
+		} else if (*c == '\'' && !double_quoted) {
+			const char* close = memchr(c + 1, '\'', end - c - 1);
+			if (close == NULL) return false;
+			c = close;
+		} else if (*c == '$') {
+			const char* n = c + 1 + (c[1] == '{');
+			if ((size_t) (end - n) < len || strncmp(n, name, len) != 0) continue;
+			if (c[1] == '{' ? n[len] == '}' : !is_name_char(n[len])) return true;
+		}
+	}
+	return false;
+}
+
+// lex_subst
+// Runs the command line of a $(...) substitution and replaces the substitution with its output, less
+// trailing newlines. The output is read straight into the output buffer, which grows by doubling.
+// Parameters: lx, the lexer, positioned at the $; quoted, whether the substitution is inside double quotes
+// Returns: 0 if successful, -1 on a syntax error or failure (a message is printed)
+static int lex_subst(struct lexer* lx, bool quoted) {
+	const char* inner = lx->p + 2;
+	const char* end = find_subst_end(inner);
+	if (end == NULL) {
+		fprintf(stderr, "smallsh: syntax error: unterminated $(\n");
+		return -1;
+	}
+	lx->p = end + 1;
+	if (quoted) lx->word_literal = true;
+	// An empty substitution has no output
+	if (inner + strspn(inner, " \t\n") >= end) return 0;
+	if (subst == NULL) {
+		fprintf(stderr, "smallsh: command substitution is not available\n");
+		return -1;
+	}
+	// In a loop's body the substitution runs once, when the body is parsed, before the loop variable has a value
+	if (lx->slot != NULL && mentions_var(inner, end, lx->slot, lx->slot_len)) {
+		fprintf(stderr, "smallsh: $(...) in a loop runs once, before the loop, so it can't use $%.*s\n",
+		        (int) lx->slot_len, lx->slot);
+		return -1;
+	}
+
+	// Start the command and read its output up to end-of-file
+	char* line = arena_strndup(lx->arena, inner, end - inner);
+	if (line == NULL) return -1;
+	void* job;
+	int fd = subst->start(line, &job);
+	if (fd == -1) return -1;
+	size_t raw_start = lx->out_len;
+	int err = 0;
+	while (true) {
+		if (out_reserve(lx, SUBST_READ_MIN) == -1) {
+			err = -1;
+			break;
+		}
+		ssize_t n = read(fd, lx->out + lx->out_len, lx->out_cap - lx->out_len);
+		if (n > 0) {
+			lx->out_len += n;
+		} else if (n == 0 || errno != EINTR) {
+			break;
+		}
+	}
+	close(fd);
+	subst->finish(job);
+	if (err == -1) return -1;
+
+	while (lx->out_len > raw_start && lx->out[lx->out_len - 1] == '\n') lx->out_len--;
+	return place_expansion(lx, raw_start, quoted);
+}
+
+// lex_var
+// Replaces a $NAME or ${NAME} reference with the variable's value; an unset variable is empty
+// Parameters: lx, the lexer, positioned at the $; quoted, whether the reference is inside double quotes
+// Returns: 0 if successful, -1 on a syntax error or failure (a message is printed for syntax errors)
+static int lex_var(struct lexer* lx, bool quoted) {
+	const char* name = lx->p + 1;
+	size_t len;
+	if (*name == '{') {
+		name++;
+		const char* end = strchr(name, '}');
+		if (end == NULL) {
+			fprintf(stderr, "smallsh: syntax error: unterminated ${\n");
+			return -1;
+		}
+		len = end - name;
+		if (!vars_valid_name(name, len)) {
+			fprintf(stderr, "smallsh: ${%.*s}: bad substitution\n", (int) len, name);
+			return -1;
+		}
+		lx->p = end + 1;
+	} else {
+		len = 1;
+		while (is_name_char(name[len])) len++;
+		lx->p = name + len;
+	}
+	if (quoted) lx->word_literal = true;
+
+	// A reference to the loop variable is marked, to be filled in by each iteration; it is never split
+	if (lx->slot != NULL && len == lx->slot_len && strncmp(name, lx->slot, len) == 0) {
+		char mark = SLOT_MARK;
+		lx->word_literal = true;
+		return out_append(lx, &mark, 1);
+	}
+
+	const char* value = vars_getn(name, len);
+	if (value == NULL || *value == '\0') return 0;
+	size_t raw_start = lx->out_len;
+	if (out_append(lx, value, strlen(value)) == -1) return -1;
+	return place_expansion(lx, raw_start, quoted);
+}
+
+// lex_dollar
+// Expands the $ sequence at the lexer's position: $$ becomes the shell's pid, $NAME and ${NAME} become the
+// variable's value, $(...) becomes the output of the command line inside, and a lone $ is kept
+// Parameters: lx, the lexer, positioned at a $; quoted, whether the $ is inside double quotes
+// Returns: 0 if successful, -1 on failure
+static int lex_dollar(struct lexer* lx, bool quoted) {
+	char next = lx->p[1];
+	if (next == '(') return lex_subst(lx, quoted);
+	if (next == '{' || next == '_' || (next >= 'a' && next <= 'z') || (next >= 'A' && next <= 'Z')) return lex_var(lx, quoted);
+	lx->word_literal = true;
+	if (lx->p[1] == '$') {
+		if (pid_len == 0) parse_init();
+		lx->p += 2;
+		return out_append(lx, pid_str, pid_len);
+	}
+	lx->p++;
+	return out_append(lx, "$", 1);
+}
+
+// lex_word
+// Reads one word, removing quotes and backslashes and expanding $$, variables, and $(...), up to the next
+// blank or operator; a word with an unquoted *, ?, or [ is kept as a pattern, and an unquoted variable or
+// substitution can split the word into several or leave none
+// Parameters: the lexer, positioned at the word's first character
+// Returns: 0 if successful, -1 on a syntax error or failure (a message is printed for syntax errors)
+static int lex_word(struct lexer* lx) {
+	lx->word_start = lx->out_len;
+	lx->glob = false;
+	lx->word_literal = false;
+
+	while (*lx->p != '\0' && !is_blank(*lx->p) && !is_operator(*lx->p)) {
+		char c = *lx->p;
+		if (c != '$') lx->word_literal = true;
+		if (c == '\\') {
+			// A backslash keeps the next character literally
+			if (lx->p[1] != '\0') {
+				if (out_append_quoted(lx, lx->p + 1, 1) == -1) return -1;
+				lx->p += 2;
+			} else {
+				lx->p++;
+			}
+		} else if (c == '\'') {
+			// Single quotes keep everything up to the closing quote literally
+			const char* close = strchr(lx->p + 1, '\'');
+			if (close == NULL) {
+				fprintf(stderr, "smallsh: syntax error: unterminated '\n");
+				return -1;
+			}
+			if (out_append_quoted(lx, lx->p + 1, close - lx->p - 1) == -1) return -1;
+			lx->p = close + 1;
+		} else if (c == '"') {
+			// Double quotes keep everything but $ expansions and backslashes before " \ $
+			lx->p++;
+			while (*lx->p != '"') {
+				if (*lx->p == '\0') {
+					fprintf(stderr, "smallsh: syntax error: unterminated \"\n");
+					return -1;
+				}
+				int err;
+				if (*lx->p == '$') {
+					err = lex_dollar(lx, true);
+				} else if (*lx->p == '\\' && (lx->p[1] == '"' || lx->p[1] == '\\' || lx->p[1] == '$')) {
+					err = out_append_quoted(lx, lx->p + 1, 1);
+					lx->p += 2;
+				} else {
+					// Copy the run of ordinary characters at once
+					size_t n = strcspn(lx->p, "\"\\$");
+					if (n == 0) n = 1;
+					err = out_append_quoted(lx, lx->p, n);
+					lx->p += n;
+				}
+				if (err == -1) return -1;
+			}
+			lx->p++;
+		} else if (c == '$') {
+			if (lex_dollar(lx, false) == -1) return -1;
+		} else {
+			// Copy the run of ordinary characters at once
+			size_t n = strcspn(lx->p, " \t\n|<>\\'\"$");
+			if (lx->patterns && !lx->glob) {
+				for (size_t i = 0; i < n; i++) {
+					if (lx->p[i] == '*' || lx->p[i] == '?' || lx->p[i] == '[') lx->glob = true;
+				}
+			}
+			if (out_append(lx, lx->p, n) == -1) return -1;
+			lx->p += n;
+		}
+	}
+
+	// Record the word, unless it was only substitutions that produced nothing
+	if (lx->out_len == lx->word_start && !lx->word_literal) return 0;
+	return finish_word(lx);
+}
+
+// lex_heredoc_line
+// Appends a line of a here-document's body to the output buffer, expanding $$, variables, and $(...) as
+// inside double quotes; a backslash only keeps a following $ or backslash literally
+// Parameters: lx, the lexer; line, the line
+// Returns: 0 if successful, -1 on a syntax error or failure
+static int lex_heredoc_line(struct lexer* lx, const char* line) {
+	// The expansions read from the lexer's position, so point it at the line for now; the body is not
+	// a pattern, so nothing in it is escaped
+	const char* saved_p = lx->p;
+	bool saved_patterns = lx->patterns;
+	lx->p = line;
+	lx->patterns = false;
+
+	int err = 0;
+	while (err == 0 && *lx->p != '\0') {
+		if (*lx->p == '$') {
+			err = lex_dollar(lx, true);
+		} else if (*lx->p == '\\' && (lx->p[1] == '$' || lx->p[1] == '\\')) {
+			err = out_append(lx, lx->p + 1, 1);
+			lx->p += 2;
+		} else {
+			// Copy the run of ordinary characters at once
+			size_t n = strcspn(lx->p, "$\\");
+			if (n == 0) n = 1;
+			err = out_append(lx, lx->p, n);
+			lx->p += n;
+		}
+	}
+	if (err == 0) err = out_append(lx, "\n", 1);
+
+	lx->p = saved_p;
+	lx->patterns = saved_patterns;
+	return err;
+}
+
+// lex_heredoc
+// Reads a <<DELIM (or <<-DELIM) here-document: the delimiter, after quote removal, and then the body from
+// the lines that follow the command line, up to a line that is only the delimiter. The body is expanded
+// unless any part of the delimiter was quoted; with <<-, leading tabs are removed from every line.
+// Parameters: the lexer, positioned at the <<
+// Returns: 0 if successful, -1 on a syntax error or failure (a message is printed for syntax errors)
+static int lex_heredoc(struct lexer* lx) {
+	lx->p += 2;
+	bool strip_tabs = (*lx->p == '-');
+	if (strip_tabs) lx->p++;
+	while (*lx->p == ' ' || *lx->p == '\t') lx->p++;
+
+	// Read the delimiter; its text is kept in the output buffer, which may move, so hold its offset
+	size_t delim_off = lx->out_len;
+	bool quoted = false;
+	while (*lx->p != '\0' && !is_blank(*lx->p) && !is_operator(*lx->p)) {
+		char c = *lx->p;
+		int err;
+		if (c == '\\') {
+			quoted = true;
+			err = (lx->p[1] != '\0') ? out_append(lx, lx->p + 1, 1) : 0;
+			lx->p += (lx->p[1] != '\0') ? 2 : 1;
+		} else if (c == '\'' || c == '"') {
+			quoted = true;
+			const char* close = strchr(lx->p + 1, c);
+			if (close == NULL) {
+				fprintf(stderr, "smallsh: syntax error: unterminated %c\n", c);
+				return -1;
+			}
+			err = out_append(lx, lx->p + 1, close - lx->p - 1);
+			lx->p = close + 1;
+		} else {
+			err = out_append(lx, lx->p, 1);
+			lx->p++;
+		}
+		if (err == -1) return -1;
+	}
+	if (lx->out_len == delim_off && !quoted) {
+		char near[2] = { *lx->p, '\0' };
+		fprintf(stderr, "smallsh: syntax error near '%s'\n", (*lx->p == '\0') ? "newline" : near);
+		return -1;
+	}
+	if (out_append(lx, "", 1) == -1) return -1;
+	if (read_heredoc_line == NULL) {
+		fprintf(stderr, "smallsh: here-documents are not available\n");
+		return -1;
+	}
+
+	// Read the body straight into the output buffer, after the delimiter
+	size_t body_off = lx->out_len;
+	while (true) {
+		const char* line;
+		int got = read_heredoc_line(&line);
+		if (got == -1) return -1;
+		if (got == 0) {
+			fprintf(stderr, "smallsh: warning: here-document ended by end of input (wanted '%s')\n", lx->out + delim_off);
+			break;
+		}
+		if (strip_tabs) line += strspn(line, "\t");
+		if (strcmp(line, lx->out + delim_off) == 0) break;
+		int err = quoted ? out_append(lx, line, strlen(line)) : lex_heredoc_line(lx, line);
+		if (err == 0 && quoted) err = out_append(lx, "\n", 1);
+		if (err == -1) return -1;
+	}
+	if (out_append(lx, "", 1) == -1) return -1;
+	return push_token(lx, TOK_HEREDOC, body_off);
+}
+
+// lex_line
+// Splits a command line into tokens in one pass, expanding $$ and removing quotes as it goes (on a line
+// with wildcards, quoted characters are escaped instead so that patterns can tell them apart)
+// A # at the start of a word begins a comment that runs to the end of the line
+// Parameters: lx, a lexer set up over the line
+// Returns: 0 if successful, -1 on a syntax error or failure
+static int lex_line(struct lexer* lx) {
+	while (true) {
+		// Skip the blanks between tokens
+		while (is_blank(*lx->p)) lx->p++;
+		char c = *lx->p;
+		if (c == '\0' || c == '#') return 0;
+
+		int err;
+		if (c == '|') {
+			err = push_token(lx, TOK_PIPE, 0);
+			lx->p++;
+		} else if (c == '<' && lx->p[1] == '<' && lx->p[2] == '<') {
+			err = push_token(lx, TOK_HERESTR, 0);
+			lx->p += 3;
+		} else if (c == '<' && lx->p[1] == '<') {
+			err = lex_heredoc(lx);
+		} else if (c == '<') {
+			err = push_token(lx, TOK_IN, 0);
+			lx->p++;
+		} else if (c == '>') {
+			err = push_token(lx, TOK_OUT, 0);
+			lx->p++;
+		} else if (c == '&' && (lx->p[1] == '\0' || is_blank(lx->p[1]) || is_operator(lx->p[1]))) {
+			// A standalone &; keep its text in case it turns out to be an ordinary argument
+			err = push_token(lx, TOK_AMP, lx->out_len);
+			if (err == 0) err = out_append(lx, "&", 2);
+			lx->p++;
+		} else {
+			err = lex_word(lx);
+		}
+		if (err == -1) return -1;
+	}
+}
+
+// struct glob_args
+// Where the paths a pattern expands to are appended
+struct glob_args {
+	struct arena* arena;
+	struct command* cmd;
+};
+
+// push_glob_match
+// Appends a path a pattern matched to a command's arguments
+// Parameters: path, the path; len, its length; ctx, the glob_args
+// Returns: 0 if successful, -1 on failure
+static int push_glob_match(const char* path, size_t len, void* ctx) {
+	struct glob_args* args = (struct glob_args*) ctx;
+	char* arg = arena_strndup(args->arena, path, len);
+	if (arg == NULL) return -1;
+	return push_arg(args->arena, args->cmd, arg);
+}
+
+// parse_syntax_error
+// Prints a syntax error about a token and frees the pipeline being built
+// Parameters: pl, the pipeline; near, the text of the offending token
+// Returns: NULL
+static struct pipeline* parse_syntax_error(struct pipeline* pl, const char* near) {
+	fprintf(stderr, "smallsh: syntax error near '%s'\n", near);
+	free_pipeline(pl);
+	return NULL;
+}
+
+// parse_stages
+// Lexes a command line into a pipeline's arena and builds a command struct for each |-separated stage,
+// registering < and > redirects, here-documents, and here-strings separately from the arguments; the
+// bodies of here-documents are read from the lines after the command line as the lexer reaches them
+// Parameters: pl, the new pipeline; line, a command string of any length; slot and slot_len, the name of
+//             the loop variable whose references are marked rather than expanded, or NULL and 0
+// Returns: the pipeline, filled, or NULL if the line is empty, a comment, or invalid, or if memory ran
+//          out (the pipeline is freed)
+static struct pipeline* parse_stages(struct pipeline* pl, const char* line, const char* slot, size_t slot_len) {
+    // Split the line into tokens
+	struct lexer lx = { &pl->arena, line, NULL, 0, 0, NULL, 0, 0, strpbrk(line, "*?[") != NULL, 0, false, false, slot, slot_len };
+	if (lex_line(&lx) == -1 || lx.n_toks == 0) {
+		free_pipeline(pl);
+		return NULL;
+	}
+
+    // An & at the end of the line puts the whole pipeline in the background
+	int n_toks = lx.n_toks;
+	if (lx.toks[n_toks - 1].type == TOK_AMP) {
+		pl->background = true;
+		n_toks--;
+	}
+
+    // Count the stages (one more than the number of | tokens)
+	int n_stages = 1;
+	for (int i = 0; i < n_toks; i++) {
+		if (lx.toks[i].type == TOK_PIPE) n_stages++;
+	}
+	pl->cmds = (struct command*) arena_alloc(&pl->arena, sizeof(struct command) * n_stages);
+	if (pl->cmds == NULL) {
+		free_pipeline(pl);
+		return NULL;
+	}
+	memset(pl->cmds, 0, sizeof(struct command) * n_stages);
+
+    // Build the commands; a redirect token applies to the word that follows it
+	struct command* cmd = &pl->cmds[0];
+	pl->n_cmds = 1;
+	enum token_type pending = TOK_WORD;
+	for (int i = 0; i < n_toks; i++) {
+		struct token* tok = &lx.toks[i];
+		char* text = lx.out + tok->off;
+		switch (tok->type) {
+		case TOK_WORD:
+		case TOK_AMP:
+			if (tok->glob && pending == TOK_WORD && (slot == NULL || strchr(text, SLOT_MARK) == NULL)) {
+                // Expand a pattern into the paths it matches, in sorted order, or keep it as it is if nothing matches
+				struct glob_args args = { &pl->arena, cmd };
+				int n = globcache_expand(text, push_glob_match, &args);
+				if (n == -1) {
+					free_pipeline(pl);
+					return NULL;
+				}
+				if (n > 0) break;
+				unescape(text);
+			} else if (tok->glob) {
+                // Redirect file names, here-strings, and words with the loop variable aren't expanded
+				unescape(text);
+			}
+			if (pending == TOK_HERESTR) {
+                // A here-string feeds the word to stdin as a line
+				size_t len = strlen(text);
+				char* here = (char*) arena_alloc(&pl->arena, len + 2);
+				if (here == NULL) {
+					free_pipeline(pl);
+					return NULL;
+				}
+				memcpy(here, text, len);
+				memcpy(here + len, "\n", 2);
+				cmd->here = here;
+				cmd->here_len = len + 1;
+				cmd->i_file = NULL;
+				pending = TOK_WORD;
+			} else if (pending == TOK_IN || pending == TOK_OUT) {
+                // Register the redirect file, cut off at the file name maximum
+				if (strlen(text) > FILE_NAME_MAX) text[FILE_NAME_MAX] = '\0';
+				if (pending == TOK_IN) {
+                    // The last of <, <<, and <<< wins
+					cmd->i_file = text;
+					cmd->here = NULL;
+				} else {
+					cmd->o_file = text;
+				}
+				pending = TOK_WORD;
+			} else if (push_arg(&pl->arena, cmd, text) == -1) {
+				free_pipeline(pl);
+				return NULL;
+			}
+			break;
+		case TOK_HEREDOC:
+			if (pending != TOK_WORD) return parse_syntax_error(pl, "<<");
+			cmd->here = text;
+			cmd->here_len = strlen(text);
+			cmd->i_file = NULL;
+			break;
+		case TOK_IN:
+		case TOK_OUT:
+		case TOK_HERESTR:
+			if (pending != TOK_WORD) return parse_syntax_error(pl, tok->type == TOK_IN ? "<" : tok->type == TOK_OUT ? ">" : "<<<");
+			pending = tok->type;
+			break;
+		case TOK_PIPE:
+            // An empty stage (such as "| wc" or "ls | | wc") or a redirect without a file is a syntax error
+			if (pending != TOK_WORD || cmd->argc == 0) return parse_syntax_error(pl, "|");
+			cmd = &pl->cmds[pl->n_cmds++];
+			break;
+		}
+	}
+	if (pending != TOK_WORD) return parse_syntax_error(pl, "newline");
+	if (cmd->argc == 0) return parse_syntax_error(pl, (pl->n_cmds > 1) ? "|" : (pl->background ? "&" : "newline"));
+
+	for (int i = 0; i < pl->n_cmds; i++) {
+		pl->cmds[i].cmd = pl->cmds[i].argv[0];
+		pl->cmds[i].background = pl->background;
+	}
+
+    // If the pipeline is a background process and no I/O redirect is given for its ends, default to /dev/null
+	if (pl->background) {
+		if (pl->cmds[0].i_file == NULL && pl->cmds[0].here == NULL) pl->cmds[0].i_file = dev_null;
+		if (pl->cmds[pl->n_cmds - 1].o_file == NULL) pl->cmds[pl->n_cmds - 1].o_file = dev_null;
+	}
+
+    // Return a pointer to the pipeline struct
+	return pl;
+}
+
+// skip_blanks
+// Skips spaces and tabs
+// Parameters: the text
+// Returns: a pointer to the first character that isn't a space or tab
+static const char* skip_blanks(const char* p) {
+	return p + strspn(p, " \t");
+}
+
+// is_keyword
+// Checks whether text starts with a keyword standing alone
+// Parameters: p, the text; word, the keyword
+// Returns: true if the keyword is followed by a blank, a ;, or the end of the text
+static bool is_keyword(const char* p, const char* word) {
+	size_t n = strlen(word);
+	return strncmp(p, word, n) == 0 && (p[n] == '\0' || p[n] == ';' || is_blank(p[n]));
+}
+
+// find_unquoted
+// Finds the first of a set of characters that isn't quoted, escaped, or inside a $(...) substitution
+// Parameters: c, the text; stop, the characters to find
+// Returns: a pointer to the character found, or to the end of the text
+static const char* find_unquoted(const char* c, const char* stop) {
+	for (; *c != '\0' && strchr(stop, *c) == NULL; c++) {
+		const char* close = c;
+		if (*c == '\\' && c[1] != '\0') {
+			close = c + 1;
+		} else if (*c == '\'') {
+			close = strchr(c + 1, '\'');
+		} else if (*c == '"') {
+			for (close = c + 1; *close != '"' && *close != '\0'; close++) {
+				if (*close == '\\' && close[1] != '\0') close++;
+			}
+			if (*close == '\0') close = NULL;
+		} else if (*c == '$' && c[1] == '(') {
+			close = find_subst_end(c + 2);
+		}
+		// An unterminated quote or substitution runs to the end; the lexer reports it
+		if (close == NULL) return c + strlen(c);
+		c = close;
+	}
+	return c;
+}
+
+// lex_words
+// Lexes a loop's list of words (or its count) into a command's arguments, expanding them as a command's
+// arguments are; operators are syntax errors
+// Parameters: pl, the pipeline whose arena holds the words; text, the list; len, its length;
+//             words, a zeroed command to receive the words
+// Returns: 0 if successful, -1 on a syntax error or failure (a message is printed for syntax errors)
+static int lex_words(struct pipeline* pl, const char* text, size_t len, struct command* words) {
+	char* copy = arena_strndup(&pl->arena, text, len);
+	if (copy == NULL) return -1;
+	struct lexer lx = { &pl->arena, copy, NULL, 0, 0, NULL, 0, 0, strpbrk(copy, "*?[") != NULL, 0, false, false, NULL, 0 };
+	if (lex_line(&lx) == -1) return -1;
+
+	for (int i = 0; i < lx.n_toks; i++) {
+		struct token* tok = &lx.toks[i];
+		char* word = lx.out + tok->off;
+		if (tok->type != TOK_WORD && tok->type != TOK_AMP) {
+			fprintf(stderr, "smallsh: syntax error near '%s'\n", operator_names[tok->type]);
+			return -1;
+		}
+		if (tok->glob) {
+			struct glob_args args = { &pl->arena, words };
+			int n = globcache_expand(word, push_glob_match, &args);
+			if (n == -1) return -1;
+			if (n > 0) continue;
+			unescape(word);
+		}
+		if (push_arg(&pl->arena, words, word) == -1) return -1;
+	}
+	return 0;
+}
+
+// slot_text
+// Gets the string a loop slot refers to
+// Parameters: cmd, the command; arg, the slot's arg
+// Returns: the string, or NULL if the command doesn't have it
+static char* slot_text(struct command* cmd, int arg) {
+	if (arg == LOOP_SLOT_IN) return cmd->i_file;
+	if (arg == LOOP_SLOT_OUT) return cmd->o_file;
+	if (arg == LOOP_SLOT_HERE) return cmd->here;
+	return cmd->argv[arg];
+}
+
+// find_slots
+// Records every string in a loop's body that refers to the loop variable, and how much room they take filled in
+// Parameters: pl, the pipeline, parsed; lp, its loop
+// Returns: 0 if successful, -1 if memory ran out
+static int find_slots(struct pipeline* pl, struct loop* lp) {
+    // Count the strings, then record them
+	for (int pass = 0; pass < 2; pass++) {
+		int n = 0;
+		for (int c = 0; c < pl->n_cmds; c++) {
+			struct command* cmd = &pl->cmds[c];
+            // The here-document, output file, and input file come before the arguments
+			for (int arg = LOOP_SLOT_HERE; arg < cmd->argc; arg++) {
+				const char* text = slot_text(cmd, arg);
+				if (text == NULL || strchr(text, SLOT_MARK) == NULL) continue;
+				if (pass == 1) {
+					lp->slots[n] = (struct loop_slot) { c, arg, text };
+					for (; *text != '\0'; text++) {
+						if (*text == SLOT_MARK) lp->n_marks++;
+						else lp->slot_bytes++;
+					}
+					lp->slot_bytes++;
+				}
+				n++;
+			}
+		}
+		if (pass == 0) {
+			if (n == 0) return 0;
+			lp->slots = (struct loop_slot*) arena_alloc(&pl->arena, sizeof(struct loop_slot) * n);
+			if (lp->slots == NULL) return -1;
+			lp->n_slots = n;
+		}
+	}
+	return 0;
+}
+
+// loop_usage
+// Prints the form of a loop construct and frees the pipeline being built
+// Parameters: pl, the pipeline; is_for, whether the loop is a for loop (or else a repeat loop)
+// Returns: NULL
+static struct pipeline* loop_usage(struct pipeline* pl, bool is_for) {
+	fprintf(stderr, "usage: %s\n", is_for ? FOR_USAGE : REPEAT_USAGE);
+	free_pipeline(pl);
+	return NULL;
+}
+
+// parse_loop
+// Parses "for [-j N] NAME in [WORD ...]; do PIPELINE; done" or "repeat [-j N] COUNT PIPELINE". The words
+// (or the count) are expanded once, and the pipeline is parsed once into the loop's body, with the loop
+// variable's references marked for each iteration to fill in rather than expanded.
+// Parameters: pl, the new pipeline; line, the command line, from its keyword
+// Returns: the pipeline, with its loop, or NULL if the line is invalid or memory ran out (the pipeline is freed)
+static struct pipeline* parse_loop(struct pipeline* pl, const char* line) {
+	bool is_for = (line[0] == 'f');
+	struct loop* lp = (struct loop*) arena_alloc(&pl->arena, sizeof(struct loop));
+	if (lp == NULL) {
+		free_pipeline(pl);
+		return NULL;
+	}
+	memset(lp, 0, sizeof(struct loop));
+	pl->loop = lp;
+	lp->keyword = is_for ? "for" : "repeat";
+	const char* p = skip_blanks(line + (is_for ? 3 : 6));
+
+    // -j N runs up to N iterations at once
+	if (strncmp(p, "-j", 2) == 0) {
+		p = skip_blanks(p + 2);
+		char* end;
+		long jobs = strtol(p, &end, 10);
+		if (end == p || jobs < 1 || jobs > INT_MAX || !is_blank(*end)) return loop_usage(pl, is_for);
+		lp->jobs = (int) jobs;
+		p = skip_blanks(end);
+	}
+
+	struct command words;
+	memset(&words, 0, sizeof(words));
+	const char* name = NULL;
+	size_t name_len = 0;
+	const char* body_end;
+	if (is_for) {
+        // The loop variable, then the words up to the first ;
+		name = p;
+		while (is_name_char(name[name_len])) name_len++;
+		if (!vars_valid_name(name, name_len) || !is_blank(name[name_len])) return loop_usage(pl, true);
+		p = skip_blanks(name + name_len);
+		if (!is_keyword(p, "in")) return loop_usage(pl, true);
+		p += 2;
+		const char* words_end = find_unquoted(p, ";");
+		if (*words_end != ';') return loop_usage(pl, true);
+		if (lex_words(pl, p, words_end - p, &words) == -1) {
+			free_pipeline(pl);
+			return NULL;
+		}
+		lp->n_iters = words.argc;
+		lp->items = words.argv;
+
+        // The body runs from do to the next ;, which must be followed by done and nothing else
+		p = skip_blanks(words_end + 1);
+		if (!is_keyword(p, "do")) return loop_usage(pl, true);
+		p += 2;
+		body_end = find_unquoted(p, ";");
+		if (*body_end != ';') return loop_usage(pl, true);
+		const char* rest = skip_blanks(body_end + 1);
+		if (!is_keyword(rest, "done")) return loop_usage(pl, true);
+		rest = skip_blanks(rest + 4);
+		if (*rest != '\0' && *rest != '#') return loop_usage(pl, true);
+	} else {
+        // The count, a single word that expands to a number; the body is the rest of the line
+		const char* count_end = find_unquoted(p, " \t");
+		if (lex_words(pl, p, count_end - p, &words) == -1) {
+			free_pipeline(pl);
+			return NULL;
+		}
+		if (words.argc != 1 || words.argv[0][0] == '\0' || strspn(words.argv[0], "0123456789") != strlen(words.argv[0])) {
+			return loop_usage(pl, false);
+		}
+		lp->n_iters = strtoul(words.argv[0], NULL, 10);
+		p = count_end;
+		body_end = p + strlen(p);
+	}
+
+	char* body = arena_strndup(&pl->arena, p, body_end - p);
+	if (body == NULL) {
+		free_pipeline(pl);
+		return NULL;
+	}
+	const char* first = skip_blanks(body);
+	if (*first == '\0' || *first == '#') return loop_usage(pl, is_for);
+	if (is_keyword(first, "for") || is_keyword(first, "repeat")) {
+		fprintf(stderr, "smallsh: loops can't be nested\n");
+		free_pipeline(pl);
+		return NULL;
+	}
+
+    // Parse the body once, and keep its commands as parsed for every iteration to start from
+	if (parse_stages(pl, body, name, name_len) == NULL) return NULL;
+	lp->body = (struct command*) arena_alloc(&pl->arena, sizeof(struct command) * pl->n_cmds);
+	if (lp->body == NULL || find_slots(pl, lp) == -1) {
+		free_pipeline(pl);
+		return NULL;
+	}
+	memcpy(lp->body, pl->cmds, sizeof(struct command) * pl->n_cmds);
+	return pl;
+}
+
+// parse_pipeline
+// Parses a command line into a new pipeline: a for or repeat loop around a pipeline, or a pipeline
+// Parameters: a command string of any length
+// Returns: a pointer to a filled pipeline struct, or NULL if the line is empty, a comment, or invalid,
+//          or if memory ran out
+struct pipeline* parse_pipeline(const char* line) {
+    // Allocate the pipeline struct; its built-in arena buffer holds everything else
+	struct pipeline* pl = (struct pipeline*) malloc(sizeof(struct pipeline));
+	if (pl == NULL) return NULL;
+	arena_init(&pl->arena, pl->arena_buf, sizeof(pl->arena_buf));
+	pl->n_cmds = 0;
+	pl->background = false;
+	pl->loop = NULL;
+
+	const char* start = skip_blanks(line);
+	if (is_keyword(start, "for") || is_keyword(start, "repeat")) return parse_loop(pl, start);
+	return parse_stages(pl, line, NULL, 0);
+}
+
+// parse_loop_iteration
+// Prepares a loop's pipeline for an iteration: the body's commands are restored as they were parsed, and the
+// strings that refer to the loop variable are filled in with its value, in a buffer every iteration reuses
+// Parameters: pl, a pipeline with a loop; i, the iteration, from 0
+// Returns: 0 if successful, -1 if memory ran out
+int parse_loop_iteration(struct pipeline* pl, unsigned long i) {
+	struct loop* lp = pl->loop;
+	memcpy(pl->cmds, lp->body, sizeof(struct command) * pl->n_cmds);
+
+	if (lp->n_slots > 0) {
+		const char* value = lp->items[i];
+		size_t value_len = strlen(value);
+		size_t need = lp->slot_bytes + lp->n_marks * value_len;
+		if (need > lp->scratch_cap) {
+			char* grown = (char*) realloc(lp->scratch, need);
+			if (grown == NULL) return -1;
+			lp->scratch = grown;
+			lp->scratch_cap = need;
+		}
+
+        // Copy each string into the buffer with the value in place of its markers
+		static const char marks[] = { SLOT_MARK, '\0' };
+		char* out = lp->scratch;
+		for (int s = 0; s < lp->n_slots; s++) {
+			struct loop_slot* slot = &lp->slots[s];
+			char* start = out;
+			for (const char* c = slot->text; *c != '\0'; ) {
+				size_t run = strcspn(c, marks);
+				memcpy(out, c, run);
+				out += run;
+				c += run;
+				if (*c == SLOT_MARK) {
+					memcpy(out, value, value_len);
+					out += value_len;
+					c++;
+				}
+			}
+			*out++ = '\0';
+
+			struct command* cmd = &pl->cmds[slot->cmd];
+			if (slot->arg >= 0) {
+				cmd->argv[slot->arg] = start;
+			} else if (slot->arg == LOOP_SLOT_IN) {
+				cmd->i_file = start;
+			} else if (slot->arg == LOOP_SLOT_OUT) {
+				cmd->o_file = start;
+			} else {
+				cmd->here = start;
+				cmd->here_len = out - start - 1;
+			}
+		}
+	}
+
+	for (int c = 0; c < pl->n_cmds; c++) {
+		pl->cmds[c].cmd = pl->cmds[c].argv[0];
+	}
+	return 0;
+}
@@ -0,0 +1,86 @@
+#ifndef PARSE_H
+#define PARSE_H
+
+#include <stdbool.h>
+
+#include "arena.h"
+
+// Macro for the maximum file name length
+#define FILE_NAME_MAX 255
+// The size of the buffer built into each pipeline struct; a typical command line parses without any other allocation
+#define PIPELINE_ARENA_SIZE 4096
+
+// struct command
+// Holds command data; every string points into the arena of the command's pipeline
+struct command {
+	char* cmd;                  // The command itself
+	int argc;                   // The number of arguments (counting the command)
+	char** argv;                // The arguments (including the command), followed by NULL
+	int argv_cap;               // The number of slots in argv
+	char* i_file, * o_file;     // The input and output files for I/O redirection
+	char* here;                 // The text a here-document or here-string feeds to stdin instead, or NULL
+	size_t here_len;            // The length of the text
+	bool background;            // Whether the command should be a background process
+};
+
+// The arg of a loop slot that is a command's input file, output file, or here-document text
+#define LOOP_SLOT_IN -1
+#define LOOP_SLOT_OUT -2
+#define LOOP_SLOT_HERE -3
+
+// struct loop_slot
+// A string in a loop's body that refers to the loop variable
+struct loop_slot {
+	int cmd;                    // The index of the command it belongs to
+	int arg;                    // The index of the argument, or one of LOOP_SLOT_IN, LOOP_SLOT_OUT, and LOOP_SLOT_HERE
+	const char* text;           // The string as parsed, with a marker where each reference was
+};
+
+// struct loop
+// A for or repeat loop around a pipeline, whose commands are the loop's body; the body is parsed once,
+// and each iteration only fills the loop variable's value into the strings that refer to it
+struct loop {
+	const char* keyword;        // "for" or "repeat"
+	int jobs;                   // The most iterations run at once (-j N), or 0 to run them one by one at the prompt
+	unsigned long n_iters;      // The number of iterations
+	char** items;               // The loop variable's value in each iteration, or NULL for repeat
+	struct command* body;       // The commands as parsed, copied back before each iteration
+	struct loop_slot* slots;    // The strings that refer to the loop variable
+	int n_slots;
+	size_t slot_bytes;          // The room the strings take filled in, less the value's, with their nulls
+	size_t n_marks;             // The number of references to the loop variable in the strings
+	char* scratch;              // The heap buffer the filled-in strings are written to, reused by every iteration
+	size_t scratch_cap;
+};
+
+// struct pipeline
+// Holds a list of commands connected by pipes (a single command is a one-stage pipeline)
+struct pipeline {
+	int n_cmds;                 // The number of commands (stages)
+	struct command* cmds;       // The commands, from the first stage to the last
+	bool background;            // Whether the pipeline should run in the background
+	struct loop* loop;          // The loop the pipeline is the body of, or NULL
+	struct arena arena;         // The arena holding the commands, their arguments, and the lexed text of the line
+	char arena_buf[PIPELINE_ARENA_SIZE];    // The arena's first block
+};
+
+// struct subst_hooks
+// How the parser runs the command line of a $(...) substitution; the shell provides these
+struct subst_hooks {
+	int (*start)(const char* line, void** job);     // Launches the line with its stdout on a pipe; returns the read end, or -1
+	int (*finish)(void* job);                       // Waits for a launched line; returns its wait status
+};
+
+// Reads the next line of a here-document's body for the parser (the shell provides it); sets *line to the
+// line without its newline and returns 1, or returns 0 at the end of the input, or -1 to abandon the command line
+typedef int (*heredoc_read_fn)(const char** line);
+
+void free_pipeline(struct pipeline* pl);
+void print_command(struct command* cmd);
+void parse_init(void);
+void parse_set_subst_hooks(const struct subst_hooks* hooks);
+void parse_set_heredoc_reader(heredoc_read_fn read_line);
+struct pipeline* parse_pipeline(const char* line);
+int parse_loop_iteration(struct pipeline* pl, unsigned long i);
+
+#endif
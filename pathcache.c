@@ -0,0 +1,256 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "pathcache.h"
+#include "vars.h"
+
+// The number of buckets the cache starts with (always a power of two)
+#define PATHCACHE_MIN_BUCKETS 64
+
+// struct path_entry
+// A cached command, chained with the other entries in its bucket
+struct path_entry {
+	char* name;                 // The command name as typed
+	char* path;                 // The absolute path it resolved to
+	unsigned long hits;         // The number of launches served from the cache
+	struct path_entry* next;    // The next entry in the bucket
+};
+
+static struct path_entry** buckets = NULL;
+static int n_buckets = 0;
+static int n_entries = 0;
+
+// The value of PATH the cached entries were resolved against, and the variable store's generation when it was checked
+static char* cached_path_var = NULL;
+static unsigned long checked_generation = 0;
+
+// Counters for the hash builtin
+static unsigned long n_hits = 0, n_misses = 0;
+
+// hash_name
+// Hashes a command name (FNV-1a)
+// Parameters: the name
+// Returns: the hash
+static unsigned int hash_name(const char* name) {
+	unsigned int h = 2166136261u;
+	for (const unsigned char* c = (const unsigned char*) name; *c != '\0'; c++) {
+		h = (h ^ *c) * 16777619u;
+	}
+	return h;
+}
+
+// is_executable
+// Checks whether a path names an executable regular file, as execve() requires
+// Parameters: the path
+// Returns: 1 if so, 0 otherwise
+static int is_executable(const char* path) {
+	struct stat st;
+	return access(path, X_OK) == 0 && stat(path, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+// search_path
+// Searches the directories in PATH for a command, the same way execvp() does
+// Parameters: name, the command name; path_var, the value of PATH
+// Returns: a heap copy of the first matching path, or NULL if the command was not found (or memory ran out)
+static char* search_path(const char* name, const char* path_var) {
+	size_t name_len = strlen(name);
+	const char* dir = path_var;
+	while (true) {
+		// Each directory runs up to the next colon; an empty directory means the current one
+		const char* end = strchrnul(dir, ':');
+		size_t dir_len = end - dir;
+		char* candidate = (char*) malloc(dir_len + name_len + 3);
+		if (candidate == NULL) return NULL;
+		if (dir_len == 0) {
+			snprintf(candidate, name_len + 3, "./%s", name);
+		} else {
+			memcpy(candidate, dir, dir_len);
+			candidate[dir_len] = '/';
+			memcpy(candidate + dir_len + 1, name, name_len + 1);
+		}
+
+		if (is_executable(candidate)) return candidate;
+		free(candidate);
+
+		if (*end == '\0') return NULL;
+		dir = end + 1;
+	}
+}
+
+// grow_buckets
+// Doubles the number of buckets and redistributes the entries
+// Parameters: none
+// Returns: none
+static void grow_buckets(void) {
+	int new_n = (n_buckets == 0) ? PATHCACHE_MIN_BUCKETS : n_buckets * 2;
+	struct path_entry** new_buckets = (struct path_entry**) calloc(new_n, sizeof(struct path_entry*));
+	if (new_buckets == NULL) return;
+
+	for (int i = 0; i < n_buckets; i++) {
+		struct path_entry* entry = buckets[i];
+		while (entry != NULL) {
+			struct path_entry* next = entry->next;
+			unsigned int b = hash_name(entry->name) & (new_n - 1);
+			entry->next = new_buckets[b];
+			new_buckets[b] = entry;
+			entry = next;
+		}
+	}
+	free(buckets);
+	buckets = new_buckets;
+	n_buckets = new_n;
+}
+
+// check_path_var
+// Empties the cache if PATH has changed since the entries were resolved; PATH is only compared again
+// once some variable has been set or unset
+// Parameters: none
+// Returns: the current value of PATH
+static const char* check_path_var(void) {
+	if (cached_path_var != NULL && checked_generation == vars_generation()) return cached_path_var;
+	checked_generation = vars_generation();
+
+	const char* path_var = vars_get("PATH");
+	// execvp() falls back to this search path when PATH is unset
+	if (path_var == NULL) path_var = "/bin:/usr/bin";
+
+	if (cached_path_var == NULL || strcmp(cached_path_var, path_var) != 0) {
+		pathcache_clear();
+		free(cached_path_var);
+		cached_path_var = strdup(path_var);
+	}
+	return path_var;
+}
+
+// find_entry
+// Finds a command's entry in the cache
+// Parameters: name, the command name; link, a pointer to receive the link that points to the entry (may be NULL)
+// Returns: the entry, or NULL if the name is not cached
+static struct path_entry* find_entry(const char* name, struct path_entry*** link) {
+	if (n_buckets == 0) return NULL;
+	struct path_entry** l = &buckets[hash_name(name) & (n_buckets - 1)];
+	while (*l != NULL && strcmp((*l)->name, name) != 0) l = &(*l)->next;
+	if (link != NULL) *link = l;
+	return *l;
+}
+
+// add_entry
+// Resolves a command in PATH and adds it to the cache
+// Parameters: name, the command name; path_var, the value of PATH
+// Returns: the new entry, or NULL if the command was not found or couldn't be cached
+static struct path_entry* add_entry(const char* name, const char* path_var) {
+	char* path = search_path(name, path_var);
+	if (path == NULL) return NULL;
+
+	// Keep chains short by growing once there are as many entries as buckets
+	if (n_entries + 1 > n_buckets) grow_buckets();
+	if (n_buckets == 0) {
+		free(path);
+		return NULL;
+	}
+
+	struct path_entry* entry = (struct path_entry*) malloc(sizeof(struct path_entry));
+	char* name_copy = strdup(name);
+	if (entry == NULL || name_copy == NULL) {
+		free(entry);
+		free(name_copy);
+		free(path);
+		return NULL;
+	}
+	entry->name = name_copy;
+	entry->path = path;
+	entry->hits = 0;
+	unsigned int b = hash_name(name) & (n_buckets - 1);
+	entry->next = buckets[b];
+	buckets[b] = entry;
+	n_entries++;
+	return entry;
+}
+
+// free_entry
+// Frees a cache entry
+// Parameters: the entry
+// Returns: none
+static void free_entry(struct path_entry* entry) {
+	free(entry->name);
+	free(entry->path);
+	free(entry);
+}
+
+// pathcache_lookup
+// Finds the absolute path to launch a command from, searching PATH only if the command is not cached
+// or its cached file no longer exists
+// Parameters: the command name
+// Returns: the path (owned by the cache, valid until the next cache call), or NULL if the name contains
+//          a slash (it is launched as given) or the command was not found
+const char* pathcache_lookup(const char* name) {
+	if (strchr(name, '/') != NULL || name[0] == '\0') return NULL;
+	const char* path_var = check_path_var();
+
+	struct path_entry** link;
+	struct path_entry* entry = find_entry(name, &link);
+	if (entry != NULL) {
+		if (is_executable(entry->path)) {
+			n_hits++;
+			entry->hits++;
+			return entry->path;
+		}
+		// The cached file was removed or replaced; forget it and search again
+		*link = entry->next;
+		free_entry(entry);
+		n_entries--;
+	}
+
+	n_misses++;
+	entry = add_entry(name, path_var);
+	return (entry != NULL) ? entry->path : NULL;
+}
+
+// pathcache_warm
+// Resolves a command and caches it without launching it (for "hash name")
+// Parameters: the command name
+// Returns: 0 if the command was found, -1 otherwise
+int pathcache_warm(const char* name) {
+	if (strchr(name, '/') != NULL) return -1;
+	const char* path_var = check_path_var();
+	if (find_entry(name, NULL) != NULL) return 0;
+	return (add_entry(name, path_var) != NULL) ? 0 : -1;
+}
+
+// pathcache_clear
+// Forgets every cached command (for "hash -r")
+// Parameters: none
+// Returns: none
+void pathcache_clear(void) {
+	for (int i = 0; i < n_buckets; i++) {
+		struct path_entry* entry = buckets[i];
+		while (entry != NULL) {
+			struct path_entry* next = entry->next;
+			free_entry(entry);
+			entry = next;
+		}
+		buckets[i] = NULL;
+	}
+	n_entries = 0;
+}
+
+// pathcache_print
+// Lists the cached commands with their hit counts, followed by the cache's hit and miss counters
+// Parameters: none
+// Returns: none
+void pathcache_print(void) {
+	if (n_entries > 0) printf("hits\tcommand\n");
+	for (int i = 0; i < n_buckets; i++) {
+		for (struct path_entry* entry = buckets[i]; entry != NULL; entry = entry->next) {
+			printf("%4lu\t%s\n", entry->hits, entry->path);
+		}
+	}
+	printf("%d cached, %lu hits, %lu misses\n", n_entries, n_hits, n_misses);
+	fflush(stdout);
+}
@@ -0,0 +1,13 @@
+#ifndef PATHCACHE_H
+#define PATHCACHE_H
+
+// The path cache remembers where each command name was found in PATH, so a command is
+// searched for once instead of on every launch. It is emptied whenever PATH changes, which it
+// only checks for after a variable has been set or unset.
+
+const char* pathcache_lookup(const char* name);
+int pathcache_warm(const char* name);
+void pathcache_clear(void);
+void pathcache_print(void);
+
+#endif
@@ -0,0 +1,268 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <limits.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "pathindex.h"
+#include "vars.h"
+
+// Each name carries a bit for every PATH directory it is an executable in, and one for being a builtin;
+// directories after the first 63 in PATH are not indexed
+#define PATHINDEX_MAX_DIRS 63
+#define BUILTIN_BIT (1ull << PATHINDEX_MAX_DIRS)
+
+// The changes to a directory that can add or remove an executable, or the directory itself
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+// struct index_dir
+// A directory of PATH
+struct index_dir {
+	char* path;
+	int wd;                     // Its inotify watch, or -1 if it can't be watched (or is gone)
+};
+
+static struct index_dir dirs[PATHINDEX_MAX_DIRS];
+static int n_dirs = 0;
+static int inotify_fd = -1;
+
+// The names in sorted order, and the bits saying where each one comes from
+static char** names = NULL;
+static uint64_t* sources = NULL;
+static size_t n_names = 0, names_cap = 0;
+
+// The PATH the index was built for, and the variable store's generation it was last compared at
+static char* indexed_path = NULL;
+static unsigned long checked_generation = 0;
+static bool built = false;
+
+// lower_bound
+// Finds where a name is, or would be inserted, in the sorted names
+// Parameters: name, the name; len, the number of bytes to compare (including the null for an exact name)
+// Returns: the index of the first name not less than the given one
+static size_t lower_bound(const char* name, size_t len) {
+	size_t lo = 0, hi = n_names;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (strncmp(names[mid], name, len) < 0) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+// remove_at
+// Removes a name from the index
+// Parameters: the name's index
+// Returns: none
+static void remove_at(size_t i) {
+	free(names[i]);
+	memmove(names + i, names + i + 1, sizeof(char*) * (n_names - i - 1));
+	memmove(sources + i, sources + i + 1, sizeof(uint64_t) * (n_names - i - 1));
+	n_names--;
+}
+
+// set_source
+// Records whether a name comes from a source, adding it to the index or removing it as needed
+// Parameters: name, the name; bit, the source's bit; present, whether the name comes from the source
+// Returns: none
+static void set_source(const char* name, uint64_t bit, bool present) {
+	size_t len = strlen(name);
+	size_t i = lower_bound(name, len + 1);
+	bool found = (i < n_names && strcmp(names[i], name) == 0);
+	if (found) {
+		if (present) sources[i] |= bit;
+		else sources[i] &= ~bit;
+		if (sources[i] == 0) remove_at(i);
+		return;
+	}
+	if (!present) return;
+
+	if (n_names == names_cap) {
+		size_t cap = (names_cap == 0) ? 1024 : names_cap * 2;
+		char** new_names = (char**) realloc(names, sizeof(char*) * cap);
+		if (new_names == NULL) return;
+		names = new_names;
+		uint64_t* new_sources = (uint64_t*) realloc(sources, sizeof(uint64_t) * cap);
+		if (new_sources == NULL) return;
+		sources = new_sources;
+		names_cap = cap;
+	}
+	char* copy = strdup(name);
+	if (copy == NULL) return;
+	memmove(names + i + 1, names + i, sizeof(char*) * (n_names - i));
+	memmove(sources + i + 1, sources + i, sizeof(uint64_t) * (n_names - i));
+	names[i] = copy;
+	sources[i] = bit;
+	n_names++;
+}
+
+// clear_sources
+// Drops a set of sources from every name, removing the names that no longer come from anywhere
+// Parameters: the bits of the sources
+// Returns: none
+static void clear_sources(uint64_t bits) {
+	size_t kept = 0;
+	for (size_t i = 0; i < n_names; i++) {
+		sources[i] &= ~bits;
+		if (sources[i] == 0) {
+			free(names[i]);
+			continue;
+		}
+		names[kept] = names[i];
+		sources[kept++] = sources[i];
+	}
+	n_names = kept;
+}
+
+// is_executable
+// Checks whether a directory entry is a command, as the path cache would find it; the entry is found by path,
+// since holding the directory open would keep inotify from reporting its removal
+// Parameters: dir, the directory's path; name, the entry's name
+// Returns: true if it is an executable regular file (or a link to one)
+static bool is_executable(const char* dir, const char* name) {
+	char path[PATH_MAX];
+	struct stat st;
+	if (snprintf(path, sizeof(path), "%s/%s", dir, name) >= (int) sizeof(path)) return false;
+	return access(path, X_OK) == 0 && stat(path, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+// scan_dir
+// Adds every executable in a PATH directory to the index
+// Parameters: the directory's index in dirs
+// Returns: none
+static void scan_dir(int d) {
+	DIR* dir = opendir(dirs[d].path);
+	if (dir == NULL) return;
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (entry->d_name[0] == '.' && (entry->d_name[1] == '\0' || (entry->d_name[1] == '.' && entry->d_name[2] == '\0'))) continue;
+		if (is_executable(dirs[d].path, entry->d_name)) set_source(entry->d_name, 1ull << d, true);
+	}
+	closedir(dir);
+}
+
+// build
+// Scans the directories of PATH into the index, watching each one before it is scanned so no change is missed
+// Parameters: none
+// Returns: none
+static void build(void) {
+	built = true;
+	clear_sources(~BUILTIN_BIT);
+	for (int d = 0; d < n_dirs; d++) free(dirs[d].path);
+	n_dirs = 0;
+	if (inotify_fd != -1) close(inotify_fd);
+	inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+	const char* path = vars_get("PATH");
+	free(indexed_path);
+	indexed_path = (path != NULL) ? strdup(path) : NULL;
+	checked_generation = vars_generation();
+	if (path == NULL) return;
+
+	// An empty entry in PATH is the working directory
+	const char* p = path;
+	while (n_dirs < PATHINDEX_MAX_DIRS) {
+		size_t len = strcspn(p, ":");
+		char* dir = (len == 0) ? strdup(".") : strndup(p, len);
+		if (dir == NULL) break;
+		dirs[n_dirs].path = dir;
+		dirs[n_dirs].wd = (inotify_fd != -1) ? inotify_add_watch(inotify_fd, dir, WATCH_MASK) : -1;
+		scan_dir(n_dirs++);
+		if (p[len] == '\0') break;
+		p += len + 1;
+	}
+}
+
+// apply_changes
+// Applies the changes inotify has queued to the index; a directory listed in PATH twice shares one watch
+// Parameters: none
+// Returns: none
+static void apply_changes(void) {
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t n;
+	while (inotify_fd != -1 && (n = read(inotify_fd, buf, sizeof(buf))) > 0) {
+		for (char* c = buf; c < buf + n; ) {
+			const struct inotify_event* ev = (const struct inotify_event*) c;
+			c += sizeof(struct inotify_event) + ev->len;
+
+			// Changes were lost; only a rescan can tell what the directories hold now
+			if (ev->mask & IN_Q_OVERFLOW) {
+				build();
+				return;
+			}
+			for (int d = 0; d < n_dirs; d++) {
+				if (dirs[d].wd != ev->wd) continue;
+				if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+					// The directory itself is gone; its commands go with it, and a directory moved away
+					// stops being watched so that one made at its path can be watched in its place
+					clear_sources(1ull << d);
+					if (ev->mask & IN_MOVE_SELF) inotify_rm_watch(inotify_fd, ev->wd);
+					if (ev->mask & (IN_MOVE_SELF | IN_IGNORED)) dirs[d].wd = -1;
+				} else if (ev->len > 0) {
+					// Whatever happened to the entry, it is a command if it is an executable now
+					set_source(ev->name, 1ull << d, is_executable(dirs[d].path, ev->name));
+				}
+			}
+		}
+	}
+}
+
+// rewatch_dirs
+// Watches and scans the PATH directories that aren't watched, picking up those made (or made again) since;
+// a directory is watched before it is scanned so no change is missed
+// Parameters: none
+// Returns: none
+static void rewatch_dirs(void) {
+	if (inotify_fd == -1) return;
+	for (int d = 0; d < n_dirs; d++) {
+		if (dirs[d].wd != -1) continue;
+		dirs[d].wd = inotify_add_watch(inotify_fd, dirs[d].path, WATCH_MASK);
+		if (dirs[d].wd != -1) scan_dir(d);
+	}
+}
+
+// pathindex_add_builtin
+// Adds a builtin to the names that complete
+// Parameters: the builtin's name
+// Returns: none
+void pathindex_add_builtin(const char* name) {
+	set_source(name, BUILTIN_BIT, true);
+}
+
+// pathindex_refresh
+// Builds the index if it hasn't been built or PATH has changed, applies the changes queued since the last refresh,
+// and picks up the PATH directories that have appeared
+// Parameters: none
+// Returns: none
+void pathindex_refresh(void) {
+	if (built && checked_generation != vars_generation()) {
+		// Only a different PATH needs a rebuild, not every change to a variable
+		const char* path = vars_get("PATH");
+		checked_generation = vars_generation();
+		if ((path == NULL) != (indexed_path == NULL) || (path != NULL && strcmp(path, indexed_path) != 0)) built = false;
+	}
+	if (!built) build();
+	apply_changes();
+	rewatch_dirs();
+}
+
+// pathindex_find
+// Finds the names that start with a prefix, after bringing the index up to date
+// Parameters: prefix, the prefix; len, its length; first, a pointer to receive the first matching name
+// Returns: the number of matching names, which follow the first in sorted order (valid until the next call)
+size_t pathindex_find(const char* prefix, size_t len, char*** first) {
+	pathindex_refresh();
+	size_t i = lower_bound(prefix, len);
+	size_t end = i;
+	while (end < n_names && strncmp(names[end], prefix, len) == 0) end++;
+	*first = names + i;
+	return end - i;
+}
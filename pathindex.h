@@ -0,0 +1,18 @@
+#ifndef PATHINDEX_H
+#define PATHINDEX_H
+
+#include <stddef.h>
+
+// The path index lists every command name that completes at the prompt: the executables in the
+// directories of PATH and the shell's builtins, sorted so the names with a given prefix sit side
+// by side. The directories are scanned once, when the index is first needed, and watched with
+// inotify from then on; each lookup applies the changes the kernel queued since the last one, so
+// completing a name never rescans a directory. A directory that is missing, or goes away, is
+// watched and scanned once it exists again. The index is rebuilt when PATH changes or the
+// kernel's queue of changes overflows.
+
+void pathindex_add_builtin(const char* name);
+void pathindex_refresh(void);
+size_t pathindex_find(const char* prefix, size_t len, char*** first);
+
+#endif
@@ -0,0 +1,145 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "deadline.h"
+#include "pump.h"
+
+// The most bytes moved by one splice() call (the default capacity of a pipe)
+#define PUMP_CHUNK 65536
+
+bool splice_mode = false;
+
+// is_pipe
+// Checks whether a descriptor refers to a pipe (the side of a pump that can be polled)
+// Parameters: the file descriptor
+// Returns: true if the descriptor is a pipe or FIFO, false otherwise
+static bool is_pipe(int fd) {
+	struct stat st;
+	return fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+// pump_init
+// Sets up a pump between two descriptors; the pump takes ownership of both
+// Parameters: p, the pump to set up; src, the descriptor to read from; dst, the descriptor to write to
+// Returns: none
+void pump_init(struct pump* p, int src, int dst) {
+	p->src = src;
+	p->dst = dst;
+	p->done = false;
+}
+
+// pump_finish
+// Marks a pump as done and closes its descriptors, so the pipe's other end sees EOF or EPIPE
+// Parameters: the pump
+// Returns: none
+static void pump_finish(struct pump* p) {
+	close(p->src);
+	close(p->dst);
+	p->done = true;
+}
+
+// pump_copy
+// Moves one chunk through a user-space buffer; used when splice() does not support the file (such as a terminal)
+// Parameters: the pump
+// Returns: the bytes moved, 0 at the end of the stream, or -1 with errno set
+static ssize_t pump_copy(struct pump* p) {
+	static char buffer[PUMP_CHUNK];
+	ssize_t n = read(p->src, buffer, sizeof(buffer));
+	if (n <= 0) return n;
+	// Write the whole chunk; the destination may still be non-blocking, so wait for it as needed
+	for (ssize_t off = 0; off < n; ) {
+		ssize_t w = write(p->dst, buffer + off, n - off);
+		if (w == -1) {
+			if (errno == EINTR) continue;
+			if (errno != EAGAIN) return -1;
+			struct pollfd pfd = { p->dst, POLLOUT, 0 };
+			poll(&pfd, 1, -1);
+			continue;
+		}
+		off += w;
+	}
+	return n;
+}
+
+// pump_run
+// Moves the data of every pump with splice() until all of their streams end,
+// sleeping in poll() on the pipe ends whenever no pump can make progress
+// Parameters: pumps, an array of pumps; n, the number of pumps
+// Returns: none
+void pump_run(struct pump* pumps, int n) {
+	if (n == 0) return;
+
+	// A reader exiting early raises SIGPIPE on the next splice(); block it here and discard it afterwards
+	sigset_t pipe_set, old_mask;
+	sigemptyset(&pipe_set);
+	sigaddset(&pipe_set, SIGPIPE);
+	sigprocmask(SIG_BLOCK, &pipe_set, &old_mask);
+
+	// Make the pipe ends non-blocking so a full or empty pipe returns EAGAIN instead of stalling other pumps
+	bool src_pipe[n], dst_pipe[n], use_copy[n];
+	for (int i = 0; i < n; i++) {
+		src_pipe[i] = is_pipe(pumps[i].src);
+		dst_pipe[i] = is_pipe(pumps[i].dst);
+		use_copy[i] = false;
+		if (src_pipe[i]) fcntl(pumps[i].src, F_SETFL, fcntl(pumps[i].src, F_GETFL) | O_NONBLOCK);
+		if (dst_pipe[i]) fcntl(pumps[i].dst, F_SETFL, fcntl(pumps[i].dst, F_GETFL) | O_NONBLOCK);
+	}
+
+	int active = n;
+	while (active > 0) {
+		struct pollfd pfds[2 * n + 1];
+		int n_pfds = 0;
+
+		for (int i = 0; i < n; i++) {
+			struct pump* p = &pumps[i];
+			if (p->done) continue;
+
+			// Move data until the pump would block or its stream ends
+			ssize_t moved;
+			do {
+				if (use_copy[i]) {
+					moved = pump_copy(p);
+				} else {
+					moved = splice(p->src, NULL, p->dst, NULL, PUMP_CHUNK, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+					if (moved == -1 && errno == EINVAL) {
+						// This pair of files cannot be spliced; fall back to copying
+						use_copy[i] = true;
+						moved = 1;
+					}
+				}
+			} while (moved > 0 || (moved == -1 && errno == EINTR));
+
+			if (moved == -1 && errno == EAGAIN) {
+				// Wait for the pipe side to become ready
+				if (src_pipe[i]) pfds[n_pfds++] = (struct pollfd) { p->src, POLLIN, 0 };
+				if (dst_pipe[i]) pfds[n_pfds++] = (struct pollfd) { p->dst, POLLOUT, 0 };
+			} else {
+				// The stream ended (0), the reader went away (EPIPE), or an error occurred
+				if (moved == -1 && errno != EPIPE) perror("splice");
+				pump_finish(p);
+				active--;
+			}
+		}
+
+		// A deadline expiring meanwhile is acted on, so a stage that never closes its pipe can still be stopped
+		if (n_pfds > 0) {
+			int timer = (deadline_count() > 0) ? n_pfds++ : -1;
+			if (timer != -1) pfds[timer] = (struct pollfd) { deadline_timer_fd(), POLLIN, 0 };
+			if (poll(pfds, n_pfds, -1) > 0 && timer != -1 && (pfds[timer].revents & POLLIN)) deadline_expire();
+		}
+	}
+
+	// Discard any SIGPIPE raised by a reader that exited early
+	struct timespec no_wait = { 0, 0 };
+	while (sigtimedwait(&pipe_set, NULL, &no_wait) > 0);
+	sigprocmask(SIG_SETMASK, &old_mask, NULL);
+}
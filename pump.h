@@ -0,0 +1,20 @@
+#ifndef PUMP_H
+#define PUMP_H
+
+#include <stdbool.h>
+
+// struct pump
+// A one-way stream the shell moves with splice(), between a redirect file and a pipeline's pipe
+struct pump {
+	int src;        // The descriptor data is read from (a file or the read end of a pipe)
+	int dst;        // The descriptor data is written to (the write end of a pipe or a file)
+	bool done;      // Whether the stream has ended; both descriptors are closed once it has
+};
+
+// Whether pipelines should route their redirect files through splice() pumps in the shell
+extern bool splice_mode;
+
+void pump_init(struct pump* p, int src, int dst);
+void pump_run(struct pump* pumps, int n);
+
+#endif
@@ -0,0 +1,474 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "server.h"
+#include "events.h"
+#include "jobs.h"
+#include "launch.h"
+#include "parse.h"
+
+// The number of pending connections the kernel queues before accept()
+#define SERVER_BACKLOG 128
+// The starting capacity of a client's line buffer
+#define CLIENT_BUF_MIN 256
+
+// The epoll ids of the listening socket and the signalfd; a client's id is its slot index plus CLIENT_ID_BASE
+#define LISTEN_ID 0
+#define SIGNAL_ID 1
+#define CLIENT_ID_BASE 2
+
+// struct client
+// A connected client and the pipeline it is running
+struct client {
+	int fd;                     // The connection
+	int std_fds[3];             // The client's stdin, stdout, and stderr, or -1 until they are received
+	char* buf;                  // The bytes received that have not been run yet
+	size_t len, cap;
+	bool hung_up;               // Whether the client has closed its end
+	int n_running;              // The number of stages of its pipeline still running
+	pid_t last_pid;             // The pid of the pipeline's last stage, whose status is the line's status
+	int status;                 // The status of the last stage
+};
+
+// The clients, by slot; a slot's index plus one is the job tag of its pipeline's stages
+static struct client** clients = NULL;
+static int n_slots = 0;
+
+static int epoll_fd = -1;
+static int n_running_jobs = 0;      // The number of clients with a pipeline running
+static int max_running_jobs = 1;
+static int next_client = 0;         // Where the next scheduling pass starts, so no client is always served last
+static unsigned long n_served = 0, n_connections = 0;
+
+// remove_socket
+// Removes a socket file, leaving anything else at the path alone
+// Parameters: the socket path
+// Returns: 0 if the path is free now, -1 if something other than a socket is there
+static int remove_socket(const char* path) {
+	struct stat st;
+	if (lstat(path, &st) == -1) return (errno == ENOENT) ? 0 : -1;
+	if (!S_ISSOCK(st.st_mode)) {
+		errno = EEXIST;
+		return -1;
+	}
+	return (unlink(path) == -1 && errno != ENOENT) ? -1 : 0;
+}
+
+// listen_on
+// Creates a listening Unix-domain socket at a path, replacing a stale socket file; the socket is only
+// accessible to the shell's owner, since whoever connects runs commands as them
+// Parameters: the socket path
+// Returns: the socket, or -1 on failure
+static int listen_on(const char* path) {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "smallsh: socket path too long: %s\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd == -1) {
+		perror("socket");
+		return -1;
+	}
+	if (remove_socket(path) == -1) {
+		if (errno == EEXIST) fprintf(stderr, "smallsh: %s exists and is not a socket\n", path);
+		else perror(path);
+		close(fd);
+		return -1;
+	}
+
+	// The socket file takes its mode from the umask, so narrow it while the file is created
+	mode_t old_mask = umask(0177);
+	int bound = bind(fd, (struct sockaddr*) &addr, sizeof(addr));
+	umask(old_mask);
+	if (bound == -1 || listen(fd, SERVER_BACKLOG) == -1) {
+		perror(path);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// add_client
+// Registers a new connection in a free slot and in the epoll set
+// Parameters: the connection
+// Returns: none
+static void add_client(int fd) {
+	int slot = 0;
+	while (slot < n_slots && clients[slot] != NULL) slot++;
+	if (slot == n_slots) {
+		int new_slots = (n_slots == 0) ? 16 : n_slots * 2;
+		struct client** new_clients = (struct client**) realloc(clients, sizeof(struct client*) * new_slots);
+		if (new_clients == NULL) {
+			close(fd);
+			return;
+		}
+		memset(new_clients + n_slots, 0, sizeof(struct client*) * (new_slots - n_slots));
+		clients = new_clients;
+		n_slots = new_slots;
+	}
+
+	struct client* c = (struct client*) calloc(1, sizeof(struct client));
+	if (c == NULL) {
+		close(fd);
+		return;
+	}
+	c->fd = fd;
+	c->std_fds[0] = c->std_fds[1] = c->std_fds[2] = -1;
+
+	struct epoll_event ev = { .events = EPOLLIN, .data.u32 = slot + CLIENT_ID_BASE };
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+		perror("epoll_ctl");
+		close(fd);
+		free(c);
+		return;
+	}
+	clients[slot] = c;
+	n_connections++;
+}
+
+// free_client
+// Closes a client's connection and descriptors and frees its slot
+// Parameters: the client's slot
+// Returns: none
+static void free_client(int slot) {
+	struct client* c = clients[slot];
+	close(c->fd);
+	for (int i = 0; i < 3; i++) {
+		if (c->std_fds[i] != -1) close(c->std_fds[i]);
+	}
+	free(c->buf);
+	free(c);
+	clients[slot] = NULL;
+}
+
+// receive_fds
+// Receives the client's stdin, stdout, and stderr, which ride on the first byte it sends
+// Parameters: the client
+// Returns: 1 if they were received, 0 if they have not arrived yet, -1 if the client sent something else or hung up
+static int receive_fds(struct client* c) {
+	char byte;
+	struct iovec iov = { .iov_base = &byte, .iov_len = 1 };
+	union {
+		char buf[CMSG_SPACE(sizeof(int) * 3)];
+		struct cmsghdr align;
+	} control;
+	struct msghdr msg = {
+		.msg_iov = &iov, .msg_iovlen = 1,
+		.msg_control = control.buf, .msg_controllen = sizeof(control.buf)
+	};
+
+	ssize_t n = recvmsg(c->fd, &msg, MSG_CMSG_CLOEXEC);
+	if (n == -1 && (errno == EAGAIN || errno == EINTR)) return 0;
+	if (n <= 0) return -1;
+
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+	    cmsg->cmsg_len != CMSG_LEN(sizeof(int) * 3)) {
+		return -1;
+	}
+	memcpy(c->std_fds, CMSG_DATA(cmsg), sizeof(int) * 3);
+	return 1;
+}
+
+// read_client
+// Reads everything a client has sent into its line buffer
+// Parameters: the client
+// Returns: 0 if successful, -1 if the client broke the protocol
+static int read_client(struct client* c) {
+	if (c->std_fds[0] == -1) {
+		int got = receive_fds(c);
+		if (got == -1) return -1;
+		if (got == 0) return 0;
+	}
+
+	while (true) {
+		if (c->cap - c->len < CLIENT_BUF_MIN) {
+			size_t new_cap = (c->cap == 0) ? CLIENT_BUF_MIN * 4 : c->cap * 2;
+			char* new_buf = (char*) realloc(c->buf, new_cap);
+			if (new_buf == NULL) return -1;
+			c->buf = new_buf;
+			c->cap = new_cap;
+		}
+		ssize_t n = read(c->fd, c->buf + c->len, c->cap - c->len);
+		if (n > 0) {
+			c->len += n;
+		} else if (n == 0) {
+			c->hung_up = true;
+			return 0;
+		} else if (errno == EAGAIN) {
+			return 0;
+		} else if (errno != EINTR) {
+			return -1;
+		}
+	}
+}
+
+// reply
+// Sends a line's status to its client
+// Parameters: the client; the status set by wait4()
+// Returns: none
+static void reply(struct client* c, int status) {
+	char msg[32];
+	int len = WIFSIGNALED(status) ? sprintf(msg, "signal %d\n", WTERMSIG(status))
+	                              : sprintf(msg, "exit %d\n", WEXITSTATUS(status));
+	// A client that has gone away just misses its answer
+	send(c->fd, msg, len, MSG_NOSIGNAL);
+}
+
+// start_next
+// Runs the client's next complete line, answering empty lines and lines that can't be run at once
+// Parameters: the client's slot
+// Returns: true if a pipeline was started, false otherwise
+static bool start_next(int slot) {
+	struct client* c = clients[slot];
+	while (c->n_running == 0 && c->std_fds[0] != -1) {
+		char* nl = (char*) memchr(c->buf, '\n', c->len);
+		if (nl == NULL) return false;
+		*nl = '\0';
+
+		// Parse the line the same way the shell parses its input
+		struct pipeline* pl = NULL;
+		char first = c->buf[strspn(c->buf, " \t")];
+		bool blank = (first == '\0' || first == '#');
+		if (!blank) pl = parse_pipeline(c->buf);
+
+		// Drop the line from the buffer; the pipeline holds its own copies of the words
+		size_t used = nl + 1 - c->buf;
+		memmove(c->buf, nl + 1, c->len - used);
+		c->len -= used;
+
+		if (pl == NULL) {
+			// An empty line succeeds; a line that doesn't parse fails like a shell syntax error
+			reply(c, W_EXITCODE(blank ? 0 : 2, 0));
+			continue;
+		}
+		// Loops run their iterations from the shell's own command loop, which the server doesn't have
+		if (pl->loop != NULL) {
+			dprintf(c->std_fds[2], "smallsh: %s loops are not available to --serve clients\n", pl->loop->keyword);
+			free_pipeline(pl);
+			reply(c, W_EXITCODE(2, 0));
+			continue;
+		}
+
+		// The stages must not get SIGINT from the server's terminal: that stops the server
+		for (int i = 0; i < pl->n_cmds; i++) {
+			pl->cmds[i].background = true;
+		}
+
+		pid_t pids[pl->n_cmds];
+		int n_pumps;
+		struct timespec start;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		launch_pipeline(pl, pids, NULL, &n_pumps, c->std_fds, NULL);
+		c->last_pid = pids[pl->n_cmds - 1];
+		c->status = W_EXITCODE(EXIT_FAILURE, 0);
+		for (int i = 0; i < pl->n_cmds; i++) {
+			if (pids[i] != -1 && jobs_add(pids[i], slot + 1, &start) == 0) c->n_running++;
+		}
+		free_pipeline(pl);
+
+		// A line with no running stages could not be started at all
+		if (c->n_running == 0) {
+			reply(c, c->status);
+			continue;
+		}
+		n_running_jobs++;
+		return true;
+	}
+	return false;
+}
+
+// schedule
+// Starts lines from waiting clients, round-robin, until the cap on running pipelines is reached, and
+// frees clients that have hung up once their last line has run
+// Parameters: none
+// Returns: none
+static void schedule(void) {
+	int first = next_client;
+	for (int k = 0; k < n_slots; k++) {
+		int slot = (first + k) % n_slots;
+		struct client* c = clients[slot];
+		if (c == NULL) continue;
+		if (n_running_jobs < max_running_jobs && start_next(slot)) next_client = (slot + 1) % n_slots;
+		if (c->hung_up && c->n_running == 0 && memchr(c->buf, '\n', c->len) == NULL) free_client(slot);
+	}
+}
+
+// finish_jobs
+// Reaps ended stages and answers every client whose pipeline has ended
+// Parameters: none
+// Returns: none
+static void finish_jobs(void) {
+	jobs_reap();
+	struct job_result res;
+	while (jobs_next_done(&res)) {
+		int slot = res.tag - 1;
+		struct client* c = clients[slot];
+		if (res.pid == c->last_pid) c->status = res.status;
+		if (--c->n_running > 0) continue;
+
+		n_running_jobs--;
+		n_served++;
+		reply(c, c->status);
+	}
+}
+
+// server_run
+// Serves command lines on a Unix-domain socket until SIGINT
+// Parameters: path, the socket path; max_jobs, the most pipelines to run at once
+// Returns: 0 if the server stopped normally, -1 if it could not start
+int server_run(const char* path, int max_jobs) {
+	max_running_jobs = max_jobs;
+
+	int listen_fd = listen_on(path);
+	if (listen_fd == -1) return -1;
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	struct epoll_event ev = { .events = EPOLLIN, .data.u32 = LISTEN_ID };
+	if (epoll_fd == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) == -1) {
+		perror("epoll");
+		close(listen_fd);
+		remove_socket(path);
+		return -1;
+	}
+	ev.data.u32 = SIGNAL_ID;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, events_signal_fd(), &ev);
+	fprintf(stderr, "smallsh: serving on %s (at most %d jobs at once)\n", path, max_jobs);
+
+	bool running = true;
+	while (running) {
+		struct epoll_event ready[64];
+		int n = epoll_wait(epoll_fd, ready, 64, -1);
+		if (n == -1 && errno != EINTR) {
+			perror("epoll_wait");
+			break;
+		}
+
+		for (int i = 0; i < n; i++) {
+			uint32_t id = ready[i].data.u32;
+			if (id == LISTEN_ID) {
+				// Accept every pending connection
+				int fd;
+				while ((fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+					add_client(fd);
+				}
+			} else if (id == SIGNAL_ID) {
+				int events = events_poll();
+				if (events & EV_CHILD) finish_jobs();
+				if (events & EV_INT) running = false;
+			} else {
+				int slot = id - CLIENT_ID_BASE;
+				struct client* c = clients[slot];
+				if (c == NULL) continue;
+				if (read_client(c) == -1) c->hung_up = true;
+				// A client that has hung up stops being watched; it is freed once its lines have run
+				if (c->hung_up) epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+			}
+		}
+		schedule();
+	}
+
+	// Stop the running pipelines and clean up
+	jobs_kill_all(SIGKILL);
+	for (int slot = 0; slot < n_slots; slot++) {
+		if (clients[slot] != NULL) free_client(slot);
+	}
+	free(clients);
+	close(epoll_fd);
+	close(listen_fd);
+	remove_socket(path);
+	fprintf(stderr, "smallsh: served %lu commands to %lu clients\n", n_served, n_connections);
+	return 0;
+}
+
+// client_run
+// Sends command lines to a server and waits for each one's status; the commands' output goes
+// straight to this process's stdout and stderr
+// Parameters: path, the server's socket path; in, the input to read command lines from
+// Returns: the exit code of the last command (128 plus the signal number if it was killed by a signal),
+//          or 1 if the server could not be reached
+int client_run(const char* path, struct input* in) {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "smallsh: socket path too long: %s\n", path);
+		return EXIT_FAILURE;
+	}
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1 || connect(fd, (struct sockaddr*) &addr, sizeof(addr)) == -1) {
+		perror(path);
+		if (fd != -1) close(fd);
+		return EXIT_FAILURE;
+	}
+
+	// Pass stdin, stdout, and stderr to the server along with a single marker byte
+	int std_fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+	char marker = 'F';
+	struct iovec iov = { .iov_base = &marker, .iov_len = 1 };
+	union {
+		char buf[CMSG_SPACE(sizeof(std_fds))];
+		struct cmsghdr align;
+	} control;
+	struct msghdr msg = {
+		.msg_iov = &iov, .msg_iovlen = 1,
+		.msg_control = control.buf, .msg_controllen = sizeof(control.buf)
+	};
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(std_fds));
+	memcpy(CMSG_DATA(cmsg), std_fds, sizeof(std_fds));
+	if (sendmsg(fd, &msg, MSG_NOSIGNAL) == -1) {
+		perror("sendmsg");
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	// Send each line and wait for its status before sending the next
+	FILE* replies = fdopen(fd, "r");
+	char* answer = NULL;
+	size_t answer_cap = 0;
+	int exit_code = EXIT_SUCCESS;
+	while (true) {
+		input_prompt(in);
+		char* line = input_read_line(in);
+		if (line == NULL) break;
+
+		size_t len = strlen(line);
+		line[len] = '\n';
+		ssize_t sent = send(fd, line, len + 1, MSG_NOSIGNAL);
+		line[len] = '\0';
+		if (sent != (ssize_t) len + 1 || getline(&answer, &answer_cap, replies) == -1) {
+			fprintf(stderr, "smallsh: lost the connection to %s\n", path);
+			exit_code = EXIT_FAILURE;
+			break;
+		}
+
+		int value;
+		if (sscanf(answer, "exit %d", &value) == 1) {
+			exit_code = value;
+		} else if (sscanf(answer, "signal %d", &value) == 1) {
+			exit_code = 128 + value;
+		}
+	}
+
+	free(answer);
+	fclose(replies);
+	return exit_code;
+}
@@ -0,0 +1,15 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "input.h"
+
+// A resident shell serving command lines over a Unix-domain stream socket. A client connects,
+// passes its stdin, stdout, and stderr with SCM_RIGHTS, then sends command lines; each line is
+// run as a pipeline wired to the client's descriptors, and the server answers it with one
+// "exit N" or "signal N" line once it ends. Each client's lines run in order, and lines from
+// different clients run concurrently, up to a cap on the number of running pipelines.
+
+int server_run(const char* path, int max_jobs);
+int client_run(const char* path, struct input* in);
+
+#endif
@@ -0,0 +1,193 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+#include "jobsched.h"
+#include "launch_engine.h"
+#include "vars.h"
+
+enum spawn_engine spawn_engine = SPAWN_POSIX;
+
+// The names accepted by spawn_parse_engine(), indexed by engine
+static const char* engine_names[] = { "posix", "vfork", "fork" };
+
+// spawn_parse_engine
+// Looks up a launch engine by name
+// Parameters: name, the engine name ("posix", "vfork", or "fork"); engine, a pointer to receive the engine
+// Returns: 0 if the name is known, -1 otherwise
+int spawn_parse_engine(const char* name, enum spawn_engine* engine) {
+	for (size_t i = 0; i < sizeof(engine_names) / sizeof(engine_names[0]); i++) {
+		if (strcmp(name, engine_names[i]) == 0) {
+			*engine = (enum spawn_engine) i;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+// spawn_engine_name
+// Gets the name of a launch engine
+// Parameters: the engine
+// Returns: the engine's name
+const char* spawn_engine_name(enum spawn_engine engine) {
+	return engine_names[engine];
+}
+
+// child_sigmask
+// Builds the signal mask a child process starts with
+// SIGTSTP is blocked in all children; SIGINT is also blocked in background children
+// Parameters: mask, the signal set to fill; background, whether the child is a background process
+// Returns: none
+static void child_sigmask(sigset_t* mask, bool background) {
+	sigemptyset(mask);
+	sigaddset(mask, SIGTSTP);
+	if (background) sigaddset(mask, SIGINT);
+}
+
+// spawn_posix
+// Launches a child with posix_spawnp(); the redirects are dup2() file actions and the mask is a spawn attribute
+// Parameters: see spawn_process()
+// Returns: the child's pid, or -1 with errno set if the child could not be started
+static pid_t spawn_posix(const char* file, char* const argv[], int in_fd, int out_fd, int err_fd, bool background) {
+	// The spawn attributes only depend on whether the child is a background process, so build each once
+	static posix_spawnattr_t attrs[2];
+	static bool attrs_ready[2] = { false, false };
+	posix_spawnattr_t* attr = &attrs[background];
+	if (!attrs_ready[background]) {
+		sigset_t mask;
+		child_sigmask(&mask, background);
+		posix_spawnattr_init(attr);
+		posix_spawnattr_setsigmask(attr, &mask);
+		posix_spawnattr_setflags(attr, POSIX_SPAWN_SETSIGMASK);
+		attrs_ready[background] = true;
+	}
+
+	// Redirect stdin, stdout, and stderr in the child
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	if (in_fd != -1) posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+	if (out_fd != -1) posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+	if (err_fd != -1) posix_spawn_file_actions_adddup2(&actions, err_fd, STDERR_FILENO);
+
+	// posix_spawnp() returns an error number rather than setting errno
+	pid_t pid;
+	int err = posix_spawnp(&pid, file, &actions, attr, argv, vars_envp());
+	posix_spawn_file_actions_destroy(&actions);
+	if (err != 0) {
+		errno = err;
+		return -1;
+	}
+	return pid;
+}
+
+// spawn_vfork
+// Launches a child with vfork(); the child reports a failed exec() through the shared address space
+// Parameters: see spawn_process()
+// Returns: the child's pid, or -1 with errno set if the child could not be started
+static pid_t spawn_vfork(const char* file, char* const argv[], int in_fd, int out_fd, int err_fd, bool background,
+                         const struct job_sched* sched) {
+	sigset_t mask, all, old;
+	child_sigmask(&mask, background);
+	char** envp = vars_envp();
+
+	// Block every signal across vfork() so no handler can run in the child while it shares the parent's memory
+	sigfillset(&all);
+	sigprocmask(SIG_BLOCK, &all, &old);
+
+	// The child writes its errno here if it fails before exec() replaces it
+	volatile int child_errno = 0;
+	pid_t pid = vfork();
+	if (pid == 0) {
+		// The child process; only async-signal-safe calls from here on
+		sigprocmask(SIG_SETMASK, &mask, NULL);
+		if ((sched == NULL || jobsched_apply(sched) != -1) &&
+		    (in_fd == -1 || dup2(in_fd, STDIN_FILENO) != -1) &&
+		    (out_fd == -1 || dup2(out_fd, STDOUT_FILENO) != -1) &&
+		    (err_fd == -1 || dup2(err_fd, STDERR_FILENO) != -1)) {
+			execvpe(file, argv, envp);
+		}
+		child_errno = errno;
+		_exit(EXIT_FAILURE);
+	}
+
+	// The parent resumes once the child has called exec() or _exit()
+	int err = (pid == -1) ? errno : child_errno;
+	sigprocmask(SIG_SETMASK, &old, NULL);
+	if (pid != -1 && err != 0) {
+		// Reap the child that failed to exec so it doesn't linger as a zombie
+		waitpid(pid, NULL, 0);
+	}
+	if (err != 0) {
+		errno = err;
+		return -1;
+	}
+	return pid;
+}
+
+// spawn_fork
+// Launches a child with fork(); the child reports its own errors, as the shell always has
+// Parameters: see spawn_process()
+// Returns: the child's pid, or -1 with errno set if fork() failed
+static pid_t spawn_fork(const char* file, char* const argv[], int in_fd, int out_fd, int err_fd, bool background,
+                        const struct job_sched* sched) {
+	char** envp = vars_envp();
+	pid_t pid = fork();
+	if (pid != 0) return pid;
+
+	// The child process
+	sigset_t mask;
+	child_sigmask(&mask, background);
+	sigprocmask(SIG_SETMASK, &mask, NULL);
+
+	// Redirect stdin, stdout, and stderr; exit with an error code if unsuccessful
+	if ((in_fd != -1 && dup2(in_fd, STDIN_FILENO) == -1) ||
+	    (out_fd != -1 && dup2(out_fd, STDOUT_FILENO) == -1) ||
+	    (err_fd != -1 && dup2(err_fd, STDERR_FILENO) == -1)) {
+		perror("Redirect");
+		_exit(EXIT_FAILURE);
+	}
+
+	// Apply the scheduling settings; exit with an error code if the kernel refuses them
+	if (sched != NULL && jobsched_apply(sched) == -1) {
+		perror("sched");
+		_exit(EXIT_FAILURE);
+	}
+
+	// Execute the command, searching the directories in PATH if necessary
+	execvpe(file, argv, envp);
+
+	// If exec() returns, the command failed; print an error and exit with an error code
+	perror(file);
+	_exit(EXIT_FAILURE);
+}
+
+// spawn_process
+// Launches a child process with the current engine
+// Parameters: file, the program to run (searched for in PATH if it has no slash);
+//             argv, the NULL-terminated arguments; in_fd, out_fd, and err_fd, descriptors to
+//             become the child's stdin, stdout, and stderr, or -1 to inherit the shell's;
+//             background, whether the child is a background process; sched, the scheduling settings to
+//             apply to the child, or NULL to let it inherit the shell's
+// The child's environment is the variable store's envp, whatever the engine; posix_spawn() has no attributes
+// for affinity, nice levels, or I/O priorities, so a child with settings is launched with vfork() instead
+// Returns: the child's pid, or -1 with errno set if the child could not be started
+pid_t spawn_process(const char* file, char* const argv[], int in_fd, int out_fd, int err_fd, bool background,
+                    const struct job_sched* sched) {
+	if (!jobsched_active(sched)) sched = NULL;
+	switch (spawn_engine) {
+	case SPAWN_FORK:
+		return spawn_fork(file, argv, in_fd, out_fd, err_fd, background, sched);
+	case SPAWN_POSIX:
+		if (sched == NULL) return spawn_posix(file, argv, in_fd, out_fd, err_fd, background);
+		// Fall through
+	default:
+		return spawn_vfork(file, argv, in_fd, out_fd, err_fd, background, sched);
+	}
+}
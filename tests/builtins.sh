@@ -0,0 +1,29 @@
+#!/bin/sh
+# builtins.sh
+# Checks the builtins' edge cases: printf conversions whose flags and width fill its format buffer
+# Prints one line per failed check and exits with 1 if any failed
+# Usage: sh tests/builtins.sh [path to smallsh]
+
+SHELL_BIN=${1:-./smallsh}
+
+TMPDIR=$(mktemp -d)
+trap 'rm -rf "$TMPDIR"' EXIT
+failed=0
+
+# check
+# Runs a command line in smallsh and compares its stdout and stderr with the expected text
+# Usage: check name line expected-stdout expected-stderr
+check() {
+	printf '%s\nexit\n' "$2" > "$TMPDIR/script"
+	"$SHELL_BIN" "$TMPDIR/script" > "$TMPDIR/out" 2> "$TMPDIR/err"
+	if [ "$(cat "$TMPDIR/out")" != "$3" ] || [ "$(cat "$TMPDIR/err")" != "$4" ]; then
+		echo "FAIL $1: got '$(cat "$TMPDIR/out")' and '$(cat "$TMPDIR/err")'"
+		failed=1
+	fi
+}
+
+# The longest flags and width that fit, and one more
+check printf-width-27 "printf '%000000000000000000000000001x\\n' 5" "5" ""
+check printf-width-28 "printf '%0000000000000000000000000001x\\n' 5" "" "printf: invalid format"
+
+exit $failed
@@ -0,0 +1,36 @@
+#!/bin/sh
+# loops.sh
+# Checks that for and repeat loops fill in the loop variable, and that a substitution in a loop's
+# body that uses the loop variable is rejected rather than run without it
+# Prints one line per failed check and exits with 1 if any failed
+# Usage: sh tests/loops.sh [path to smallsh]
+
+SHELL_BIN=${1:-./smallsh}
+
+TMPDIR=$(mktemp -d)
+trap 'rm -rf "$TMPDIR"' EXIT
+failed=0
+
+# check
+# Runs a command line in smallsh and compares its stdout and stderr with the expected text
+# Usage: check name line expected-stdout expected-stderr
+check() {
+	printf '%s\nexit\n' "$2" > "$TMPDIR/script"
+	"$SHELL_BIN" "$TMPDIR/script" > "$TMPDIR/out" 2> "$TMPDIR/err"
+	if [ "$(cat "$TMPDIR/out")" != "$3" ] || [ "$(cat "$TMPDIR/err")" != "$4" ]; then
+		echo "FAIL $1: got '$(cat "$TMPDIR/out")' and '$(cat "$TMPDIR/err")'"
+		failed=1
+	fi
+}
+
+check for 'for x in a b; do echo plain-$x ${x}; done' "$(printf 'plain-a a\nplain-b b')" ""
+check repeat 'repeat 2 echo hi' "$(printf 'hi\nhi')" ""
+check subst 'for x in a b; do echo $(echo sub) $x; done' "$(printf 'sub a\nsub b')" ""
+check subst-var 'for x in a b; do echo $(echo sub-$x) plain-$x; done' "" \
+	'smallsh: $(...) in a loop runs once, before the loop, so it can'"'"'t use $x'
+check subst-braced-var 'for x in a b; do echo "$(echo ${x})"; done' "" \
+	'smallsh: $(...) in a loop runs once, before the loop, so it can'"'"'t use $x'
+check subst-quoted-var 'for x in a; do echo $(echo '"'"'$x'"'"' $xy) $x; done' '$x a' ""
+check summary 'repeat -j 2 3 true' 'repeat: 3 iterations, 3 succeeded, 0 failed' ""
+
+exit $failed
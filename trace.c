@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+// The number of events the ring holds (always a power of two)
+#define TRACE_RING_SIZE 8192
+// The longest detail string kept with an event (such as a command name)
+#define TRACE_DETAIL_MAX 32
+
+// struct trace_event
+// A recorded span
+struct trace_event {
+	const char* name;               // The phase name (a string literal)
+	char detail[TRACE_DETAIL_MAX];  // What the phase worked on, or an empty string
+	uint64_t start;                 // The start time in ns, relative to when tracing was opened
+	uint64_t dur;                   // The duration in ns
+	pid_t tid;                      // The shell's pid for its own phases, or the child's pid for its lifetime
+	long arg;                       // A numeric argument (such as the child's pid), or -1
+};
+
+bool trace_enabled = false;
+
+static FILE* trace_file = NULL;
+static bool json_lines = false;     // Whether the file gets JSON lines instead of a Chrome trace array
+static bool first_event = true;     // Whether no event has been written yet (for the array's commas)
+static pid_t shell_pid = 0;
+static uint64_t origin = 0;         // The monotonic time tracing was opened, in ns
+
+// The ring of events not yet written; the oldest ones are overwritten if it fills between flushes
+static struct trace_event* ring = NULL;
+static unsigned long ring_head = 0; // The index of the oldest event
+static unsigned long ring_count = 0;
+static unsigned long n_dropped = 0;
+
+// trace_ts
+// Converts a CLOCK_MONOTONIC timestamp to trace time
+// Parameters: the timestamp
+// Returns: the timestamp in ns since tracing was opened
+uint64_t trace_ts(const struct timespec* ts) {
+	return (uint64_t) ts->tv_sec * 1000000000u + ts->tv_nsec - origin;
+}
+
+// trace_now
+// Reads the clock for the start or end of a span
+// Parameters: none
+// Returns: the current trace time in ns, or 0 if tracing is off
+uint64_t trace_now(void) {
+	if (trace_enabled == false) return 0;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return trace_ts(&ts);
+}
+
+// trace_open
+// Turns tracing on, writing to the given file
+// Parameters: the trace file's path
+// Returns: 0 if successful, -1 on failure
+int trace_open(const char* path) {
+	trace_file = fopen(path, "w");
+	if (trace_file == NULL) {
+		perror(path);
+		return -1;
+	}
+	ring = (struct trace_event*) malloc(sizeof(struct trace_event) * TRACE_RING_SIZE);
+	if (ring == NULL) {
+		perror("trace");
+		fclose(trace_file);
+		return -1;
+	}
+	// Touch every page of the ring now so the first events don't pay for page faults
+	memset(ring, 0, sizeof(struct trace_event) * TRACE_RING_SIZE);
+
+	size_t len = strlen(path);
+	json_lines = (len >= 6 && strcmp(path + len - 6, ".jsonl") == 0);
+	if (json_lines == false) fputs("[\n", trace_file);
+
+	shell_pid = getpid();
+	origin = 0;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	origin = trace_ts(&ts);
+	trace_enabled = true;
+	return 0;
+}
+
+// trace_span
+// Records a span in the ring; does nothing if tracing is off
+// Parameters: name, the phase name (must outlive the shell, such as a string literal); detail, what the
+//             phase worked on, or NULL; start and end, trace times from trace_now(); tid, the track to show
+//             the span on (0 for the shell itself); arg, a numeric argument, or -1
+// Returns: none
+void trace_span(const char* name, const char* detail, uint64_t start, uint64_t end, pid_t tid, long arg) {
+	if (trace_enabled == false) return;
+
+	// Overwrite the oldest event if the ring is full
+	if (ring_count == TRACE_RING_SIZE) {
+		ring_head = (ring_head + 1) & (TRACE_RING_SIZE - 1);
+		ring_count--;
+		n_dropped++;
+	}
+	struct trace_event* ev = &ring[(ring_head + ring_count) & (TRACE_RING_SIZE - 1)];
+	ring_count++;
+
+	ev->name = name;
+	ev->detail[0] = '\0';
+	if (detail != NULL) {
+		strncpy(ev->detail, detail, TRACE_DETAIL_MAX - 1);
+		ev->detail[TRACE_DETAIL_MAX - 1] = '\0';
+	}
+	ev->start = start;
+	ev->dur = (end > start) ? end - start : 0;
+	ev->tid = (tid == 0) ? shell_pid : tid;
+	ev->arg = arg;
+}
+
+// write_string
+// Writes a string to the trace file as a quoted JSON string
+// Parameters: the string
+// Returns: none
+static void write_string(const char* s) {
+	fputc('"', trace_file);
+	for (const unsigned char* c = (const unsigned char*) s; *c != '\0'; c++) {
+		if (*c == '"' || *c == '\\') {
+			fputc('\\', trace_file);
+			fputc(*c, trace_file);
+		} else if (*c < 0x20) {
+			fprintf(trace_file, "\\u%04x", *c);
+		} else {
+			fputc(*c, trace_file);
+		}
+	}
+	fputc('"', trace_file);
+}
+
+// flush_ring
+// Writes every event in the ring to the trace file and empties the ring
+// Parameters: none
+// Returns: none
+static void flush_ring(void) {
+	for (; ring_count > 0; ring_count--) {
+		struct trace_event* ev = &ring[ring_head];
+		ring_head = (ring_head + 1) & (TRACE_RING_SIZE - 1);
+
+		if (json_lines == false && first_event == false) fputs(",\n", trace_file);
+		first_event = false;
+
+		// Chrome trace times are in microseconds
+		fputs("{\"name\":", trace_file);
+		write_string(ev->name);
+		fprintf(trace_file, ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{",
+		        ev->start / 1e3, ev->dur / 1e3, (int) shell_pid, (int) ev->tid);
+		fputs("\"detail\":", trace_file);
+		write_string(ev->detail);
+		if (ev->arg != -1) fprintf(trace_file, ",\"arg\":%ld", ev->arg);
+		fputs("}}", trace_file);
+		if (json_lines) fputc('\n', trace_file);
+	}
+	fflush(trace_file);
+}
+
+// trace_idle
+// Writes out the recorded events if the ring is at least half full; called where the shell is about to
+// wait anyway, so the writes don't land inside a measured span
+// Parameters: none
+// Returns: none
+void trace_idle(void) {
+	if (trace_enabled && ring_count >= TRACE_RING_SIZE / 2) flush_ring();
+}
+
+// trace_close
+// Writes out the remaining events and closes the trace file
+// Parameters: none
+// Returns: none
+void trace_close(void) {
+	if (trace_enabled == false) return;
+	flush_ring();
+	if (json_lines == false) fputs("\n]\n", trace_file);
+	if (n_dropped > 0) fprintf(stderr, "smallsh: trace: %lu events dropped\n", n_dropped);
+	fclose(trace_file);
+	free(ring);
+	ring = NULL;
+	trace_enabled = false;
+}
@@ -0,0 +1,25 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+
+// The tracer records timed spans of the shell's own work (reading, parsing, launching, waiting)
+// and of each child's lifetime into a preallocated ring. Events are only written out while the
+// shell is idle (waiting for input or for jobs) and at exit, so recording one is a few stores.
+// A trace file ending in ".jsonl" gets one JSON object per line; any other name gets a Chrome
+// trace-event array that can be loaded in chrome://tracing or Perfetto.
+
+// Whether tracing is on
+extern bool trace_enabled;
+
+int trace_open(const char* path);
+uint64_t trace_now(void);
+uint64_t trace_ts(const struct timespec* ts);
+void trace_span(const char* name, const char* detail, uint64_t start, uint64_t end, pid_t tid, long arg);
+void trace_idle(void);
+void trace_close(void);
+
+#endif
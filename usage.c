@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "usage.h"
+
+bool usage_every_job = false;
+
+// usage_init
+// Clears a usage record
+// Parameters: the usage record
+// Returns: none
+void usage_init(struct job_usage* u) {
+	memset(u, 0, sizeof(struct job_usage));
+}
+
+// usage_add
+// Adds one child's resource usage to a job's record: times and context switches are summed,
+// and the largest resident set size is kept; safe to call from a signal handler
+// Parameters: u, the job's usage record; ru, the child's usage from wait4()
+// Returns: none
+void usage_add(struct job_usage* u, const struct rusage* ru) {
+	u->utime.tv_sec += ru->ru_utime.tv_sec;
+	u->utime.tv_usec += ru->ru_utime.tv_usec;
+	if (u->utime.tv_usec >= 1000000) {
+		u->utime.tv_sec++;
+		u->utime.tv_usec -= 1000000;
+	}
+	u->stime.tv_sec += ru->ru_stime.tv_sec;
+	u->stime.tv_usec += ru->ru_stime.tv_usec;
+	if (u->stime.tv_usec >= 1000000) {
+		u->stime.tv_sec++;
+		u->stime.tv_usec -= 1000000;
+	}
+	if (ru->ru_maxrss > u->maxrss) u->maxrss = ru->ru_maxrss;
+	u->nvcsw += ru->ru_nvcsw;
+	u->nivcsw += ru->ru_nivcsw;
+}
+
+// usage_merge
+// Adds a finished stage's usage record to a job's record; the job's wall time is that of its longest stage
+// Parameters: u, the job's usage record; other, the stage's usage record
+// Returns: none
+void usage_merge(struct job_usage* u, const struct job_usage* other) {
+	struct rusage ru = {0};
+	ru.ru_utime = other->utime;
+	ru.ru_stime = other->stime;
+	ru.ru_maxrss = other->maxrss;
+	ru.ru_nvcsw = other->nvcsw;
+	ru.ru_nivcsw = other->nivcsw;
+	usage_add(u, &ru);
+	if (other->wall > u->wall) u->wall = other->wall;
+}
+
+// usage_self
+// Records the resources the shell has used so far, its own and those of the children it has waited for
+// Parameters: the usage record to fill
+// Returns: none
+void usage_self(struct job_usage* u) {
+	struct rusage ru;
+	usage_init(u);
+	if (getrusage(RUSAGE_SELF, &ru) == 0) usage_add(u, &ru);
+	if (getrusage(RUSAGE_CHILDREN, &ru) == 0) usage_add(u, &ru);
+}
+
+// usage_since
+// Turns a record from usage_self() into the resources used since an earlier one; the resident set size
+// stays the largest so far, since it can't be divided
+// Parameters: u, the later record; start, the earlier record
+// Returns: none
+void usage_since(struct job_usage* u, const struct job_usage* start) {
+	timersub(&u->utime, &start->utime, &u->utime);
+	timersub(&u->stime, &start->stime, &u->stime);
+	u->nvcsw -= start->nvcsw;
+	u->nivcsw -= start->nivcsw;
+}
+
+// usage_elapsed
+// Calculates the time between two timestamps; safe to call from a signal handler
+// Parameters: the start and end timestamps
+// Returns: the elapsed time in seconds
+double usage_elapsed(const struct timespec* start, const struct timespec* end) {
+	return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// usage_print
+// Prints a usage record on one line
+// Parameters: stream, the stream to print to; u, the usage record
+// Returns: none
+void usage_print(FILE* stream, const struct job_usage* u) {
+	fprintf(stream, "real %.3fs  user %ld.%03lds  sys %ld.%03lds  maxrss %ld KiB  csw %ld voluntary, %ld involuntary\n",
+	        u->wall, (long) u->utime.tv_sec, (long) u->utime.tv_usec / 1000,
+	        (long) u->stime.tv_sec, (long) u->stime.tv_usec / 1000, u->maxrss, u->nvcsw, u->nivcsw);
+	fflush(stream);
+}
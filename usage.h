@@ -0,0 +1,32 @@
+#ifndef USAGE_H
+#define USAGE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+// struct job_usage
+// The resources used by a job (one child, or every stage of a pipeline)
+struct job_usage {
+	double wall;                // The seconds from launch to reap
+	struct timeval utime;       // The user CPU time
+	struct timeval stime;       // The system CPU time
+	long maxrss;                // The largest resident set size of any child, in KiB
+	long nvcsw;                 // The number of voluntary context switches
+	long nivcsw;                // The number of involuntary context switches
+};
+
+// Whether to print the resource usage of every job as it ends
+extern bool usage_every_job;
+
+void usage_init(struct job_usage* u);
+void usage_add(struct job_usage* u, const struct rusage* ru);
+void usage_merge(struct job_usage* u, const struct job_usage* other);
+void usage_self(struct job_usage* u);
+void usage_since(struct job_usage* u, const struct job_usage* start);
+double usage_elapsed(const struct timespec* start, const struct timespec* end);
+void usage_print(FILE* stream, const struct job_usage* u);
+
+#endif
@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "vars.h"
+
+extern char** environ;
+
+// The number of buckets the table starts with (always a power of two), and the envp slots it starts with
+#define VARS_MIN_BUCKETS 64
+#define ENVP_MIN_CAP 64
+
+// struct var
+// A variable, chained with the other variables in its bucket
+struct var {
+	char* entry;                // "NAME=value", as it appears in envp
+	size_t name_len;            // The length of NAME
+	int index;                  // The variable's slot in envp
+	struct var* next;           // The next variable in the bucket
+};
+
+static struct var** buckets = NULL;
+static int n_buckets = 0;
+
+// The environment for children: n_vars entries followed by NULL, and the variable in each slot
+static char** envp = NULL;
+static struct var** owners = NULL;
+static int n_vars = 0, envp_cap = 0;
+
+// Counts changes to the store, so caches derived from a variable can tell when to look again
+static unsigned long generation = 0;
+static bool initialized = false;
+
+// hash_name
+// Hashes a variable name (FNV-1a)
+// Parameters: name, the name; len, its length
+// Returns: the hash
+static unsigned int hash_name(const char* name, size_t len) {
+	unsigned int h = 2166136261u;
+	for (size_t i = 0; i < len; i++) {
+		h = (h ^ (unsigned char) name[i]) * 16777619u;
+	}
+	return h;
+}
+
+// grow_buckets
+// Doubles the number of buckets and redistributes the variables
+// Parameters: none
+// Returns: 0 if successful, -1 on failure
+static int grow_buckets(void) {
+	int new_n = (n_buckets == 0) ? VARS_MIN_BUCKETS : n_buckets * 2;
+	struct var** new_buckets = (struct var**) calloc(new_n, sizeof(struct var*));
+	if (new_buckets == NULL) return -1;
+
+	for (int i = 0; i < n_buckets; i++) {
+		struct var* v = buckets[i];
+		while (v != NULL) {
+			struct var* next = v->next;
+			unsigned int b = hash_name(v->entry, v->name_len) & (new_n - 1);
+			v->next = new_buckets[b];
+			new_buckets[b] = v;
+			v = next;
+		}
+	}
+	free(buckets);
+	buckets = new_buckets;
+	n_buckets = new_n;
+	return 0;
+}
+
+// find_var
+// Finds a variable in the table
+// Parameters: name, the name; len, its length; link, a pointer to receive the link that points to the variable (may be NULL)
+// Returns: the variable, or NULL if it is not set
+static struct var* find_var(const char* name, size_t len, struct var*** link) {
+	if (n_buckets == 0) return NULL;
+	struct var** l = &buckets[hash_name(name, len) & (n_buckets - 1)];
+	while (*l != NULL && ((*l)->name_len != len || memcmp((*l)->entry, name, len) != 0)) l = &(*l)->next;
+	if (link != NULL) *link = l;
+	return *l;
+}
+
+// make_entry
+// Builds the "NAME=value" string of a variable
+// Parameters: name, the name; len, its length; value, the value
+// Returns: the string on the heap, or NULL on failure
+static char* make_entry(const char* name, size_t len, const char* value) {
+	size_t value_len = strlen(value);
+	char* entry = (char*) malloc(len + value_len + 2);
+	if (entry == NULL) return NULL;
+	memcpy(entry, name, len);
+	entry[len] = '=';
+	memcpy(entry + len + 1, value, value_len + 1);
+	return entry;
+}
+
+// add_var
+// Adds a variable that is not set yet to the table and to the end of envp
+// Parameters: entry, its "NAME=value" string on the heap, which the store takes over; len, the length of NAME
+// Returns: 0 if successful, -1 on failure
+static int add_var(char* entry, size_t len) {
+	// Keep chains short by growing once there are as many variables as buckets
+	if (n_vars + 1 > n_buckets && grow_buckets() == -1) return -1;
+	// Keep a slot free for the NULL that terminates envp
+	if (n_vars + 1 >= envp_cap) {
+		int cap = (envp_cap == 0) ? ENVP_MIN_CAP : envp_cap * 2;
+		char** new_envp = (char**) realloc(envp, sizeof(char*) * cap);
+		if (new_envp == NULL) return -1;
+		envp = new_envp;
+		struct var** new_owners = (struct var**) realloc(owners, sizeof(struct var*) * cap);
+		if (new_owners == NULL) return -1;
+		owners = new_owners;
+		envp_cap = cap;
+	}
+
+	struct var* v = (struct var*) malloc(sizeof(struct var));
+	if (v == NULL) return -1;
+	v->entry = entry;
+	v->name_len = len;
+	v->index = n_vars;
+	unsigned int b = hash_name(entry, len) & (n_buckets - 1);
+	v->next = buckets[b];
+	buckets[b] = v;
+
+	envp[n_vars] = entry;
+	owners[n_vars] = v;
+	envp[++n_vars] = NULL;
+	return 0;
+}
+
+// vars_init
+// Fills the store from the environment the shell started with; the first of duplicate names wins, as with getenv()
+// Parameters: none
+// Returns: none
+static void vars_init(void) {
+	initialized = true;
+	if (grow_buckets() == -1) return;
+	for (char** e = environ; *e != NULL; e++) {
+		const char* eq = strchr(*e, '=');
+		if (eq == NULL || find_var(*e, eq - *e, NULL) != NULL) continue;
+		char* entry = strdup(*e);
+		if (entry == NULL || add_var(entry, eq - *e) == -1) {
+			free(entry);
+			return;
+		}
+	}
+}
+
+// vars_valid_name
+// Checks whether a string is a valid variable name: a letter or underscore, then letters, digits, and underscores
+// Parameters: name, the string; len, its length
+// Returns: true if it is a valid name
+bool vars_valid_name(const char* name, size_t len) {
+	if (len == 0 || (name[0] >= '0' && name[0] <= '9')) return false;
+	for (size_t i = 0; i < len; i++) {
+		char c = name[i];
+		if (!(c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'))) return false;
+	}
+	return true;
+}
+
+// vars_getn
+// Looks up a variable whose name is not null-terminated
+// Parameters: name, the name; len, its length
+// Returns: the value (owned by the store, valid until the variable changes), or NULL if it is not set
+const char* vars_getn(const char* name, size_t len) {
+	if (!initialized) vars_init();
+	struct var* v = find_var(name, len, NULL);
+	return (v != NULL) ? v->entry + len + 1 : NULL;
+}
+
+// vars_get
+// Looks up a variable
+// Parameters: the name
+// Returns: the value (owned by the store, valid until the variable changes), or NULL if it is not set
+const char* vars_get(const char* name) {
+	return vars_getn(name, strlen(name));
+}
+
+// vars_set
+// Sets a variable, replacing its envp entry in place if it was already set
+// Parameters: name, a valid name; value, the value
+// Returns: 0 if successful, -1 on failure
+int vars_set(const char* name, const char* value) {
+	if (!initialized) vars_init();
+	size_t len = strlen(name);
+	char* entry = make_entry(name, len, value);
+	if (entry == NULL) return -1;
+
+	struct var* v = find_var(name, len, NULL);
+	if (v != NULL) {
+		free(v->entry);
+		v->entry = entry;
+		envp[v->index] = entry;
+	} else if (add_var(entry, len) == -1) {
+		free(entry);
+		return -1;
+	}
+	generation++;
+	return 0;
+}
+
+// vars_unset
+// Removes a variable; the last envp entry moves into its slot
+// Parameters: the name
+// Returns: 0 (unsetting a variable that is not set is not an error)
+int vars_unset(const char* name) {
+	if (!initialized) vars_init();
+	struct var** link;
+	struct var* v = find_var(name, strlen(name), &link);
+	if (v == NULL) return 0;
+
+	*link = v->next;
+	int last = --n_vars;
+	envp[v->index] = envp[last];
+	owners[v->index] = owners[last];
+	owners[v->index]->index = v->index;
+	envp[last] = NULL;
+	free(v->entry);
+	free(v);
+	generation++;
+	return 0;
+}
+
+// vars_envp
+// Gets the environment to launch children with
+// Parameters: none
+// Returns: the null-terminated "NAME=value" array (owned by the store, valid until a variable changes)
+char** vars_envp(void) {
+	if (!initialized) vars_init();
+	if (envp == NULL) return environ;
+	return envp;
+}
+
+// vars_generation
+// Gets a counter that changes whenever a variable is set or unset
+// Parameters: none
+// Returns: the counter
+unsigned long vars_generation(void) {
+	return generation;
+}
+
+// vars_print
+// Lists the variables as export commands, quoting each value
+// Parameters: none
+// Returns: none
+void vars_print(void) {
+	if (!initialized) vars_init();
+	for (int i = 0; i < n_vars; i++) {
+		const struct var* v = owners[i];
+		printf("export %.*s='", (int) v->name_len, v->entry);
+		for (const char* c = v->entry + v->name_len + 1; *c != '\0'; c++) {
+			if (*c == '\'') {
+				fputs("'\\''", stdout);
+			} else {
+				putchar(*c);
+			}
+		}
+		printf("'\n");
+	}
+	fflush(stdout);
+}
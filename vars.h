@@ -0,0 +1,21 @@
+#ifndef VARS_H
+#define VARS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// The variable store holds the shell's variables, which are all exported, in a hash table filled
+// from the environment the shell started with. Alongside it, the store keeps the envp array that
+// children are launched with, updated in place as variables change, so a launch never has to
+// rebuild the environment.
+
+bool vars_valid_name(const char* name, size_t len);
+const char* vars_getn(const char* name, size_t len);
+const char* vars_get(const char* name);
+int vars_set(const char* name, const char* value);
+int vars_unset(const char* name);
+char** vars_envp(void);
+unsigned long vars_generation(void);
+void vars_print(void);
+
+#endif